@@ -6,14 +6,43 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <stdexcept>
+#include <vector>
 #include "bst.h"
+#include "frozenbst.h"
 
 struct KeyError { };
 
+/**
+* Runs both halves of a fork in turn on the calling thread. The set
+* operations of AVLTree accept any executor with the same invoke, such
+* as the ForkJoinPool in fork_join_pool.h.
+*/
+struct SerialExecutor
+{
+    template<typename F, typename G>
+    void invoke(F f, G g)
+    {
+        f();
+        g();
+    }
+};
+
+// The AVLTree set operations only fork when both subtrees are at least
+// this tall, i.e. hold at least a few hundred keys
+#ifndef AVL_PARALLEL_GRAIN_HEIGHT
+#define AVL_PARALLEL_GRAIN_HEIGHT 10
+#endif
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
+*
+* Compiling with -DAVL_PACKED_BALANCE drops the balance_ member and keeps the balance
+* in the low bits of the parent pointer instead (see Node in bst.h), which saves a
+* word per node. Balances are stored offset by 2 so the transient +/-2 seen during
+* insert fits in the three bits freed up by 8-byte node alignment.
 */
 template <typename Key, typename Value>
 class AVLNode : public Node<Key, Value>
@@ -21,7 +50,8 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(typename Node<Key, Value>::ItemMaker make, void* context, AVLNode<Key, Value>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
@@ -29,14 +59,18 @@ public:
     void updateBalance(int8_t diff);
 
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide the Node versions
+    // rather than override them; see the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
+#ifdef AVL_PACKED_BALANCE
+    static const int8_t PACKED_BALANCE_BIAS = 2;
+#else
     int8_t balance_;    // effectively a signed char
+#endif
 };
 
 /*
@@ -50,10 +84,36 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
+#ifdef AVL_PACKED_BALANCE
+    Node<Key, Value>(key, value, parent)
+{
+    static_assert(alignof(Node<Key, Value>) > Node<Key, Value>::PACKED_TAG_MASK,
+                  "AVL_PACKED_BALANCE needs 8-byte aligned nodes");
+    setBalance(0);
+}
+#else
     Node<Key, Value>(key, value, parent), balance_(0)
 {
 
 }
+#endif
+
+/**
+* A constructor that builds the item in place; see Node.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(typename Node<Key, Value>::ItemMaker make, void* context, AVLNode<Key, Value> *parent) :
+#ifdef AVL_PACKED_BALANCE
+    Node<Key, Value>(make, context, parent)
+{
+    setBalance(0);
+}
+#else
+    Node<Key, Value>(make, context, parent), balance_(0)
+{
+
+}
+#endif
 
 /**
 * A destructor which does nothing.
@@ -70,7 +130,11 @@ AVLNode<Key, Value>::~AVLNode()
 template<class Key, class Value>
 int8_t AVLNode<Key, Value>::getBalance() const
 {
+#ifdef AVL_PACKED_BALANCE
+    return int8_t(this->parent_ & Node<Key, Value>::PACKED_TAG_MASK) - PACKED_BALANCE_BIAS;
+#else
     return balance_;
+#endif
 }
 
 /**
@@ -79,7 +143,12 @@ int8_t AVLNode<Key, Value>::getBalance() const
 template<class Key, class Value>
 void AVLNode<Key, Value>::setBalance(int8_t balance)
 {
+#ifdef AVL_PACKED_BALANCE
+    this->parent_ = (this->parent_ & ~Node<Key, Value>::PACKED_TAG_MASK)
+        | uintptr_t(balance + PACKED_BALANCE_BIAS);
+#else
     balance_ = balance;
+#endif
 }
 
 /**
@@ -88,21 +157,25 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 template<class Key, class Value>
 void AVLNode<Key, Value>::updateBalance(int8_t diff)
 {
+#ifdef AVL_PACKED_BALANCE
+    setBalance(getBalance() + diff);
+#else
     balance_ += diff;
+#endif
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A redefined function for getting the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value>*>(Node<Key, Value>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +184,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -127,24 +200,1048 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare>
 {
 public:
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    template<typename Iterator>
+    AVLTree(Iterator first, Iterator last, const Compare& comp = Compare());
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    using BinarySearchTree<Key, Value, Compare>::insert;
     virtual void remove(const Key& key);  // TODO
+    template<typename Iterator>
+    void buildFromSorted(Iterator first, Iterator last);
+    template<typename Iterator>
+    void insertBatch(Iterator first, Iterator last);
+    void split(const Key& key, AVLTree<Key, Value, Compare>& less, AVLTree<Key, Value, Compare>& greater);
+    void join(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right);
+    FrozenTree<Key, Value, Compare> freeze() const;
+
+    template<typename Executor>
+    void setUnion(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right, Executor& executor);
+    template<typename Executor>
+    void setIntersection(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right, Executor& executor);
+    template<typename Executor>
+    void setDifference(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right, Executor& executor);
+    void setUnion(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right);
+    void setIntersection(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right);
+    void setDifference(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right);
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key,
+                                         const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                         bool& inserted);
+    virtual Node<Key, Value>* newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make, void* context);
+    virtual int heightAt(Node<Key, Value>* top) const;
+    virtual bool balancedAt(Node<Key, Value>* top) const;
 
     // Add helper functions here
     void rotateLeft(AVLNode <Key, Value>* upperNode);
     void rotateRight(AVLNode <Key, Value>* upperNode);
+    template<typename Iterator>
+    AVLNode<Key, Value>* buildSubtree(Iterator& curr, Iterator last, size_t count,
+                                      AVLNode<Key, Value>* parent, int& height);
+    AVLNode<Key, Value>* linkSubtree(AVLNode<Key, Value>** nodes, size_t count,
+                                     AVLNode<Key, Value>* parent, int& height);
+    AVLNode<Key, Value>* mergeSorted(AVLNode<Key, Value>* top, int topHeight,
+                                     AVLNode<Key, Value>** nodes, size_t count, int& height,
+                                     AVLNode<Key, Value>* before, AVLNode<Key, Value>* after,
+                                     std::vector<std::pair<AVLNode<Key, Value>*, AVLNode<Key, Value>*> >& matched);
+    AVLNode<Key, Value>* joinAt(AVLNode<Key, Value>* leftTree, int leftHeight,
+                                AVLNode<Key, Value>* middle,
+                                AVLNode<Key, Value>* rightTree, int rightHeight, int& height);
+    void splitAt(AVLNode<Key, Value>* top, int topHeight, const Key& key,
+                 AVLNode<Key, Value>*& less, int& lessHeight, AVLNode<Key, Value>*& found,
+                 AVLNode<Key, Value>*& greater, int& greaterHeight);
+    AVLNode<Key, Value>* splitLast(AVLNode<Key, Value>* top, int topHeight,
+                                   AVLNode<Key, Value>*& last, int& height);
+    AVLNode<Key, Value>* joinPair(AVLNode<Key, Value>* leftTree, int leftHeight,
+                                  AVLNode<Key, Value>* rightTree, int rightHeight, int& height);
+
+    // Nodes dropped by the set operations, chained through the parent
+    // links of their subtree roots so that parallel tasks can collect
+    // them without allocating or touching the node pool
+    struct DiscardList
+    {
+        AVLNode<Key, Value>* head;
+        AVLNode<Key, Value>* tail;
+
+        DiscardList() : head(nullptr), tail(nullptr) { }
+        void addSubtree(AVLNode<Key, Value>* top);
+        void addNode(AVLNode<Key, Value>* node);
+        void append(DiscardList& other);
+    };
+    void destroyDiscarded(DiscardList& discarded);
+    void takeOperands(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right,
+                      AVLNode<Key, Value>*& leftRoot, int& leftHeight,
+                      AVLNode<Key, Value>*& rightRoot, int& rightHeight);
+    template<typename Executor, typename F, typename G>
+    static void fork(Executor& executor, int height, F f, G g);
+    template<typename Executor>
+    AVLNode<Key, Value>* unionAt(AVLNode<Key, Value>* a, int aHeight, AVLNode<Key, Value>* b, int bHeight,
+                                 int& height, DiscardList& discarded, Executor& executor);
+    template<typename Executor>
+    AVLNode<Key, Value>* intersectionAt(AVLNode<Key, Value>* a, int aHeight, AVLNode<Key, Value>* b, int bHeight,
+                                        int& height, DiscardList& discarded, Executor& executor);
+    template<typename Executor>
+    AVLNode<Key, Value>* differenceAt(AVLNode<Key, Value>* a, int aHeight, AVLNode<Key, Value>* b, int bHeight,
+                                      int& height, DiscardList& discarded, Executor& executor);
+    bool insertFix(AVLNode<Key, Value>* grown);
+    static void linkChildren(AVLNode<Key, Value>* node, AVLNode<Key, Value>* left,
+                             AVLNode<Key, Value>* right, int8_t balance);
+    static AVLNode<Key, Value>* detach(AVLNode<Key, Value>* node);
+    static int subtreeHeight(AVLNode<Key, Value>* node);
 
 
 };
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft (AVLNode <Key, Value>* upperNode)
+/**
+* Default constructor, which sets the node pool up for AVLNodes.
+*/
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), alignof(AVLNode<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<AVLNode<Key, Value> >)
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+AVLTree<Key, Value, Compare>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), alignof(AVLNode<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<AVLNode<Key, Value> >, comp)
+{
+
+}
+
+/**
+* Constructs a tree from a range sorted by key under comp; see
+* buildFromSorted.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+AVLTree<Key, Value, Compare>::AVLTree(Iterator first, Iterator last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), alignof(AVLNode<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<AVLNode<Key, Value> >, comp)
+{
+    buildFromSorted(first, last);
+}
+
+/**
+* Replaces the contents of the tree with the key/value pairs in
+* [first, last), which must be sorted by key. As with insert, the
+* last of several equal keys wins.
+*
+* The tree is built directly in its final, height-balanced shape in
+* O(n) with no comparisons beyond an order check and no rotations.
+* Nodes are created in key order, so they sit next to their in-order
+* neighbours in memory and a full scan walks the pool sequentially.
+* Throws std::invalid_argument (leaving the tree untouched) if the
+* range is not sorted; if copying a key or value throws, the tree is
+* left empty.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+void AVLTree<Key, Value, Compare>::buildFromSorted(Iterator first, Iterator last)
+{
+    //count the distinct keys, checking the order on the way
+    size_t count = 0;
+    for (Iterator curr = first; curr != last; ){
+        Iterator next = curr;
+        ++next;
+        if (next != last && this->comp_(next->first, curr->first)){
+            throw std::invalid_argument("buildFromSorted: range is not sorted");
+        }
+        if (next == last || this->comp_(curr->first, next->first)){
+            ++count;
+        }
+        curr = next;
+    }
+
+    this->clear();
+    int height = 0;
+    this->adoptRoot(buildSubtree(first, last, count, static_cast<AVLNode<Key, Value>*>(nullptr), height));
+    this->relinkThreads();
+}
+
+/**
+* Builds a perfectly balanced subtree from the next count distinct keys
+* starting at curr, and advances curr past them. The left side gets the
+* smaller half, so every balance is 0 or -1. Returns the subtree's root
+* and sets height to its height.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::buildSubtree(Iterator& curr, Iterator last, size_t count,
+                                                       AVLNode<Key, Value>* parent, int& height)
+{
+    if (count == 0){
+        height = 0;
+        return nullptr;
+    }
+
+    size_t leftCount = (count - 1) / 2;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    AVLNode<Key, Value>* leftChild = buildSubtree(curr, last, leftCount, static_cast<AVLNode<Key, Value>*>(nullptr), leftHeight);
+
+    //skip to the last of a run of equal keys
+    Iterator next = curr;
+    ++next;
+    while (next != last && !this->comp_(curr->first, next->first)){
+        curr = next;
+        ++next;
+    }
+
+    AVLNode<Key, Value>* node;
+    try {
+        node = this->createNode(curr->first, curr->second, parent);
+    }
+    catch(...) {
+        this->destroySubtree(leftChild);
+        throw;
+    }
+    curr = next;
+
+    node->setLeft(leftChild);
+    if (leftChild != nullptr){
+        leftChild->setParent(node);
+    }
+
+    try {
+        node->setRight(buildSubtree(curr, last, count - 1 - leftCount, node, rightHeight));
+    }
+    catch(...) {
+        this->destroySubtree(node);
+        throw;
+    }
+
+    node->setBalance(int8_t(leftHeight - rightHeight));
+    node->updateSize();
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/**
+* Inserts every pair in [first, last), in any order, with the same
+* last-writer-wins semantics as calling insert on each in turn.
+*
+* The batch is sorted and its nodes are created up front, then merged
+* into the tree in one recursive pass: each tree node splits the sorted
+* batch by binary search, both halves are merged into its subtrees, and
+* the results are joined back under it. Only the parts of the tree the
+* batch actually lands in are visited, so the whole merge costs
+* O(m log(n/m + 1)) for m new keys instead of O(m log n), and rebalancing
+* is a short retrace per join rather than per key. An existing key keeps
+* its node and has its value assigned, as with insert, so iterators and
+* references to it stay valid. If copying a key or value into a new node
+* throws, the tree is left untouched; if assigning an existing key's
+* value throws, the values assigned before it stay assigned.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+void AVLTree<Key, Value, Compare>::insertBatch(Iterator first, Iterator last)
+{
+    //sort positions rather than copies of the pairs; the stable sort
+    //keeps equal keys in input order so the last one can win
+    std::vector<Iterator> batch;
+    for (Iterator curr = first; curr != last; ++curr){
+        batch.push_back(curr);
+    }
+    if (batch.empty()){
+        return;
+    }
+    std::stable_sort(batch.begin(), batch.end(),
+        [this](const Iterator& a, const Iterator& b) { return this->comp_(a->first, b->first); });
+
+    //create the nodes before touching the tree so a throwing copy only
+    //has to undo them
+    std::vector<AVLNode<Key, Value>*> nodes;
+    nodes.reserve(batch.size());
+    try {
+        for (size_t i = 0; i < batch.size(); ++i){
+            //only the last of a run of equal keys matters
+            if (i + 1 < batch.size() && !this->comp_(batch[i]->first, batch[i + 1]->first)){
+                continue;
+            }
+            nodes.push_back(this->template createNode<AVLNode<Key, Value> >(
+                batch[i]->first, batch[i]->second, nullptr));
+        }
+    }
+    catch(...) {
+        for (size_t i = 0; i < nodes.size(); ++i){
+            this->destroyNode(nodes[i]);
+        }
+        throw;
+    }
+
+    //the tree's node and the batch's node for each key already present;
+    //values are only assigned once the tree is whole again
+    std::vector<std::pair<AVLNode<Key, Value>*, AVLNode<Key, Value>*> > matched;
+    try {
+        matched.reserve(nodes.size());
+    }
+    catch(...) {
+        for (size_t i = 0; i < nodes.size(); ++i){
+            this->destroyNode(nodes[i]);
+        }
+        throw;
+    }
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    int height = 0;
+    this->adoptRoot(mergeSorted(root, subtreeHeight(root), nodes.data(), nodes.size(), height,
+                                nullptr, nullptr, matched));
+
+    size_t i = 0;
+    try {
+        for (; i < matched.size(); ++i){
+            matched[i].first->getValue() = std::move(matched[i].second->getValue());
+            this->destroyNode(matched[i].second);
+        }
+    }
+    catch(...) {
+        for (; i < matched.size(); ++i){
+            this->destroyNode(matched[i].second);
+        }
+        throw;
+    }
+}
+
+/**
+* Merges count detached nodes, sorted by distinct key, into the subtree
+* at top (whose height is topHeight) and returns the merged subtree's
+* root, setting height to its height. A tree node whose key is also in
+* the array stays in place, and the pair of it and the array's node,
+* which is left unlinked, is added to matched. before and after are the
+* tree's nodes just outside the subtree in key order, if any, which the
+* new nodes are threaded in between.
+*/
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::mergeSorted(AVLNode<Key, Value>* top, int topHeight,
+                                                      AVLNode<Key, Value>** nodes, size_t count,
+                                                      int& height,
+                                                      AVLNode<Key, Value>* before, AVLNode<Key, Value>* after,
+                                                      std::vector<std::pair<AVLNode<Key, Value>*, AVLNode<Key, Value>*> >& matched)
+{
+    if (count == 0){
+        height = topHeight;
+        return top;
+    }
+    if (top == nullptr){
+        //an empty spot means before and after are neighbours so far
+        for (size_t i = 0; i < count; ++i){
+            this->threadBetween(i == 0 ? before : nodes[i - 1], nodes[i]);
+        }
+        this->threadBetween(nodes[count - 1], after);
+        return linkSubtree(nodes, count, nullptr, height);
+    }
+
+    //the children's heights follow from the balance
+    int leftHeight = top->getBalance() >= 0 ? topHeight - 1 : topHeight - 2;
+    int rightHeight = top->getBalance() <= 0 ? topHeight - 1 : topHeight - 2;
+
+    //split the array around top's key
+    size_t mid = 0;
+    size_t hi = count;
+    while (mid < hi){
+        size_t probe = mid + (hi - mid) / 2;
+        if (this->comp_(nodes[probe]->getKey(), top->getKey())){
+            mid = probe + 1;
+        }
+        else{
+            hi = probe;
+        }
+    }
+
+    AVLNode<Key, Value>* leftChild = detach(top->getLeft());
+    AVLNode<Key, Value>* rightChild = detach(top->getRight());
+    size_t rightStart = mid;
+    if (mid < count && !this->comp_(top->getKey(), nodes[mid]->getKey())){
+        //top keeps its place and later takes the batch node's value
+        matched.push_back(std::make_pair(top, nodes[mid]));
+        rightStart = mid + 1;
+    }
+
+    leftChild = mergeSorted(leftChild, leftHeight, nodes, mid, leftHeight, before, top, matched);
+    rightChild = mergeSorted(rightChild, rightHeight, nodes + rightStart, count - rightStart, rightHeight,
+                             top, after, matched);
+    return joinAt(leftChild, leftHeight, top, rightChild, rightHeight, height);
+}
+
+/**
+* Joins two detached subtrees whose keys are all less than and all
+* greater than middle's key, with middle as the node between them.
+* Takes the subtrees' heights and returns the new subtree's root,
+* setting height to its height.
+*
+* When the heights differ by more than one, middle is hung off the
+* spine of the taller subtree at the first node no taller than the
+* shorter subtree plus one, and the usual insert retrace restores the
+* balances above it. This costs O(|leftHeight - rightHeight| + 1).
+*/
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::joinAt(AVLNode<Key, Value>* leftTree, int leftHeight,
+                                                 AVLNode<Key, Value>* middle,
+                                                 AVLNode<Key, Value>* rightTree, int rightHeight,
+                                                 int& height)
+{
+    if (leftHeight > rightHeight + 1){
+        //walk down the left tree's right spine
+        AVLNode<Key, Value>* above = nullptr;
+        AVLNode<Key, Value>* curr = leftTree;
+        int currHeight = leftHeight;
+        while (currHeight > rightHeight + 1){
+            above = curr;
+            currHeight -= curr->getBalance() == 1 ? 2 : 1;
+            curr = curr->getRight();
+        }
+        linkChildren(middle, curr, rightTree, int8_t(currHeight - rightHeight));
+        middle->setParent(above);
+        above->setRight(middle);
+        this->updateSizesUpward(above);
+
+        //a rotation at the top moves leftTree down under the new root
+        height = leftHeight + (insertFix(middle) ? 1 : 0);
+        return leftTree->getParent() == nullptr ? leftTree : leftTree->getParent();
+    }
+    if (rightHeight > leftHeight + 1){
+        //walk down the right tree's left spine
+        AVLNode<Key, Value>* above = nullptr;
+        AVLNode<Key, Value>* curr = rightTree;
+        int currHeight = rightHeight;
+        while (currHeight > leftHeight + 1){
+            above = curr;
+            currHeight -= curr->getBalance() == -1 ? 2 : 1;
+            curr = curr->getLeft();
+        }
+        linkChildren(middle, leftTree, curr, int8_t(leftHeight - currHeight));
+        middle->setParent(above);
+        above->setLeft(middle);
+        this->updateSizesUpward(above);
+
+        height = rightHeight + (insertFix(middle) ? 1 : 0);
+        return rightTree->getParent() == nullptr ? rightTree : rightTree->getParent();
+    }
+
+    linkChildren(middle, leftTree, rightTree, int8_t(leftHeight - rightHeight));
+    middle->setParent(nullptr);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return middle;
+}
+
+/**
+* Makes left and right the children of node and sets its balance.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::linkChildren(AVLNode<Key, Value>* node, AVLNode<Key, Value>* left,
+                                       AVLNode<Key, Value>* right, int8_t balance)
+{
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != nullptr){
+        left->setParent(node);
+    }
+    if (right != nullptr){
+        right->setParent(node);
+    }
+    node->setBalance(balance);
+    node->updateSize();
+}
+
+/**
+* Cuts a subtree loose from its parent's side (the parent's own child
+* link is left for the caller to overwrite) and returns it.
+*/
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::detach(AVLNode<Key, Value>* node)
+{
+    if (node != nullptr){
+        node->setParent(nullptr);
+    }
+    return node;
+}
+
+/**
+* Moves every key less than key into less and every other key into
+* greater, leaving this tree empty. Whatever less and greater held
+* before is cleared; either of them may be this tree itself.
+*
+* Runs in O(log n): the search path for key is cut out of the tree and
+* the subtrees hanging off it are joined back up on each side. No node
+* is copied or reallocated; all three trees share one node pool after.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::split(const Key& key, AVLTree<Key, Value, Compare>& less, AVLTree<Key, Value, Compare>& greater)
+{
+    if (&less == &greater){
+        throw std::invalid_argument("split: less and greater must be different trees");
+    }
+    if (&less != this){
+        less.clear();
+    }
+    if (&greater != this){
+        greater.clear();
+    }
+    less.sharePool(*this);
+    greater.sharePool(*this);
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* lessRoot = nullptr;
+    AVLNode<Key, Value>* found = nullptr;
+    AVLNode<Key, Value>* greaterRoot = nullptr;
+    int lessHeight = 0;
+    int greaterHeight = 0;
+    splitAt(root, subtreeHeight(root), key, lessRoot, lessHeight, found, greaterRoot, greaterHeight);
+    if (found != nullptr){
+        //key itself is the smallest of the greater keys
+        greaterRoot = joinAt(nullptr, 0, found, greaterRoot, greaterHeight, greaterHeight);
+    }
+
+    this->adoptRoot(nullptr);
+    less.adoptRoot(lessRoot);
+    greater.adoptRoot(greaterRoot);
+}
+
+/**
+* Replaces the contents of this tree with all of left's keys followed
+* by all of right's, leaving left and right empty. Every key in left
+* must be less than every key in right, or std::invalid_argument is
+* thrown and nothing changes. Either input may be this tree itself.
+*
+* Runs in O(log n): the largest node of left is cut out and used to
+* join the two trees, without copying or reallocating any node.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::join(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right)
+{
+    AVLNode<Key, Value>* leftRoot = static_cast<AVLNode<Key, Value>*>(left.root_);
+    AVLNode<Key, Value>* rightRoot = static_cast<AVLNode<Key, Value>*>(right.root_);
+    Node<Key, Value>* leftMax = left.rightmost_;
+    Node<Key, Value>* rightMin = right.leftmost_;
+    if (leftRoot != nullptr && rightRoot != nullptr){
+        if (!this->comp_(leftMax->getKey(), rightMin->getKey())){
+            throw std::invalid_argument("join: key ranges overlap");
+        }
+    }
+
+    if (this != &left && this != &right){
+        this->clear();
+    }
+    this->sharePool(left);
+    this->sharePool(right);
+    this->threadBetween(leftMax, rightMin);
+    left.adoptRoot(nullptr);
+    right.adoptRoot(nullptr);
+
+    int height = 0;
+    this->adoptRoot(joinPair(leftRoot, subtreeHeight(leftRoot), rightRoot, subtreeHeight(rightRoot), height));
+}
+
+/**
+* Returns a read-only snapshot of the tree's items, laid out for fast
+* lookups. It is a copy: later changes to this tree do not show in it.
+* Takes O(n) time and copies every key twice, once for the search
+* array and once with its value.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare> AVLTree<Key, Value, Compare>::freeze() const
+{
+    return FrozenTree<Key, Value, Compare>(this->begin(), this->end(), this->comp_);
+}
+
+/**
+* Cuts the largest node out of left and joins the two detached subtrees
+* with it; every key of left must be less than every key of right.
+*/
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::joinPair(AVLNode<Key, Value>* leftTree, int leftHeight,
+                                                   AVLNode<Key, Value>* rightTree, int rightHeight, int& height)
+{
+    if (leftTree == nullptr){
+        height = rightHeight;
+        return rightTree;
+    }
+    if (rightTree == nullptr){
+        height = leftHeight;
+        return leftTree;
+    }
+    AVLNode<Key, Value>* last = nullptr;
+    AVLNode<Key, Value>* rest = splitLast(leftTree, leftHeight, last, leftHeight);
+    return joinAt(rest, leftHeight, last, rightTree, rightHeight, height);
+}
+
+/**
+* Replaces the contents of this tree with the union of left and right,
+* leaving both empty. A key in both keeps right's value, as if right
+* had been inserted into left. Either input may be this tree itself.
+*
+* Like the other set operations this is join based: the second tree's
+* root splits the first tree, the two halves are combined with its
+* subtrees recursively, and the results are joined back under it. That
+* takes O(m log(n/m + 1)) work for trees of m <= n keys, and the two
+* recursive calls are independent, so executor may run them in parallel
+* for polylogarithmic span. Nodes are reused, never copied; the ones
+* dropped are destroyed on the calling thread at the end. With
+* BST_THREADED the result is rethreaded in one O(n) pass after that.
+*/
+template<class Key, class Value, class Compare>
+template<typename Executor>
+void AVLTree<Key, Value, Compare>::setUnion(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right, Executor& executor)
+{
+    if (&left == &right){
+        AVLTree<Key, Value, Compare> empty;
+        join(left, empty);
+        return;
+    }
+    AVLNode<Key, Value>* a = nullptr;
+    AVLNode<Key, Value>* b = nullptr;
+    int aHeight = 0;
+    int bHeight = 0;
+    takeOperands(left, right, a, aHeight, b, bHeight);
+
+    DiscardList discarded;
+    int height = 0;
+    this->adoptRoot(unionAt(a, aHeight, b, bHeight, height, discarded, executor));
+    this->relinkThreads();
+    destroyDiscarded(discarded);
+}
+
+/**
+* Replaces the contents of this tree with the keys of left that are
+* also in right, keeping left's values, and leaves both empty. See
+* setUnion for how it runs.
+*/
+template<class Key, class Value, class Compare>
+template<typename Executor>
+void AVLTree<Key, Value, Compare>::setIntersection(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right, Executor& executor)
+{
+    if (&left == &right){
+        AVLTree<Key, Value, Compare> empty;
+        join(left, empty);
+        return;
+    }
+    AVLNode<Key, Value>* a = nullptr;
+    AVLNode<Key, Value>* b = nullptr;
+    int aHeight = 0;
+    int bHeight = 0;
+    takeOperands(left, right, a, aHeight, b, bHeight);
+
+    DiscardList discarded;
+    int height = 0;
+    this->adoptRoot(intersectionAt(a, aHeight, b, bHeight, height, discarded, executor));
+    this->relinkThreads();
+    destroyDiscarded(discarded);
+}
+
+/**
+* Replaces the contents of this tree with the keys of left that are not
+* in right, keeping left's values, and leaves both empty. See setUnion
+* for how it runs.
+*/
+template<class Key, class Value, class Compare>
+template<typename Executor>
+void AVLTree<Key, Value, Compare>::setDifference(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right, Executor& executor)
+{
+    if (&left == &right){
+        left.clear();
+        this->clear();
+        return;
+    }
+    AVLNode<Key, Value>* a = nullptr;
+    AVLNode<Key, Value>* b = nullptr;
+    int aHeight = 0;
+    int bHeight = 0;
+    takeOperands(left, right, a, aHeight, b, bHeight);
+
+    DiscardList discarded;
+    int height = 0;
+    this->adoptRoot(differenceAt(a, aHeight, b, bHeight, height, discarded, executor));
+    this->relinkThreads();
+    destroyDiscarded(discarded);
+}
+
+/**
+* Serial versions of the set operations.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::setUnion(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right)
+{
+    SerialExecutor serial;
+    setUnion(left, right, serial);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::setIntersection(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right)
+{
+    SerialExecutor serial;
+    setIntersection(left, right, serial);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::setDifference(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right)
+{
+    SerialExecutor serial;
+    setDifference(left, right, serial);
+}
+
+/**
+* Detaches the roots of two distinct operand trees, after clearing this
+* tree unless it is one of them, and makes all three share a pool.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::takeOperands(AVLTree<Key, Value, Compare>& left, AVLTree<Key, Value, Compare>& right,
+                                       AVLNode<Key, Value>*& leftRoot, int& leftHeight,
+                                       AVLNode<Key, Value>*& rightRoot, int& rightHeight)
+{
+    if (this != &left && this != &right){
+        this->clear();
+    }
+    this->sharePool(left);
+    this->sharePool(right);
+
+    leftRoot = static_cast<AVLNode<Key, Value>*>(left.root_);
+    rightRoot = static_cast<AVLNode<Key, Value>*>(right.root_);
+    leftHeight = subtreeHeight(leftRoot);
+    rightHeight = subtreeHeight(rightRoot);
+    left.adoptRoot(nullptr);
+    right.adoptRoot(nullptr);
+}
+
+/**
+* Runs f and g through the executor when the subtrees they work on are
+* big enough to be worth a fork, and in turn otherwise.
+*/
+template<class Key, class Value, class Compare>
+template<typename Executor, typename F, typename G>
+void AVLTree<Key, Value, Compare>::fork(Executor& executor, int height, F f, G g)
+{
+    if (height >= AVL_PARALLEL_GRAIN_HEIGHT){
+        executor.invoke(f, g);
+    }
+    else{
+        f();
+        g();
+    }
+}
+
+template<class Key, class Value, class Compare>
+template<typename Executor>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::unionAt(AVLNode<Key, Value>* a, int aHeight,
+                                                  AVLNode<Key, Value>* b, int bHeight,
+                                                  int& height, DiscardList& discarded, Executor& executor)
+{
+    if (a == nullptr){
+        height = bHeight;
+        return b;
+    }
+    if (b == nullptr){
+        height = aHeight;
+        return a;
+    }
+
+    int bLeftHeight = b->getBalance() >= 0 ? bHeight - 1 : bHeight - 2;
+    int bRightHeight = b->getBalance() <= 0 ? bHeight - 1 : bHeight - 2;
+    AVLNode<Key, Value>* bLeft = detach(b->getLeft());
+    AVLNode<Key, Value>* bRight = detach(b->getRight());
+
+    AVLNode<Key, Value>* aLess = nullptr;
+    AVLNode<Key, Value>* aFound = nullptr;
+    AVLNode<Key, Value>* aGreater = nullptr;
+    int aLessHeight = 0;
+    int aGreaterHeight = 0;
+    splitAt(a, aHeight, b->getKey(), aLess, aLessHeight, aFound, aGreater, aGreaterHeight);
+    if (aFound != nullptr){
+        //b's node stands for the key
+        discarded.addNode(aFound);
+    }
+
+    AVLNode<Key, Value>* leftTree = nullptr;
+    AVLNode<Key, Value>* rightTree = nullptr;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    DiscardList rightDiscarded;
+    fork(executor, std::min(aHeight, bHeight),
+        [&]() { leftTree = unionAt(aLess, aLessHeight, bLeft, bLeftHeight, leftHeight, discarded, executor); },
+        [&]() { rightTree = unionAt(aGreater, aGreaterHeight, bRight, bRightHeight, rightHeight, rightDiscarded, executor); });
+    discarded.append(rightDiscarded);
+    return joinAt(leftTree, leftHeight, b, rightTree, rightHeight, height);
+}
+
+template<class Key, class Value, class Compare>
+template<typename Executor>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::intersectionAt(AVLNode<Key, Value>* a, int aHeight,
+                                                         AVLNode<Key, Value>* b, int bHeight,
+                                                         int& height, DiscardList& discarded, Executor& executor)
+{
+    if (a == nullptr || b == nullptr){
+        discarded.addSubtree(a);
+        discarded.addSubtree(b);
+        height = 0;
+        return nullptr;
+    }
+
+    int bLeftHeight = b->getBalance() >= 0 ? bHeight - 1 : bHeight - 2;
+    int bRightHeight = b->getBalance() <= 0 ? bHeight - 1 : bHeight - 2;
+    AVLNode<Key, Value>* bLeft = detach(b->getLeft());
+    AVLNode<Key, Value>* bRight = detach(b->getRight());
+
+    AVLNode<Key, Value>* aLess = nullptr;
+    AVLNode<Key, Value>* aFound = nullptr;
+    AVLNode<Key, Value>* aGreater = nullptr;
+    int aLessHeight = 0;
+    int aGreaterHeight = 0;
+    splitAt(a, aHeight, b->getKey(), aLess, aLessHeight, aFound, aGreater, aGreaterHeight);
+    discarded.addNode(b);
+
+    AVLNode<Key, Value>* leftTree = nullptr;
+    AVLNode<Key, Value>* rightTree = nullptr;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    DiscardList rightDiscarded;
+    fork(executor, std::min(aHeight, bHeight),
+        [&]() { leftTree = intersectionAt(aLess, aLessHeight, bLeft, bLeftHeight, leftHeight, discarded, executor); },
+        [&]() { rightTree = intersectionAt(aGreater, aGreaterHeight, bRight, bRightHeight, rightHeight, rightDiscarded, executor); });
+    discarded.append(rightDiscarded);
+    if (aFound != nullptr){
+        return joinAt(leftTree, leftHeight, aFound, rightTree, rightHeight, height);
+    }
+    return joinPair(leftTree, leftHeight, rightTree, rightHeight, height);
+}
+
+template<class Key, class Value, class Compare>
+template<typename Executor>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::differenceAt(AVLNode<Key, Value>* a, int aHeight,
+                                                       AVLNode<Key, Value>* b, int bHeight,
+                                                       int& height, DiscardList& discarded, Executor& executor)
+{
+    if (a == nullptr || b == nullptr){
+        discarded.addSubtree(b);
+        height = aHeight;
+        return a;
+    }
+
+    int bLeftHeight = b->getBalance() >= 0 ? bHeight - 1 : bHeight - 2;
+    int bRightHeight = b->getBalance() <= 0 ? bHeight - 1 : bHeight - 2;
+    AVLNode<Key, Value>* bLeft = detach(b->getLeft());
+    AVLNode<Key, Value>* bRight = detach(b->getRight());
+
+    AVLNode<Key, Value>* aLess = nullptr;
+    AVLNode<Key, Value>* aFound = nullptr;
+    AVLNode<Key, Value>* aGreater = nullptr;
+    int aLessHeight = 0;
+    int aGreaterHeight = 0;
+    splitAt(a, aHeight, b->getKey(), aLess, aLessHeight, aFound, aGreater, aGreaterHeight);
+    discarded.addNode(b);
+    if (aFound != nullptr){
+        discarded.addNode(aFound);
+    }
+
+    AVLNode<Key, Value>* leftTree = nullptr;
+    AVLNode<Key, Value>* rightTree = nullptr;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    DiscardList rightDiscarded;
+    fork(executor, std::min(aHeight, bHeight),
+        [&]() { leftTree = differenceAt(aLess, aLessHeight, bLeft, bLeftHeight, leftHeight, discarded, executor); },
+        [&]() { rightTree = differenceAt(aGreater, aGreaterHeight, bRight, bRightHeight, rightHeight, rightDiscarded, executor); });
+    discarded.append(rightDiscarded);
+    return joinPair(leftTree, leftHeight, rightTree, rightHeight, height);
+}
+
+/**
+* Adds a whole detached subtree to the list.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::DiscardList::addSubtree(AVLNode<Key, Value>* top)
+{
+    if (top == nullptr){
+        return;
+    }
+    top->setParent(head);
+    head = top;
+    if (tail == nullptr){
+        tail = top;
+    }
+}
+
+/**
+* Adds a single node whose children have been moved elsewhere.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::DiscardList::addNode(AVLNode<Key, Value>* node)
+{
+    node->setLeft(nullptr);
+    node->setRight(nullptr);
+    addSubtree(node);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::DiscardList::append(DiscardList& other)
+{
+    if (other.head == nullptr){
+        return;
+    }
+    other.tail->setParent(head);
+    head = other.head;
+    if (tail == nullptr){
+        tail = other.tail;
+    }
+    other.head = nullptr;
+    other.tail = nullptr;
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::destroyDiscarded(DiscardList& discarded)
+{
+    AVLNode<Key, Value>* curr = discarded.head;
+    while (curr != nullptr){
+        AVLNode<Key, Value>* next = curr->getParent();
+        curr->setParent(nullptr);
+        this->destroySubtree(curr);
+        curr = next;
+    }
+    discarded.head = nullptr;
+    discarded.tail = nullptr;
+}
+
+/**
+* Splits the detached subtree at top (whose height is topHeight) into
+* the keys less than key and those greater, returning both as detached
+* subtrees along with their heights. The node holding key itself, if
+* any, is returned through found with its links left stale.
+*/
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::splitAt(AVLNode<Key, Value>* top, int topHeight, const Key& key,
+                                  AVLNode<Key, Value>*& less, int& lessHeight, AVLNode<Key, Value>*& found,
+                                  AVLNode<Key, Value>*& greater, int& greaterHeight)
+{
+    if (top == nullptr){
+        less = nullptr;
+        found = nullptr;
+        greater = nullptr;
+        lessHeight = 0;
+        greaterHeight = 0;
+        return;
+    }
+
+    int leftHeight = top->getBalance() >= 0 ? topHeight - 1 : topHeight - 2;
+    int rightHeight = top->getBalance() <= 0 ? topHeight - 1 : topHeight - 2;
+    AVLNode<Key, Value>* leftChild = detach(top->getLeft());
+    AVLNode<Key, Value>* rightChild = detach(top->getRight());
+
+    KeyOrder order = this->orderKeys(top->getKey(), key);
+    if (order.less){
+        //top and its left subtree are all less; split the right one
+        AVLNode<Key, Value>* middle = nullptr;
+        int middleHeight = 0;
+        splitAt(rightChild, rightHeight, key, middle, middleHeight, found, greater, greaterHeight);
+        less = joinAt(leftChild, leftHeight, top, middle, middleHeight, lessHeight);
+    }
+    else if (!order.equivalent){
+        //top and its right subtree are all greater; split the left one
+        AVLNode<Key, Value>* middle = nullptr;
+        int middleHeight = 0;
+        splitAt(leftChild, leftHeight, key, less, lessHeight, found, middle, middleHeight);
+        greater = joinAt(middle, middleHeight, top, rightChild, rightHeight, greaterHeight);
+    }
+    else{
+        less = leftChild;
+        lessHeight = leftHeight;
+        found = top;
+        greater = rightChild;
+        greaterHeight = rightHeight;
+    }
+}
+
+/**
+* Cuts the largest node out of the detached subtree at top, returning
+* the rest of the subtree and its height, and the node through last.
+*/
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::splitLast(AVLNode<Key, Value>* top, int topHeight,
+                                                    AVLNode<Key, Value>*& last, int& height)
+{
+    if (top->getRight() == nullptr){
+        last = top;
+        height = topHeight - 1;
+        return detach(top->getLeft());
+    }
+
+    int leftHeight = top->getBalance() >= 0 ? topHeight - 1 : topHeight - 2;
+    int rightHeight = top->getBalance() <= 0 ? topHeight - 1 : topHeight - 2;
+    AVLNode<Key, Value>* leftChild = detach(top->getLeft());
+    AVLNode<Key, Value>* rest = splitLast(detach(top->getRight()), rightHeight, last, rightHeight);
+    return joinAt(leftChild, leftHeight, top, rest, rightHeight, height);
+}
+
+/**
+* Links an in-order array of existing nodes into a perfectly balanced
+* subtree, setting every link and balance. Returns the subtree's root
+* and sets height to its height.
+*/
+template<class Key, class Value, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare>::linkSubtree(AVLNode<Key, Value>** nodes, size_t count,
+                                                      AVLNode<Key, Value>* parent, int& height)
+{
+    if (count == 0){
+        height = 0;
+        return nullptr;
+    }
+
+    size_t leftCount = (count - 1) / 2;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    AVLNode<Key, Value>* node = nodes[leftCount];
+    node->setParent(parent);
+    node->setLeft(linkSubtree(nodes, leftCount, node, leftHeight));
+    node->setRight(linkSubtree(nodes + leftCount + 1, count - 1 - leftCount, node, rightHeight));
+    node->setBalance(int8_t(leftHeight - rightHeight));
+    node->updateSize();
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/**
+* Returns the height of a subtree in O(log n) by following the
+* taller child down, as told by the balances.
+*/
+template<class Key, class Value, class Compare>
+int AVLTree<Key, Value, Compare>::subtreeHeight(AVLNode<Key, Value>* node)
+{
+    int height = 0;
+    while (node != nullptr){
+        ++height;
+        node = node->getBalance() >= 0 ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+/**
+* An AVLTree keeps no heights; they follow from the balances instead.
+*/
+template<class Key, class Value, class Compare>
+int AVLTree<Key, Value, Compare>::heightAt(Node<Key, Value>* top) const
+{
+    return subtreeHeight(static_cast<AVLNode<Key, Value>*>(top));
+}
+
+/**
+* Every subtree of an AVLTree is balanced: insert, remove and the bulk
+* operations all restore it before returning.
+*/
+template<class Key, class Value, class Compare>
+bool AVLTree<Key, Value, Compare>::balancedAt(Node<Key, Value>*) const
+{
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::rotateLeft (AVLNode <Key, Value>* upperNode)
 {
     
     AVLNode<Key, Value>* rightChild = upperNode->getRight(); 
@@ -169,8 +1266,11 @@ void AVLTree<Key, Value>::rotateLeft (AVLNode <Key, Value>* upperNode)
     rightChild->setParent(prevParentofUpperNode);
     //case 1: upperNode was a left child to prevParentofUpperNode
     if (prevParentofUpperNode == nullptr){
-        //upperNode was not right/left child (was a root)
-        this->root_ = rightChild;
+        //upperNode was not right/left child (was a root); the top of a
+        //detached subtree being split or joined is not the tree's root
+        if (this->root_ == upperNode){
+            this->root_ = rightChild;
+        }
     }
     else if (upperNode == prevParentofUpperNode->getLeft()){
             prevParentofUpperNode->setLeft(rightChild); 
@@ -183,11 +1283,16 @@ void AVLTree<Key, Value>::rotateLeft (AVLNode <Key, Value>* upperNode)
     //set upper node to the left of right child and done
     rightChild->setLeft(upperNode);
     upperNode->setParent(rightChild);
+
+    //only the two rotated nodes have new subtrees
+    upperNode->updateSize();
+    rightChild->updateSize();
+    this->rotations_.fetch_add(1, std::memory_order_relaxed);
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight (AVLNode <Key, Value>* upperNode)
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::rotateRight (AVLNode <Key, Value>* upperNode)
 {
     AVLNode<Key, Value>* leftChild = upperNode->getLeft(); 
 
@@ -209,7 +1314,9 @@ void AVLTree<Key, Value>::rotateRight (AVLNode <Key, Value>* upperNode)
     leftChild->setParent(prevParentofUpperNode);
     //case 1: upperNode was a left child to prevParentofUpperNode
     if (prevParentofUpperNode == nullptr){
-        this->root_ = leftChild; 
+        if (this->root_ == upperNode){
+            this->root_ = leftChild; 
+        }
     }
     //case 2: upperNode was a right child to prevParentofUpperNode
     else if (upperNode == prevParentofUpperNode->getLeft()){
@@ -222,80 +1329,100 @@ void AVLTree<Key, Value>::rotateRight (AVLNode <Key, Value>* upperNode)
     //set upper node to the right of left child and done
     leftChild->setRight(upperNode);
     upperNode->setParent(leftChild);
+
+    upperNode->updateSize();
+    leftChild->updateSize();
+    this->rotations_.fetch_add(1, std::memory_order_relaxed);
 }
 
 
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
+ * As in BinarySearchTree::insert, appends start at the last node.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::insert (const std::pair<const Key, Value> &new_item)
 {
-    Key key = new_item.first; 
-    Value val = new_item.second; 
+    bool inserted;
+    typename BinarySearchTree<Key, Value, Compare>::ItemSource source(&this->copyItem,
+        const_cast<std::pair<const Key, Value>*>(&new_item), &this->copyValue);
+    insertFrom(this->appendStart(new_item.first), new_item.first, source, inserted);
+}
+
+/**
+* Finds or inserts key as BinarySearchTree::insertFrom does, and
+* rebalances after an insert.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* AVLTree<Key, Value, Compare>::insertFrom(Node<Key, Value>* start, const Key& key,
+                                                  const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                                  bool& inserted)
+{
+    inserted = true;
 
     //Case 1: tree is empty 
     if (this->root_ == nullptr){
         //make a new node as the root  
-        this->root_ = new AVLNode<Key, Value> (key, val, nullptr);
-        return;
+        this->root_ = this->placeNode(source, static_cast<AVLNode<Key, Value>*>(nullptr));
+        this->noteInserted(this->root_);
+        return this->root_;
     }
     //Case 2: tree is not empty 
-    AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(start);
     AVLNode<Key, Value>* aboveNode = nullptr; 
+    bool goLeft = false;
 
     //use loop to find where to insert the item
     while (curr != nullptr){
         aboveNode = curr; 
+        KeyOrder order = this->orderKeys(key, curr->getKey());
 
-        //go left if key < curr
-        if (key < curr->getKey()){
-            curr = curr->getLeft(); 
-        }
-        //go right if key > curr 
-        else if (key > curr->getKey()){
-            curr = curr->getRight(); 
-        }
-        //otherwise, the key exists; set it
-        else{
-            curr->setValue(val);
-            return; //exit
+        //the key exists; set it
+        if (order.equivalent){
+            inserted = false;
+            if (source.node != nullptr){
+                this->destroyNode(source.node);
+            }
+            if (source.assign != nullptr){
+                source.assign(source.context, curr->getValue());
+            }
+            return curr; //exit
         }
+        //go left if key < curr, right if key > curr (a select rather
+        //than a branch, as in BinarySearchTree::insertFrom)
+        goLeft = order.less;
+        curr = goLeft ? curr->getLeft() : curr->getRight(); 
     }
 
     //now that we know where to insert the item, make the actual node to insert
-    AVLNode<Key, Value>* nodeToInsert = new AVLNode<Key, Value>(key, val, aboveNode);
-    //set it left if key < above node 
-    if (key < aboveNode->getKey()){
+    //(a key moved into it can no longer be compared)
+    AVLNode<Key, Value>* nodeToInsert = this->placeNode(source, aboveNode);
+    if (goLeft){
         aboveNode->setLeft(nodeToInsert); 
     }
-    //set it right if key > above node 
-    else if (key > aboveNode->getKey()){
+    else{
         aboveNode->setRight(nodeToInsert); 
     }
 
-    //now check for balance (see if we need to rotate nodes)
-    AVLNode<Key,Value>* newNode = nodeToInsert; 
-    AVLNode<Key,Value>* parent = aboveNode; 
-
+    this->noteInserted(nodeToInsert);
+    this->updateSizesUpward(aboveNode);
 
-    //update the balance of parent node
-    if (parent->getLeft() == newNode){
-      parent->updateBalance(1);
-    }
-    else{
-      parent->updateBalance(-1);
-    }
-
-    //if balanced, exit 
-    if (parent->getBalance() == 0){
-      return; 
-    }
+    //now check for balance (see if we need to rotate nodes)
+    insertFix(nodeToInsert);
+    return nodeToInsert;
+}
 
-    //go up
-    newNode = parent; 
-    parent = parent->getParent(); 
+/**
+* Retraces from a node whose subtree just grew by one level, updating
+* balances and rotating where needed. Returns true if the growth reached
+* the top of the tree, i.e. the whole tree got one level taller.
+*/
+template<class Key, class Value, class Compare>
+bool AVLTree<Key, Value, Compare>::insertFix(AVLNode<Key, Value>* grown)
+{
+    AVLNode<Key,Value>* newNode = grown; 
+    AVLNode<Key,Value>* parent = grown->getParent(); 
 
     while (parent != nullptr){
 
@@ -344,7 +1471,7 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
                 }
                 rightChildOfLeftChild->setBalance(0);
             }
-            break; 
+            return false; 
         }
         else if(parent->getBalance() == -2){    //left rotation needed
             AVLNode<Key, Value>* rightChild = parent->getRight(); 
@@ -379,37 +1506,42 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
                 }
                 leftChildOfRightChild->setBalance(0);
             }
-            break; 
+            return false; 
             
         }
             
         if(parent->getBalance() == 0){
-            break; 
+            return false; 
         }
 
         //keep going to the next upper nodes to repeat
         newNode = parent; 
         parent = parent->getParent(); 
     }
+    return true;
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>:: remove(const Key& key)
 {
     AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
     
     //use loop to find where to remove the item
-    while (curr != nullptr && curr->getKey() != key){
+    while (curr != nullptr){
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+        if (order.equivalent){
+            break;
+        }
         //go left if key < curr
-        if (key < curr->getKey()){
+        else if (order.less){
             curr = curr->getLeft(); 
         }
         //go right if key > curr 
-        else if (key > curr->getKey()){
+        else{
             curr = curr->getRight(); 
         }
     }
@@ -418,6 +1550,7 @@ void AVLTree<Key, Value>:: remove(const Key& key)
     if(curr==nullptr){
         return; 
     }
+    this->noteRemoving(curr);
 
     //Otherwise, item exists
     //Case 1: node has 2 children
@@ -479,7 +1612,8 @@ void AVLTree<Key, Value>:: remove(const Key& key)
         }
     }
         
-    delete curr; 
+    this->updateSizesUpward(aboveNode);
+    this->destroyNode(curr); 
     
     //update the balance; start on the parent of deleted node and go up till at root 
     AVLNode<Key, Value>* node = aboveNode;
@@ -648,10 +1782,19 @@ void AVLTree<Key, Value>:: remove(const Key& key)
     return; 
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Creates a detached AVLNode with its item built by make(context).
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* AVLTree<Key, Value, Compare>::newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make, void* context)
+{
+    return this->template createNode<AVLNode<Key, Value> >(make, context, nullptr);
+}
+
+template<class Key, class Value, class Compare>
+void AVLTree<Key, Value, Compare>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
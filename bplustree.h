@@ -0,0 +1,1277 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+#include "node_pool.h"
+
+// Target size of a B+tree node; nodes are padded to whole cache lines
+#ifndef BPLUS_NODE_BYTES
+#define BPLUS_NODE_BYTES 512
+#endif
+#define BPLUS_CACHE_LINE_BYTES 64
+
+/**
+* Counts the keys of a node that come before key, or that do not come
+* after it, in a sorted array of count keys. Every key is compared, and
+* the results are added up rather than branched on: a node holds a few
+* cache lines of keys at most, and a scan the processor can run ahead on
+* beats a binary search it has to guess its way through.
+*/
+template<typename Key, typename Compare, typename Enable = void>
+struct NodeSearch
+{
+    static size_t countLess(const Key* keys, size_t count, const Key& key, const Compare& comp)
+    {
+        size_t less = 0;
+        for (size_t i = 0; i < count; ++i){
+            less += comp(keys[i], key);
+        }
+        return less;
+    }
+
+    static size_t countNotGreater(const Key* keys, size_t count, const Key& key, const Compare& comp)
+    {
+        size_t notGreater = 0;
+        for (size_t i = 0; i < count; ++i){
+            notGreater += !comp(key, keys[i]);
+        }
+        return notGreater;
+    }
+};
+
+#ifdef __SSE2__
+/**
+* The same counts for 32- and 64-bit integers in their natural order,
+* compared four or two at a time. SSE2 only has signed 32-bit compares,
+* so the keys are biased to turn unsigned order into signed order, and
+* without SSE4.2 a 64-bit compare is put together from its two halves.
+* Each compare leaves -1 in the lanes that pass, which are subtracted
+* from a vector of counts; there is no popcount to lean on in the
+* baseline instruction set.
+*/
+template<typename T>
+struct NodeSearch<T, std::less<T>,
+                  typename std::enable_if<std::is_integral<T>::value && (sizeof(T) == 4 || sizeof(T) == 8)>::type>
+{
+    static const size_t LANES = 16 / sizeof(T);
+
+    static size_t countLess(const T* keys, size_t count, const T& key, const std::less<T>&)
+    {
+        __m128i bias = signBias();
+        __m128i probe = _mm_xor_si128(broadcast(key), bias);
+        __m128i counts = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + LANES <= count; i += LANES){
+            __m128i block = _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            counts = subtractLanes(counts, greater(probe, block));
+        }
+        size_t less = sumLanes(counts);
+        for (; i < count; ++i){
+            less += keys[i] < key;
+        }
+        return less;
+    }
+
+    static size_t countNotGreater(const T* keys, size_t count, const T& key, const std::less<T>&)
+    {
+        __m128i bias = signBias();
+        __m128i probe = _mm_xor_si128(broadcast(key), bias);
+        __m128i counts = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + LANES <= count; i += LANES){
+            __m128i block = _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            counts = subtractLanes(counts, greater(block, probe));
+        }
+        size_t greaterCount = sumLanes(counts);
+        for (; i < count; ++i){
+            greaterCount += key < keys[i];
+        }
+        return count - greaterCount;
+    }
+
+private:
+    static __m128i broadcast(T key)
+    {
+        if (sizeof(T) == 4){
+            return _mm_set1_epi32(static_cast<int>(key));
+        }
+        return _mm_set1_epi64x(static_cast<long long>(key));
+    }
+
+    // What to flip so that signed compares order the keys as T does:
+    // the sign of an unsigned key, and, when a 64-bit key is compared
+    // in 32-bit halves, the sign of its low half
+    static __m128i signBias()
+    {
+        if (sizeof(T) == 4){
+            return _mm_set1_epi32(std::is_signed<T>::value ? 0 : static_cast<int>(0x80000000u));
+        }
+        long long high = std::is_signed<T>::value ? 0 : static_cast<long long>(0x8000000000000000ULL);
+#ifdef __SSE4_2__
+        return _mm_set1_epi64x(high);
+#else
+        return _mm_set1_epi64x(high | 0x80000000LL);
+#endif
+    }
+
+    // Lanes of a greater than b, as all ones
+    static __m128i greater(__m128i a, __m128i b)
+    {
+        if (sizeof(T) == 4){
+            return _mm_cmpgt_epi32(a, b);
+        }
+#ifdef __SSE4_2__
+        return _mm_cmpgt_epi64(a, b);
+#else
+        //the high halves decide, unless they are equal and the low halves do
+        __m128i above = _mm_cmpgt_epi32(a, b);
+        __m128i equal = _mm_cmpeq_epi32(a, b);
+        __m128i high = _mm_or_si128(above, _mm_and_si128(equal, _mm_slli_epi64(above, 32)));
+        return _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 3, 1, 1));
+#endif
+    }
+
+    static __m128i subtractLanes(__m128i counts, __m128i lanes)
+    {
+        if (sizeof(T) == 4){
+            return _mm_sub_epi32(counts, lanes);
+        }
+        return _mm_sub_epi64(counts, lanes);
+    }
+
+    static size_t sumLanes(__m128i counts)
+    {
+        if (sizeof(T) == 4){
+            counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(1, 0, 3, 2)));
+            counts = _mm_add_epi32(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(2, 3, 0, 1)));
+            return static_cast<size_t>(_mm_cvtsi128_si32(counts));
+        }
+        counts = _mm_add_epi64(counts, _mm_shuffle_epi32(counts, _MM_SHUFFLE(1, 0, 3, 2)));
+        return static_cast<size_t>(_mm_cvtsi128_si64(counts));
+    }
+};
+#endif
+
+/**
+* An inner node of a B+tree: count_ separator keys and count_ + 1
+* children. Every key in children_[i] is at least keys_[i - 1] and less
+* than keys_[i]. The keys come first, so they start on a cache line.
+*/
+template <typename Key, typename Value>
+struct alignas(BPLUS_CACHE_LINE_BYTES) BPlusInner
+{
+    static const size_t FIT = (BPLUS_NODE_BYTES - 2 * sizeof(void*)) / (sizeof(Key) + sizeof(void*));
+    static const size_t SLOTS = FIT < 3 ? 3 : FIT;
+
+    Key keys_[SLOTS];
+    void* children_[SLOTS + 1];
+    size_t count_;
+
+    BPlusInner() : count_(0) { }
+};
+
+/**
+* A leaf of a B+tree: count_ items in key order, with a copy of each key
+* packed in front of them for the search, and links to the neighbouring
+* leaves for iteration.
+*/
+template <typename Key, typename Value>
+struct alignas(BPLUS_CACHE_LINE_BYTES) BPlusLeaf
+{
+    typedef std::pair<const Key, Value> Item;
+    static const size_t FIT = (BPLUS_NODE_BYTES - 3 * sizeof(void*)) / (sizeof(Key) + sizeof(Item));
+    static const size_t SLOTS = FIT < 3 ? 3 : FIT;
+
+    Key keys_[SLOTS];
+    size_t count_;
+    BPlusLeaf* prev_;
+    BPlusLeaf* next_;
+    // Raw slots, since an Item cannot be assigned over with its const key
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type items_[SLOTS];
+
+    BPlusLeaf() : count_(0), prev_(nullptr), next_(nullptr) { }
+    Item& item(size_t i) { return *reinterpret_cast<Item*>(&items_[i]); }
+};
+
+/**
+* A B+tree map with the interface of BinarySearchTree: insert, remove,
+* find, lower_bound, upper_bound, bidirectional iterators in key order,
+* operator[], findOrInsert and tryGet.
+*
+* A binary tree takes one node, and on a large tree one cache miss, per
+* level for about log2(n) levels. Here every node is a few cache lines
+* holding dozens of keys, so a lookup visits log base 16-32 of n nodes
+* instead, and reads each one's keys as a contiguous block: with SSE2,
+* integer keys under std::less are compared several at a time. Items
+* live only in the leaves, which are linked in key order, so a scan
+* reads them one full leaf at a time.
+*
+* Nodes are taken from two NodePools, one per node kind, aligned to the
+* cache line. Keys must be default constructible and assignable, since
+* every node holds an array of them.
+*
+* Unlike BinarySearchTree, an insert or remove moves the items around
+* within and between leaves, so it invalidates every iterator and every
+* pointer or reference to a value.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class BPlusTree
+{
+public:
+    BPlusTree();
+    explicit BPlusTree(const Compare& comp);
+    ~BPlusTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+    void setHugePages(bool enable);
+    size_t memoryUsage() const;
+    Compare key_comp() const;
+
+public:
+    /**
+    * An iterator over the items of a B+tree, in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator& operator--();
+
+    protected:
+        friend class BPlusTree<Key, Value, Compare>;
+        iterator(BPlusLeaf<Key, Value>* leaf, size_t index, const BPlusTree<Key, Value, Compare>* tree);
+        // The leaf and slot of the current item; leaf_ is NULL at end()
+        BPlusLeaf<Key, Value>* leaf_;
+        size_t index_;
+        // The tree iterated over, so that end() can step back to the last key
+        const BPlusTree<Key, Value, Compare>* tree_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    Value& findOrInsert(const Key& key);
+    Value* tryGet(const Key& key);
+    const Value* tryGet(const Key& key) const;
+
+protected:
+    typedef BPlusInner<Key, Value> Inner;
+    typedef BPlusLeaf<Key, Value> Leaf;
+    typedef std::pair<const Key, Value> Item;
+    typedef NodeSearch<Key, Compare> Search;
+
+    // Inner nodes are at least half full, so no tree of size_t keys is
+    // anywhere near this tall
+    static const int MAX_HEIGHT = 64;
+    static const size_t LEAF_MIN = Leaf::SLOTS / 2;
+    static const size_t INNER_MIN = Inner::SLOTS / 2;
+
+    Leaf* leafFor(const Key& key) const;
+    template<typename NodeType>
+    static void prefetchNode(const NodeType* node);
+    template<typename ItemRef>
+    iterator insertItem(const Key& key, ItemRef&& item, bool overwrite);
+    static void shiftItems(Leaf* leaf, size_t from, size_t to, size_t count);
+    static void moveItems(Leaf* from, size_t fromIndex, Leaf* to, size_t toIndex, size_t count);
+    static Key splitInner(Inner* node, Inner* right, size_t pos, const Key& separator, void* child);
+    static void insertChild(Inner* node, size_t pos, const Key& separator, void* child);
+    static void removeChild(Inner* node, size_t pos);
+    void rebalanceLeaf(Leaf* leaf, Inner* parent, size_t slot);
+    void rebalanceInner(Inner* node, Inner* parent, size_t slot);
+
+    Leaf* newLeaf();
+    Inner* newInner();
+    void destroyLeaf(Leaf* leaf);
+    void destroyInner(Inner* node);
+    void destroySubtree(void* node, int height);
+
+private:
+    // Not copyable: the nodes live in pools owned by the tree
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+
+protected:
+    // An Inner, or a Leaf when height_ is 1; NULL when empty
+    void* root_;
+    // Levels of nodes, leaves included; 0 when empty
+    int height_;
+    // First and last leaves, for begin() and --end()
+    Leaf* first_;
+    Leaf* last_;
+    size_t size_;
+    NodePool leafPool_;
+    NodePool innerPool_;
+    Compare comp_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the BPlusTree::iterator class.
+  -----------------------------------------------
+*/
+
+/**
+* Default constructor for an iterator that refers to no tree.
+*/
+template<class Key, class Value, class Compare>
+BPlusTree<Key, Value, Compare>::iterator::iterator() :
+    leaf_(nullptr),
+    index_(0),
+    tree_(nullptr)
+{
+
+}
+
+/**
+* Initializes an iterator at an item of a leaf of tree.
+*/
+template<class Key, class Value, class Compare>
+BPlusTree<Key, Value, Compare>::iterator::iterator(BPlusLeaf<Key, Value>* leaf, size_t index,
+                                                   const BPlusTree<Key, Value, Compare>* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key, Value>& BPlusTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return leaf_->item(index_);
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key, Value>* BPlusTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &leaf_->item(index_);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool BPlusTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool BPlusTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator to the next item, moving on to the next leaf
+* after the last item of this one.
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator& BPlusTree<Key, Value, Compare>::iterator::operator++()
+{
+    if (++index_ == leaf_->count_){
+        leaf_ = leaf_->next_;
+        index_ = 0;
+    }
+    return *this;
+}
+
+/**
+* Moves the iterator back to the previous item. Stepping back from end()
+* reaches the last item.
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator& BPlusTree<Key, Value, Compare>::iterator::operator--()
+{
+    if (leaf_ == nullptr){
+        leaf_ = tree_->last_;
+        index_ = leaf_->count_ - 1;
+    }
+    else if (index_ == 0){
+        leaf_ = leaf_->prev_;
+        index_ = leaf_->count_ - 1;
+    }
+    else{
+        --index_;
+    }
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the BPlusTree::iterator class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the BPlusTree class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+BPlusTree<Key, Value, Compare>::BPlusTree() :
+    root_(nullptr),
+    height_(0),
+    first_(nullptr),
+    last_(nullptr),
+    size_(0),
+    leafPool_(sizeof(Leaf), alignof(Leaf)),
+    innerPool_(sizeof(Inner), alignof(Inner)),
+    comp_()
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+BPlusTree<Key, Value, Compare>::BPlusTree(const Compare& comp) :
+    root_(nullptr),
+    height_(0),
+    first_(nullptr),
+    last_(nullptr),
+    size_(0),
+    leafPool_(sizeof(Leaf), alignof(Leaf)),
+    innerPool_(sizeof(Inner), alignof(Inner)),
+    comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+BPlusTree<Key, Value, Compare>::~BPlusTree()
+{
+    clear();
+}
+
+/**
+* Inserts the item, overwriting the value if the key is already in the
+* tree.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    insertItem(keyValuePair.first, keyValuePair, true);
+}
+
+/**
+* Like insert(keyValuePair), but moves the value into the tree.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    insertItem(keyValuePair.first, std::move(keyValuePair), true);
+}
+
+/**
+* Removes the item with key, if there is one. A leaf left less than half
+* full borrows an item from a sibling, or is merged into one, and the
+* same is repeated up the tree for the parents merging takes a child
+* from.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if (root_ == nullptr){
+        return;
+    }
+    Inner* path[MAX_HEIGHT];
+    size_t slots[MAX_HEIGHT];
+    int depth = 0;
+    void* node = root_;
+    for (int level = height_; level > 1; --level){
+        Inner* inner = static_cast<Inner*>(node);
+        prefetchNode(inner);
+        size_t slot = Search::countNotGreater(inner->keys_, inner->count_, key, comp_);
+        path[depth] = inner;
+        slots[depth] = slot;
+        ++depth;
+        node = inner->children_[slot];
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    prefetchNode(leaf);
+    size_t index = Search::countLess(leaf->keys_, leaf->count_, key, comp_);
+    if (index == leaf->count_ || comp_(key, leaf->keys_[index])){
+        return;
+    }
+    leaf->item(index).~Item();
+    shiftItems(leaf, index + 1, index, leaf->count_ - index - 1);
+    --leaf->count_;
+    --size_;
+
+    if (depth == 0){
+        //the root leaf may run down to nothing
+        if (leaf->count_ == 0){
+            destroyLeaf(leaf);
+            root_ = nullptr;
+            height_ = 0;
+            first_ = nullptr;
+            last_ = nullptr;
+        }
+        return;
+    }
+    if (leaf->count_ >= LEAF_MIN){
+        return;
+    }
+    rebalanceLeaf(leaf, path[depth - 1], slots[depth - 1]);
+
+    //each merge takes a child from the parent, which may fall short in turn
+    for (int level = depth - 1; level > 0 && path[level]->count_ < INNER_MIN; --level){
+        rebalanceInner(path[level], path[level - 1], slots[level - 1]);
+    }
+    Inner* root = static_cast<Inner*>(root_);
+    if (root->count_ == 0){
+        root_ = root->children_[0];
+        --height_;
+        destroyInner(root);
+    }
+}
+
+/**
+* Removes every item and gives all of the nodes back.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::clear()
+{
+    if (root_ != nullptr){
+        destroySubtree(root_, height_);
+    }
+    leafPool_.release();
+    innerPool_.release();
+    root_ = nullptr;
+    height_ = 0;
+    first_ = nullptr;
+    last_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* Returns true if the tree holds no items.
+*/
+template<class Key, class Value, class Compare>
+bool BPlusTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns the number of items in the tree.
+*/
+template<class Key, class Value, class Compare>
+size_t BPlusTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns the number of levels of nodes, leaves included, which is the
+* number of nodes every lookup visits.
+*/
+template<class Key, class Value, class Compare>
+int BPlusTree<Key, Value, Compare>::height() const
+{
+    return height_;
+}
+
+/**
+* Requests that the nodes allocated from now on be backed by transparent
+* huge pages, so that a lookup in a large tree is not also a TLB miss on
+* every level.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::setHugePages(bool enable)
+{
+    leafPool_.setHugePages(enable);
+    innerPool_.setHugePages(enable);
+}
+
+/**
+* Returns the bytes the node pools hold, including slots that are
+* reserved or freed but not in use.
+*/
+template<class Key, class Value, class Compare>
+size_t BPlusTree<Key, Value, Compare>::memoryUsage() const
+{
+    return leafPool_.reservedBytes() + innerPool_.reservedBytes();
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare BPlusTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns an iterator to the smallest key, or end() if empty.
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::begin() const
+{
+    return iterator(first_, 0, this);
+}
+
+/**
+* Returns an iterator past the largest key.
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::end() const
+{
+    return iterator(nullptr, 0, this);
+}
+
+/**
+* Returns an iterator to the item with key, or end() if it is missing.
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::find(const Key& key) const
+{
+    Leaf* leaf = leafFor(key);
+    if (leaf == nullptr){
+        return end();
+    }
+    size_t index = Search::countLess(leaf->keys_, leaf->count_, key, comp_);
+    if (index == leaf->count_ || comp_(key, leaf->keys_[index])){
+        return end();
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+* Returns an iterator to the first key not less than key, or end(). If
+* every key of the leaf key belongs in is less than it, the answer is
+* the first item of the next leaf.
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    Leaf* leaf = leafFor(key);
+    if (leaf == nullptr){
+        return end();
+    }
+    size_t index = Search::countLess(leaf->keys_, leaf->count_, key, comp_);
+    if (index == leaf->count_){
+        return iterator(leaf->next_, 0, this);
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+* Returns an iterator to the first key greater than key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    Leaf* leaf = leafFor(key);
+    if (leaf == nullptr){
+        return end();
+    }
+    size_t index = Search::countNotGreater(leaf->keys_, leaf->count_, key, comp_);
+    if (index == leaf->count_){
+        return iterator(leaf->next_, 0, this);
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+* Returns the value for key; throws std::out_of_range if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value& BPlusTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    Value* value = tryGet(key);
+    if(value == NULL) throw std::out_of_range("Invalid key");
+    return *value;
+}
+
+template<class Key, class Value, class Compare>
+Value const & BPlusTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const Value* value = tryGet(key);
+    if(value == NULL) throw std::out_of_range("Invalid key");
+    return *value;
+}
+
+/**
+* Returns the value for key, inserting the key with a default-constructed
+* value first if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value& BPlusTree<Key, Value, Compare>::findOrInsert(const Key& key)
+{
+    Value* found = tryGet(key);
+    if (found != nullptr){
+        return *found;
+    }
+    return insertItem(key, std::pair<const Key, Value>(key, Value()), false)->second;
+}
+
+/**
+* Returns a pointer to the value for key, or NULL if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value* BPlusTree<Key, Value, Compare>::tryGet(const Key& key)
+{
+    iterator found = find(key);
+    return found != end() ? &found->second : nullptr;
+}
+
+template<class Key, class Value, class Compare>
+const Value* BPlusTree<Key, Value, Compare>::tryGet(const Key& key) const
+{
+    iterator found = find(key);
+    return found != end() ? &found->second : nullptr;
+}
+
+/**
+* Returns the leaf key belongs in, or NULL if the tree is empty.
+*/
+template<class Key, class Value, class Compare>
+BPlusLeaf<Key, Value>* BPlusTree<Key, Value, Compare>::leafFor(const Key& key) const
+{
+    void* node = root_;
+    for (int level = height_; level > 1; --level){
+        Inner* inner = static_cast<Inner*>(node);
+        prefetchNode(inner);
+        node = inner->children_[Search::countNotGreater(inner->keys_, inner->count_, key, comp_)];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    if (leaf != nullptr){
+        prefetchNode(leaf);
+    }
+    return leaf;
+}
+
+/**
+* Starts loading every cache line of node at once. The search reads the
+* keys first and the child or item it picks only after, so without this
+* each level costs two cache misses in a row instead of one.
+*/
+template<class Key, class Value, class Compare>
+template<typename NodeType>
+void BPlusTree<Key, Value, Compare>::prefetchNode(const NodeType* node)
+{
+#ifdef __GNUC__
+    const char* bytes = reinterpret_cast<const char*>(node);
+    for (size_t offset = 0; offset < sizeof(NodeType); offset += BPLUS_CACHE_LINE_BYTES){
+        __builtin_prefetch(bytes + offset);
+    }
+#endif
+}
+
+/**
+* Inserts item, whose key is key, unless the key is in the tree already;
+* then its value is overwritten with item's if overwrite is set. Returns
+* an iterator to the key's item.
+*
+* A full leaf is split in two, and the new leaf's first key goes up to
+* the parent, which may have to split as well, and so on up to the
+* root. Every node the splits need is allocated before anything is
+* moved, so running out of memory leaves the tree as it was.
+*/
+template<class Key, class Value, class Compare>
+template<typename ItemRef>
+typename BPlusTree<Key, Value, Compare>::iterator BPlusTree<Key, Value, Compare>::insertItem(const Key& key,
+                                                                                           ItemRef&& item,
+                                                                                           bool overwrite)
+{
+    //insert if tree is empty
+    if (root_ == nullptr){
+        Leaf* leaf = newLeaf();
+        try {
+            new (&leaf->items_[0]) Item(std::forward<ItemRef>(item));
+        }
+        catch(...) {
+            destroyLeaf(leaf);
+            throw;
+        }
+        leaf->keys_[0] = key;
+        leaf->count_ = 1;
+        root_ = leaf;
+        height_ = 1;
+        first_ = leaf;
+        last_ = leaf;
+        size_ = 1;
+        return iterator(leaf, 0, this);
+    }
+
+    Inner* path[MAX_HEIGHT];
+    size_t slots[MAX_HEIGHT];
+    int depth = 0;
+    void* node = root_;
+    for (int level = height_; level > 1; --level){
+        Inner* inner = static_cast<Inner*>(node);
+        prefetchNode(inner);
+        size_t slot = Search::countNotGreater(inner->keys_, inner->count_, key, comp_);
+        path[depth] = inner;
+        slots[depth] = slot;
+        ++depth;
+        node = inner->children_[slot];
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    prefetchNode(leaf);
+    size_t index = Search::countLess(leaf->keys_, leaf->count_, key, comp_);
+    //the key exists
+    if (index < leaf->count_ && !comp_(key, leaf->keys_[index])){
+        if (overwrite){
+            leaf->item(index).second = std::forward<ItemRef>(item).second;
+        }
+        return iterator(leaf, index, this);
+    }
+
+    //built up front, so that a throwing constructor changes nothing
+    Item made(std::forward<ItemRef>(item));
+
+    if (leaf->count_ < Leaf::SLOTS){
+        shiftItems(leaf, index, index + 1, leaf->count_ - index);
+        new (&leaf->items_[index]) Item(std::move(made));
+        leaf->keys_[index] = key;
+        ++leaf->count_;
+        ++size_;
+        return iterator(leaf, index, this);
+    }
+
+    //a split leaf sends a key up through every full parent above it
+    int fullAbove = 0;
+    while (fullAbove < depth && path[depth - 1 - fullAbove]->count_ == Inner::SLOTS){
+        ++fullAbove;
+    }
+    int innerNeeded = fullAbove + (fullAbove == depth ? 1 : 0);
+    Inner* spares[MAX_HEIGHT];
+    int allocated = 0;
+    Leaf* right = newLeaf();
+    try {
+        for (; allocated < innerNeeded; ++allocated){
+            spares[allocated] = newInner();
+        }
+    }
+    catch(...) {
+        while (allocated > 0){
+            destroyInner(spares[--allocated]);
+        }
+        destroyLeaf(right);
+        throw;
+    }
+
+    //the new item goes into whichever half its index falls in; the
+    //halves end up with (SLOTS + 1) / 2 items on the left and the rest
+    size_t leftCount = (Leaf::SLOTS + 1) / 2;
+    Leaf* target = leaf;
+    if (index < leftCount){
+        moveItems(leaf, leftCount - 1, right, 0, Leaf::SLOTS - leftCount + 1);
+        leaf->count_ = leftCount - 1;
+        right->count_ = Leaf::SLOTS - leftCount + 1;
+    }
+    else{
+        moveItems(leaf, leftCount, right, 0, Leaf::SLOTS - leftCount);
+        leaf->count_ = leftCount;
+        right->count_ = Leaf::SLOTS - leftCount;
+        target = right;
+        index -= leftCount;
+    }
+    shiftItems(target, index, index + 1, target->count_ - index);
+    new (&target->items_[index]) Item(std::move(made));
+    target->keys_[index] = key;
+    ++target->count_;
+    ++size_;
+
+    right->prev_ = leaf;
+    right->next_ = leaf->next_;
+    if (leaf->next_ != nullptr){
+        leaf->next_->prev_ = right;
+    }
+    else{
+        last_ = right;
+    }
+    leaf->next_ = right;
+
+    Key separator = right->keys_[0];
+    void* child = right;
+    int used = 0;
+    for (int level = depth - 1; level >= depth - fullAbove; --level){
+        Inner* split = spares[used++];
+        separator = splitInner(path[level], split, slots[level], separator, child);
+        child = split;
+    }
+    if (fullAbove < depth){
+        insertChild(path[depth - 1 - fullAbove], slots[depth - 1 - fullAbove], separator, child);
+    }
+    else{
+        //the root split, so the tree grows a level
+        Inner* root = spares[used++];
+        root->keys_[0] = separator;
+        root->children_[0] = root_;
+        root->children_[1] = child;
+        root->count_ = 1;
+        root_ = root;
+        ++height_;
+    }
+    return iterator(target, index, this);
+}
+
+/**
+* Moves count items and their keys within a leaf, from index from on to
+* index to on, leaving the vacated slots empty. Either direction is
+* safe, overlap included.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::shiftItems(Leaf* leaf, size_t from, size_t to, size_t count)
+{
+    if (to > from){
+        for (size_t i = count; i > 0; --i){
+            new (&leaf->items_[to + i - 1]) Item(std::move(leaf->item(from + i - 1)));
+            leaf->item(from + i - 1).~Item();
+            leaf->keys_[to + i - 1] = std::move(leaf->keys_[from + i - 1]);
+        }
+    }
+    else{
+        for (size_t i = 0; i < count; ++i){
+            new (&leaf->items_[to + i]) Item(std::move(leaf->item(from + i)));
+            leaf->item(from + i).~Item();
+            leaf->keys_[to + i] = std::move(leaf->keys_[from + i]);
+        }
+    }
+}
+
+/**
+* Moves count items and their keys from one leaf into the empty slots of
+* another. The item counts are left for the caller to adjust.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::moveItems(Leaf* from, size_t fromIndex, Leaf* to, size_t toIndex, size_t count)
+{
+    for (size_t i = 0; i < count; ++i){
+        new (&to->items_[toIndex + i]) Item(std::move(from->item(fromIndex + i)));
+        from->item(fromIndex + i).~Item();
+        to->keys_[toIndex + i] = std::move(from->keys_[fromIndex + i]);
+    }
+}
+
+/**
+* Inserts separator and the child to its right at pos into a full inner
+* node, splitting it: the lower half stays in node, the upper half moves
+* to right, and the key in the middle is returned for the parent.
+*/
+template<class Key, class Value, class Compare>
+Key BPlusTree<Key, Value, Compare>::splitInner(Inner* node, Inner* right, size_t pos,
+                                               const Key& separator, void* child)
+{
+    //lay out all SLOTS + 1 keys and SLOTS + 2 children before dividing them
+    Key keys[Inner::SLOTS + 1];
+    void* children[Inner::SLOTS + 2];
+    for (size_t i = 0; i < pos; ++i){
+        keys[i] = std::move(node->keys_[i]);
+    }
+    keys[pos] = separator;
+    for (size_t i = pos; i < Inner::SLOTS; ++i){
+        keys[i + 1] = std::move(node->keys_[i]);
+    }
+    for (size_t i = 0; i <= pos; ++i){
+        children[i] = node->children_[i];
+    }
+    children[pos + 1] = child;
+    for (size_t i = pos + 1; i <= Inner::SLOTS; ++i){
+        children[i + 1] = node->children_[i];
+    }
+
+    size_t middle = (Inner::SLOTS + 1) / 2;
+    for (size_t i = 0; i < middle; ++i){
+        node->keys_[i] = std::move(keys[i]);
+        node->children_[i] = children[i];
+    }
+    node->children_[middle] = children[middle];
+    node->count_ = middle;
+
+    size_t rightCount = Inner::SLOTS - middle;
+    for (size_t i = 0; i < rightCount; ++i){
+        right->keys_[i] = std::move(keys[middle + 1 + i]);
+        right->children_[i] = children[middle + 1 + i];
+    }
+    right->children_[rightCount] = children[Inner::SLOTS + 1];
+    right->count_ = rightCount;
+    return keys[middle];
+}
+
+/**
+* Inserts separator and the child to its right at pos into an inner node
+* that has room for them.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::insertChild(Inner* node, size_t pos, const Key& separator, void* child)
+{
+    for (size_t i = node->count_; i > pos; --i){
+        node->keys_[i] = std::move(node->keys_[i - 1]);
+        node->children_[i + 1] = node->children_[i];
+    }
+    node->keys_[pos] = separator;
+    node->children_[pos + 1] = child;
+    ++node->count_;
+}
+
+/**
+* Removes the key at pos from an inner node, with the child to its right.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::removeChild(Inner* node, size_t pos)
+{
+    for (size_t i = pos; i + 1 < node->count_; ++i){
+        node->keys_[i] = std::move(node->keys_[i + 1]);
+        node->children_[i + 1] = node->children_[i + 2];
+    }
+    --node->count_;
+}
+
+/**
+* Tops up a leaf that fell below half full, the child at slot of parent:
+* takes an item from a sibling that can spare one, or else merges with
+* a sibling, which takes a child away from parent.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::rebalanceLeaf(Leaf* leaf, Inner* parent, size_t slot)
+{
+    Leaf* left = slot > 0 ? static_cast<Leaf*>(parent->children_[slot - 1]) : nullptr;
+    Leaf* right = slot < parent->count_ ? static_cast<Leaf*>(parent->children_[slot + 1]) : nullptr;
+
+    if (left != nullptr && left->count_ > LEAF_MIN){
+        shiftItems(leaf, 0, 1, leaf->count_);
+        moveItems(left, left->count_ - 1, leaf, 0, 1);
+        --left->count_;
+        ++leaf->count_;
+        parent->keys_[slot - 1] = leaf->keys_[0];
+        return;
+    }
+    if (right != nullptr && right->count_ > LEAF_MIN){
+        moveItems(right, 0, leaf, leaf->count_, 1);
+        shiftItems(right, 1, 0, right->count_ - 1);
+        --right->count_;
+        ++leaf->count_;
+        parent->keys_[slot] = right->keys_[0];
+        return;
+    }
+
+    //merge the right one of the pair into the left one
+    if (left == nullptr){
+        left = leaf;
+        ++slot;
+    }
+    else{
+        right = leaf;
+    }
+    moveItems(right, 0, left, left->count_, right->count_);
+    left->count_ += right->count_;
+    right->count_ = 0;
+    left->next_ = right->next_;
+    if (right->next_ != nullptr){
+        right->next_->prev_ = left;
+    }
+    else{
+        last_ = left;
+    }
+    removeChild(parent, slot - 1);
+    destroyLeaf(right);
+}
+
+/**
+* Tops up an inner node that fell below half full, the child at slot of
+* parent, the same way: a child and the separator over it rotate in from
+* a sibling through parent, or the two siblings merge around the
+* separator between them.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::rebalanceInner(Inner* node, Inner* parent, size_t slot)
+{
+    Inner* left = slot > 0 ? static_cast<Inner*>(parent->children_[slot - 1]) : nullptr;
+    Inner* right = slot < parent->count_ ? static_cast<Inner*>(parent->children_[slot + 1]) : nullptr;
+
+    if (left != nullptr && left->count_ > INNER_MIN){
+        node->children_[node->count_ + 1] = node->children_[node->count_];
+        for (size_t i = node->count_; i > 0; --i){
+            node->keys_[i] = std::move(node->keys_[i - 1]);
+            node->children_[i] = node->children_[i - 1];
+        }
+        node->keys_[0] = std::move(parent->keys_[slot - 1]);
+        node->children_[0] = left->children_[left->count_];
+        ++node->count_;
+        parent->keys_[slot - 1] = std::move(left->keys_[left->count_ - 1]);
+        --left->count_;
+        return;
+    }
+    if (right != nullptr && right->count_ > INNER_MIN){
+        node->keys_[node->count_] = std::move(parent->keys_[slot]);
+        node->children_[node->count_ + 1] = right->children_[0];
+        ++node->count_;
+        parent->keys_[slot] = std::move(right->keys_[0]);
+        for (size_t i = 0; i + 1 < right->count_; ++i){
+            right->keys_[i] = std::move(right->keys_[i + 1]);
+            right->children_[i] = right->children_[i + 1];
+        }
+        right->children_[right->count_ - 1] = right->children_[right->count_];
+        --right->count_;
+        return;
+    }
+
+    //merge the right one of the pair into the left one, with the
+    //separator between them coming down from parent
+    if (left == nullptr){
+        left = node;
+        ++slot;
+    }
+    else{
+        right = node;
+    }
+    left->keys_[left->count_] = std::move(parent->keys_[slot - 1]);
+    for (size_t i = 0; i < right->count_; ++i){
+        left->keys_[left->count_ + 1 + i] = std::move(right->keys_[i]);
+        left->children_[left->count_ + 1 + i] = right->children_[i];
+    }
+    left->children_[left->count_ + 1 + right->count_] = right->children_[right->count_];
+    left->count_ += right->count_ + 1;
+    removeChild(parent, slot - 1);
+    destroyInner(right);
+}
+
+/**
+* Allocates an empty leaf from the leaf pool.
+*/
+template<class Key, class Value, class Compare>
+BPlusLeaf<Key, Value>* BPlusTree<Key, Value, Compare>::newLeaf()
+{
+    void* slot = leafPool_.allocate();
+    try {
+        return new (slot) Leaf();
+    }
+    catch(...) {
+        leafPool_.deallocate(slot);
+        throw;
+    }
+}
+
+/**
+* Allocates an empty inner node from the inner node pool.
+*/
+template<class Key, class Value, class Compare>
+BPlusInner<Key, Value>* BPlusTree<Key, Value, Compare>::newInner()
+{
+    void* slot = innerPool_.allocate();
+    try {
+        return new (slot) Inner();
+    }
+    catch(...) {
+        innerPool_.deallocate(slot);
+        throw;
+    }
+}
+
+/**
+* Destroys a leaf's items and the leaf, and gives its slot back.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::destroyLeaf(Leaf* leaf)
+{
+    for (size_t i = 0; i < leaf->count_; ++i){
+        leaf->item(i).~Item();
+    }
+    leaf->~Leaf();
+    leafPool_.deallocate(leaf);
+}
+
+/**
+* Destroys an inner node, but not its children, and gives its slot back.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::destroyInner(Inner* node)
+{
+    node->~Inner();
+    innerPool_.deallocate(node);
+}
+
+/**
+* Destroys every item and node below node, a height-level subtree,
+* without handing the slots back; clear() releases the pools whole.
+* Items and keys that need no destructor call are not visited at all.
+*/
+template<class Key, class Value, class Compare>
+void BPlusTree<Key, Value, Compare>::destroySubtree(void* node, int height)
+{
+    if (std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value){
+        return;
+    }
+    if (height == 1){
+        Leaf* leaf = static_cast<Leaf*>(node);
+        for (size_t i = 0; i < leaf->count_; ++i){
+            leaf->item(i).~Item();
+        }
+        leaf->~Leaf();
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (size_t i = 0; i <= inner->count_; ++i){
+        destroySubtree(inner->children_[i], height - 1);
+    }
+    inner->~Inner();
+}
+
+/*
+  -----------------------------------------
+  End implementations for the BPlusTree class.
+  -----------------------------------------
+*/
+
+#endif
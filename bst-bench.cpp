@@ -0,0 +1,1044 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include "bst.h"
+#include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "scapegoatbst.h"
+#include "bplustree.h"
+#include "indexbst.h"
+#include "concurrentavl.h"
+#include "optimisticavl.h"
+#include "fork_join_pool.h"
+#include "tree_reclaimer.h"
+
+using namespace std;
+
+// Every call into the system allocator is counted so that each benchmark
+// can report allocations per operation alongside the time per operation.
+// The replacements are kept out of line: once GCC inlines one into a
+// caller it sees malloc paired with operator delete, or operator new
+// with free, and warns about a mismatch that is not there.
+static size_t allocationCount = 0;
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    ++allocationCount;
+    void* p = malloc(size == 0 ? 1 : size);
+    if(p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+// Simple stopwatch that also snapshots the allocation counter
+struct Timer
+{
+    chrono::steady_clock::time_point start;
+    size_t allocsAtStart;
+
+    Timer() : start(chrono::steady_clock::now()), allocsAtStart(allocationCount) {}
+
+    double elapsedNs() const
+    {
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    }
+    size_t allocs() const
+    {
+        return allocationCount - allocsAtStart;
+    }
+};
+
+void report(const string& tree, const string& phase, size_t ops, const Timer& t)
+{
+    double ns = t.elapsedNs();
+    size_t allocs = t.allocs();
+    cout << left << setw(10) << tree << setw(10) << phase
+         << right << setw(12) << fixed << setprecision(1) << ns / ops << " ns/op"
+         << setw(12) << setprecision(3) << double(allocs) / ops << " allocs/op" << endl;
+}
+
+// Keeps the optimizer from discarding lookup results
+static volatile uint64_t sink;
+
+/**
+ * Inserts n random keys, then repeatedly removes a live key and inserts a
+ * fresh one, looks every live key up, removes half of them and finally
+ * clears the tree.
+ */
+template<typename Tree>
+void benchChurn(const string& name, Tree& tree, size_t n, size_t churnOps)
+{
+    mt19937_64 rng(104);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = rng();
+
+    {
+        Timer t;
+        for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], i));
+        report(name, "insert", n, t);
+    }
+    {
+        Timer t;
+        for(size_t i = 0; i < churnOps; ++i) {
+            size_t slot = rng() % n;
+            tree.remove(keys[slot]);
+            keys[slot] = rng();
+            tree.insert(make_pair(keys[slot], i));
+        }
+        report(name, "churn", 2 * churnOps, t);
+    }
+    {
+        Timer t;
+        uint64_t sum = 0;
+        for(size_t i = 0; i < n; ++i) sum += tree.find(keys[i])->second;
+        sink = sum;
+        report(name, "find", n, t);
+    }
+    {
+        Timer t;
+        for(size_t i = 0; i < n / 2; ++i) tree.remove(keys[i]);
+        report(name, "remove", n / 2, t);
+    }
+    {
+        Timer t;
+        tree.clear();
+        report(name, "clear", n - n / 2, t);
+    }
+}
+
+/**
+ * Prints the node sizes of this build and the measured bytes per key
+ * once n keys have been inserted.
+ */
+void benchLayout(size_t n)
+{
+#ifdef AVL_PACKED_BALANCE
+    cout << "node layout (AVL_PACKED_BALANCE)" << endl;
+#else
+    cout << "node layout" << endl;
+#endif
+    cout << left << setw(40) << "sizeof(Node<uint64_t,uint64_t>)" << sizeof(Node<uint64_t, uint64_t>) << endl;
+    cout << setw(40) << "sizeof(AVLNode<uint64_t,uint64_t>)" << sizeof(AVLNode<uint64_t, uint64_t>) << endl;
+    cout << setw(40) << "sizeof(IndexNode<uint64_t,uint64_t>)" << sizeof(IndexNode<uint64_t, uint64_t>) << endl;
+
+    mt19937_64 rng(104);
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; ++i) tree.insert(make_pair(rng(), i));
+    cout << setw(40) << "avl bytes/key" << fixed << setprecision(1)
+         << double(tree.memoryUsage()) / n << endl;
+
+    rng.seed(104);
+    IndexedAVLTree<uint64_t, uint64_t> indexed;
+    indexed.reserve(n);
+    for(size_t i = 0; i < n; ++i) indexed.insert(make_pair(rng(), i));
+    cout << setw(40) << "indexed avl bytes/key" << fixed << setprecision(1)
+         << double(indexed.memoryUsage()) / n << endl;
+}
+
+/**
+ * Loads n sorted keys into an AVLTree with an insert loop and with
+ * buildFromSorted, and reports the total time of each.
+ */
+void benchBuild(size_t n)
+{
+    vector<pair<uint64_t, uint64_t> > sorted(n);
+    for(size_t i = 0; i < n; ++i) sorted[i] = make_pair(uint64_t(i) * 3, uint64_t(i));
+
+    cout << "sorted load, " << n << " keys" << endl;
+    {
+        Timer t;
+        AVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) tree.insert(sorted[i]);
+        report("avl", "insert", n, t);
+        cout << setw(20) << "" << fixed << setprecision(1) << t.elapsedNs() / 1e6 << " ms total" << endl;
+    }
+    {
+        Timer t;
+        AVLTree<uint64_t, uint64_t> tree(sorted.begin(), sorted.end());
+        report("avl", "build", n, t);
+        cout << setw(20) << "" << fixed << setprecision(1) << t.elapsedNs() / 1e6 << " ms total" << endl;
+    }
+}
+
+/**
+ * Inserts batches of random keys, sized from 0.01% to 100% of an n-key
+ * AVLTree, with an insert loop and with insertBatch.
+ */
+void benchBatch(size_t n)
+{
+    cout << "batch insert into " << n << " keys" << endl;
+    const double fractions[] = { 0.0001, 0.001, 0.01, 0.1, 1.0 };
+    for(size_t f = 0; f < sizeof(fractions) / sizeof(fractions[0]); ++f) {
+        size_t m = size_t(n * fractions[f]);
+        if(m == 0) continue;
+        for(int batched = 0; batched < 2; ++batched) {
+            mt19937_64 rng(104);
+            AVLTree<uint64_t, uint64_t> tree;
+            for(size_t i = 0; i < n; ++i) tree.insert(make_pair(rng(), i));
+            vector<pair<uint64_t, uint64_t> > batch(m);
+            for(size_t i = 0; i < m; ++i) batch[i] = make_pair(rng(), i);
+
+            Timer t;
+            if(batched) {
+                tree.insertBatch(batch.begin(), batch.end());
+            }
+            else {
+                for(size_t i = 0; i < m; ++i) tree.insert(batch[i]);
+            }
+            report(batched ? "avl-batch" : "avl-loop", to_string(m), m, t);
+        }
+    }
+}
+
+/**
+ * Runs union, intersection and difference on two n-key AVLTrees that
+ * share half their keys, with a ForkJoinPool of 1, 2, 4, ... threads up
+ * to the hardware's count. The operands are consumed, so they are
+ * rebuilt before each run.
+ */
+void benchSetOps(size_t n)
+{
+    vector<pair<uint64_t, uint64_t> > first(n);
+    vector<pair<uint64_t, uint64_t> > second(n);
+    for(size_t i = 0; i < n; ++i) {
+        first[i] = make_pair(uint64_t(i) * 4, uint64_t(i));
+        second[i] = make_pair(uint64_t(i) * 4 + (i % 2) * 2, uint64_t(i));
+    }
+
+    unsigned maxThreads = thread::hardware_concurrency();
+    if(maxThreads == 0) maxThreads = 1;
+    cout << "set operations on two " << n << "-key trees, up to " << maxThreads << " threads" << endl;
+    for(unsigned threads = 1; ; threads *= 2) {
+        if(threads > maxThreads) threads = maxThreads;
+        ForkJoinPool pool(threads);
+        string name = "avl-t" + to_string(threads);
+        const char* phases[] = { "union", "intersect", "difference" };
+        for(int op = 0; op < 3; ++op) {
+            AVLTree<uint64_t, uint64_t> a(first.begin(), first.end());
+            AVLTree<uint64_t, uint64_t> b(second.begin(), second.end());
+            AVLTree<uint64_t, uint64_t> result;
+            Timer t;
+            if(op == 0) result.setUnion(a, b, pool);
+            else if(op == 1) result.setIntersection(a, b, pool);
+            else result.setDifference(a, b, pool);
+            report(name, phases[op], 2 * n, t);
+        }
+        if(threads == maxThreads) break;
+    }
+}
+
+/**
+ * Ingests n timestamps that arrive nearly sorted (each within a small
+ * window of its sorted position) into an AVLTree: with plain inserts,
+ * which catch exact appends on their own, and with each insert hinted
+ * at the previous one's position.
+ */
+void benchAppend(size_t n)
+{
+    cout << "nearly sorted ingest, " << n << " keys" << endl;
+    mt19937_64 rng(104);
+    const uint64_t windows[] = { 0, 8, 64 };
+    for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+        vector<uint64_t> keys(n);
+        for(size_t i = 0; i < n; ++i) keys[i] = uint64_t(i) * 16 + (windows[w] ? rng() % (windows[w] * 16) : 0);
+        string window = "jitter" + to_string(windows[w]);
+        {
+            Timer t;
+            AVLTree<uint64_t, uint64_t> tree;
+            for(size_t i = 0; i < n; ++i) tree.insert(make_pair(keys[i], i));
+            report("avl", window, n, t);
+        }
+        {
+            Timer t;
+            AVLTree<uint64_t, uint64_t> tree;
+            AVLTree<uint64_t, uint64_t>::iterator hint = tree.end();
+            for(size_t i = 0; i < n; ++i) hint = tree.insert(hint, make_pair(keys[i], i));
+            report("avl-hint", window, n, t);
+        }
+    }
+}
+
+/**
+ * Counts occurrences of n random keys in an AVLTree, with find then
+ * insert on a miss and with findOrInsert, drawing from n/4 distinct
+ * keys (mostly hits) and from 4n (mostly misses).
+ */
+void benchCount(size_t n)
+{
+    cout << "counting, " << n << " draws" << endl;
+    const size_t ranges[] = { n / 4 + 1, 4 * n };
+    const char* names[] = { "hits", "misses" };
+    for(int r = 0; r < 2; ++r) {
+        mt19937_64 rng(104);
+        vector<uint64_t> draws(n);
+        for(size_t i = 0; i < n; ++i) draws[i] = rng() % ranges[r];
+        {
+            AVLTree<uint64_t, uint64_t> tree;
+            Timer t;
+            for(size_t i = 0; i < n; ++i) {
+                AVLTree<uint64_t, uint64_t>::iterator it = tree.find(draws[i]);
+                if(it == tree.end()) tree.insert(make_pair(draws[i], uint64_t(1)));
+                else ++it->second;
+            }
+            report("find+ins", names[r], n, t);
+        }
+        {
+            AVLTree<uint64_t, uint64_t> tree;
+            Timer t;
+            for(size_t i = 0; i < n; ++i) ++tree.findOrInsert(draws[i]);
+            report("findOrIns", names[r], n, t);
+        }
+    }
+}
+
+/**
+ * Loads string keys with 1 KB string values into an AVLTree by copying
+ * insert, by moving insert and by try_emplace, then repeats try_emplace
+ * on keys that are all present, which must build nothing.
+ */
+void benchEmplace(size_t n)
+{
+    size_t m = min(n, size_t(100000));
+    cout << "string items, " << m << " keys with 1 KB values" << endl;
+    vector<string> keys(m);
+    for(size_t i = 0; i < m; ++i) keys[i] = "timestamp-key-" + to_string(i * 7919 % m) + "-padding-to-defeat-sso";
+    const string value(1024, 'v');
+    {
+        AVLTree<string, string> tree;
+        Timer t;
+        for(size_t i = 0; i < m; ++i) {
+            pair<const string, string> item(keys[i], value);
+            tree.insert(item);
+        }
+        report("avl", "copy", m, t);
+    }
+    {
+        AVLTree<string, string> tree;
+        Timer t;
+        for(size_t i = 0; i < m; ++i) tree.insert(pair<const string, string>(keys[i], value));
+        report("avl", "move", m, t);
+    }
+    {
+        AVLTree<string, string> tree;
+        Timer t;
+        for(size_t i = 0; i < m; ++i) tree.try_emplace(keys[i], value);
+        report("avl", "emplace", m, t);
+
+        Timer hits;
+        for(size_t i = 0; i < m; ++i) tree.try_emplace(keys[i], value);
+        report("avl", "emp-hit", m, hits);
+    }
+}
+
+/**
+ * Iterates over every key of an n-key AVLTree, forwards and backwards,
+ * once after random inserts and once after a sorted build. Compare with
+ * the bst-bench-threaded build to see what the in-order threads save.
+ */
+void benchScan(size_t n)
+{
+#ifdef BST_THREADED
+    cout << "full scan, " << n << " keys (BST_THREADED)" << endl;
+#else
+    cout << "full scan, " << n << " keys" << endl;
+#endif
+    mt19937_64 rng(104);
+    vector<pair<uint64_t, uint64_t> > sorted(n);
+    for(size_t i = 0; i < n; ++i) sorted[i] = make_pair(uint64_t(i) * 3, uint64_t(i));
+    shuffle(sorted.begin(), sorted.end(), rng);
+    AVLTree<uint64_t, uint64_t> shuffled;
+    for(size_t i = 0; i < n; ++i) shuffled.insert(sorted[i]);
+    sort(sorted.begin(), sorted.end());
+    AVLTree<uint64_t, uint64_t> built(sorted.begin(), sorted.end());
+
+    AVLTree<uint64_t, uint64_t>* trees[] = { &shuffled, &built };
+    const char* names[] = { "avl-rand", "avl-built" };
+    for(int i = 0; i < 2; ++i) {
+        for(int pass = 0; pass < 3; ++pass) {
+            Timer t;
+            uint64_t sum = 0;
+            for(AVLTree<uint64_t, uint64_t>::iterator it = trees[i]->begin(); it != trees[i]->end(); ++it) {
+                sum += it->second;
+            }
+            sink = sum;
+            if(pass == 2) report(names[i], "forward", n, t);
+        }
+        Timer t;
+        uint64_t sum = 0;
+        for(AVLTree<uint64_t, uint64_t>::reverse_iterator it = trees[i]->rbegin(); it != trees[i]->rend(); ++it) {
+            sum += it->second;
+        }
+        sink = sum;
+        report(names[i], "backward", n, t);
+    }
+}
+
+/**
+ * Loads and looks up string keys sharing a long prefix, ordered by
+ * std::less (two string compares per node on a search path) and by
+ * ThreeWayCompare (one). Lookups are by std::string and by const char*;
+ * only the transparent comparator takes the latter without building a
+ * temporary std::string per lookup.
+ */
+template<typename Compare>
+void benchStringKeys(const string& name, const vector<string>& keys, const vector<size_t>& probes)
+{
+    size_t m = keys.size();
+    AVLTree<string, uint64_t, Compare> tree;
+    Timer t;
+    for(size_t i = 0; i < m; ++i) tree.insert(make_pair(keys[i], uint64_t(i)));
+    report(name, "insert", m, t);
+
+    Timer found;
+    uint64_t sum = 0;
+    for(size_t i = 0; i < probes.size(); ++i) sum += tree.find(keys[probes[i]])->second;
+    report(name, "find", probes.size(), found);
+
+    Timer foundRaw;
+    for(size_t i = 0; i < probes.size(); ++i) sum += tree.find(keys[probes[i]].c_str())->second;
+    report(name, "find-cstr", probes.size(), foundRaw);
+    sink = sum;
+}
+
+void benchStrings(size_t n)
+{
+    size_t m = min(n, size_t(200000));
+    cout << "string keys, " << m << " keys with a shared prefix" << endl;
+    vector<string> keys(m);
+    for(size_t i = 0; i < m; ++i) keys[i] = "https://example.com/api/v2/objects/" + to_string(i * 7919 % m);
+    mt19937_64 rng(104);
+    vector<size_t> probes(m);
+    for(size_t i = 0; i < m; ++i) probes[i] = rng() % m;
+
+    benchStringKeys<std::less<string> >("avl-less", keys, probes);
+    benchStringKeys<ThreeWayCompare>("avl-3way", keys, probes);
+}
+
+/**
+ * Times how long clear() holds up the caller on an n-key AVLTree, with
+ * the nodes freed in place and with them handed to a TreeReclaimer, and
+ * how long the reclaimer then takes to catch up. Values are integers,
+ * which need no destructor, and short strings on the heap, which do.
+ */
+template<typename Value>
+void benchTeardownOf(const string& name, size_t n, Value (*makeValue)(size_t), TreeReclaimer& reclaimer)
+{
+    for(int async = 0; async < 2; ++async) {
+        AVLTree<uint64_t, Value> tree;
+        if(async) tree.setReclaimer(&reclaimer);
+        for(size_t i = 0; i < n; ++i) tree.insert(make_pair(uint64_t(i) * 7919 % n, makeValue(i)));
+
+        Timer t;
+        tree.clear();
+        report(name, async ? "clr-async" : "clear", 1, t);
+        if(async) {
+            cout << "  backlog after clear(): " << reclaimer.backlog() << " nodes" << endl;
+            Timer drained;
+            reclaimer.drain();
+            report(name, "drain", 1, drained);
+        }
+    }
+}
+
+static uint64_t integerValue(size_t i)
+{
+    return i;
+}
+
+static string stringValue(size_t i)
+{
+    return "value-stored-out-of-line-" + to_string(i);
+}
+
+void benchTeardown(size_t n)
+{
+    cout << "teardown, " << n << " keys (ns per clear)" << endl;
+    TreeReclaimer reclaimer;
+    benchTeardownOf<uint64_t>("avl-int", n, &integerValue, reclaimer);
+    benchTeardownOf<string>("avl-str", n, &stringValue, reclaimer);
+}
+
+/**
+ * Draws n ranks in [0, keys) from a Zipf distribution with exponent s:
+ * rank r comes up with probability proportional to 1 / (r + 1)^s.
+ */
+static vector<size_t> zipfRanks(size_t keys, size_t n, double s, mt19937_64& rng)
+{
+    vector<double> cdf(keys);
+    double total = 0;
+    for(size_t r = 0; r < keys; ++r) {
+        total += 1.0 / pow(double(r + 1), s);
+        cdf[r] = total;
+    }
+    uniform_real_distribution<double> uniform(0, total);
+    vector<size_t> ranks(n);
+    for(size_t i = 0; i < n; ++i) {
+        ranks[i] = min(size_t(lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin()), keys - 1);
+    }
+    return ranks;
+}
+
+template<typename Tree>
+void benchLookups(const string& name, Tree& tree, const vector<uint64_t>& keys,
+                  const vector<uint64_t>& zipfProbes, const vector<uint64_t>& uniformProbes)
+{
+    Timer t;
+    for(size_t i = 0; i < keys.size(); ++i) tree.insert(make_pair(keys[i], keys[i]));
+    report(name, "insert", keys.size(), t);
+
+    uint64_t sum = 0;
+    Timer zipf;
+    for(size_t i = 0; i < zipfProbes.size(); ++i) sum += tree.find(zipfProbes[i])->second;
+    report(name, "zipf", zipfProbes.size(), zipf);
+    cout << "  height after zipf lookups: " << tree.height() << endl;
+
+    Timer uniform;
+    for(size_t i = 0; i < uniformProbes.size(); ++i) sum += tree.find(uniformProbes[i])->second;
+    report(name, "uniform", uniformProbes.size(), uniform);
+    sink = sum;
+}
+
+/**
+ * Looks up n keys drawn from a Zipf distribution in an AVLTree and a
+ * SplayTree of n random keys, then n keys drawn uniformly, at a skew
+ * where about 90% of the lookups hit 1% of the keys and at a steeper
+ * one. The hot keys are scattered over the key space, and the keys are
+ * inserted in an order unrelated to how hot they are, so that neither
+ * tree starts out with the hot keys near its root.
+ */
+void benchZipf(size_t n)
+{
+    const double exponents[] = { 1.2, 1.5 };
+    mt19937_64 rng(119);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = rng();
+    vector<uint64_t> insertOrder(keys);
+    shuffle(insertOrder.begin(), insertOrder.end(), rng);
+
+    for(size_t e = 0; e < sizeof(exponents) / sizeof(exponents[0]); ++e) {
+        vector<size_t> ranks = zipfRanks(n, n, exponents[e], rng);
+        vector<uint64_t> zipfProbes(n), uniformProbes(n);
+        size_t hot = 0;
+        for(size_t i = 0; i < n; ++i) {
+            zipfProbes[i] = keys[ranks[i]];
+            uniformProbes[i] = keys[rng() % n];
+            if(ranks[i] < (n + 99) / 100) ++hot;
+        }
+        cout << "zipf lookups, " << n << " keys, s = " << fixed << setprecision(1) << exponents[e]
+             << ": " << 100.0 * hot / n << "% of lookups hit the top 1% of keys" << endl;
+
+        AVLTree<uint64_t, uint64_t> avl;
+        benchLookups("avl", avl, insertOrder, zipfProbes, uniformProbes);
+        SplayTree<uint64_t, uint64_t> splay;
+        benchLookups("splay", splay, insertOrder, zipfProbes, uniformProbes);
+    }
+}
+
+/**
+ * One step of a mixed workload: insert key, or remove it.
+ */
+struct MixedOp
+{
+    bool insert;
+    uint64_t key;
+};
+
+template<typename Tree>
+void benchMixedOn(const string& name, const vector<uint64_t>& initial, const vector<MixedOp>& ops)
+{
+    Tree tree;
+    for(size_t i = 0; i < initial.size(); ++i) tree.insert(make_pair(initial[i], initial[i]));
+
+    size_t rotationsBefore = tree.rotations();
+    Timer t;
+    for(size_t i = 0; i < ops.size(); ++i) {
+        if(ops[i].insert) tree.insert(make_pair(ops[i].key, ops[i].key));
+        else tree.remove(ops[i].key);
+    }
+    report(name, "mixed", ops.size(), t);
+    cout << "  rotations/op: " << fixed << setprecision(3)
+         << double(tree.rotations() - rotationsBefore) / ops.size() << endl;
+}
+
+/**
+ * Starts from n random keys and runs n inserts of fresh keys and removes
+ * of live ones, interleaved at random, on an AVLTree and a RedBlackTree,
+ * for several shares of inserts. Both trees see the same sequence.
+ */
+void benchMixed(size_t n)
+{
+    const int insertPercents[] = { 90, 50, 10 };
+    mt19937_64 rng(120);
+    vector<uint64_t> initial(n);
+    for(size_t i = 0; i < n; ++i) initial[i] = rng();
+
+    for(size_t p = 0; p < sizeof(insertPercents) / sizeof(insertPercents[0]); ++p) {
+        vector<uint64_t> live(initial);
+        vector<MixedOp> ops(n);
+        for(size_t i = 0; i < n; ++i) {
+            ops[i].insert = live.empty() || int(rng() % 100) < insertPercents[p];
+            if(ops[i].insert) {
+                ops[i].key = rng();
+                live.push_back(ops[i].key);
+            }
+            else {
+                size_t pick = rng() % live.size();
+                ops[i].key = live[pick];
+                live[pick] = live.back();
+                live.pop_back();
+            }
+        }
+        cout << "mixed workload, " << n << " keys, " << insertPercents[p] << "% inserts / "
+             << 100 - insertPercents[p] << "% removes" << endl;
+        benchMixedOn<AVLTree<uint64_t, uint64_t> >("avl", initial, ops);
+        benchMixedOn<RedBlackTree<uint64_t, uint64_t> >("rb", initial, ops);
+    }
+}
+
+/**
+ * Builds a tree of n random keys and reports the node pool's bytes per
+ * key, the tree's height and the time for n lookups of random live keys.
+ */
+template<typename Tree>
+void benchMemoryOf(const string& name, size_t nodeSize, const vector<uint64_t>& keys,
+                   const vector<uint64_t>& probes)
+{
+    Tree tree;
+    Timer t;
+    for(size_t i = 0; i < keys.size(); ++i) tree.insert(make_pair(keys[i], keys[i]));
+    report(name, "insert", keys.size(), t);
+
+    uint64_t sum = 0;
+    Timer found;
+    for(size_t i = 0; i < probes.size(); ++i) sum += tree.find(probes[i])->second;
+    report(name, "find", probes.size(), found);
+    sink = sum;
+
+    cout << "  " << nodeSize << " bytes/node, " << fixed << setprecision(1)
+         << double(tree.memoryUsage()) / keys.size() << " bytes/key in the pool, height "
+         << tree.height() << endl;
+}
+
+/**
+ * Compares what the tree kinds spend per key on uint64_t keys and values,
+ * and what their shape costs lookups in return.
+ */
+void benchMemory(size_t n)
+{
+    cout << "memory per key, " << n << " random keys" << endl;
+    mt19937_64 rng(121);
+    vector<uint64_t> keys(n), probes(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = rng();
+    for(size_t i = 0; i < n; ++i) probes[i] = keys[rng() % n];
+
+    benchMemoryOf<AVLTree<uint64_t, uint64_t> >("avl", sizeof(AVLNode<uint64_t, uint64_t>), keys, probes);
+    benchMemoryOf<RedBlackTree<uint64_t, uint64_t> >("rb", sizeof(RBNode<uint64_t, uint64_t>), keys, probes);
+    benchMemoryOf<ScapegoatTree<uint64_t, uint64_t> >("scapegoat", sizeof(Node<uint64_t, uint64_t>), keys, probes);
+}
+
+/**
+ * Looks n random live keys up in an AVL tree and in a frozen snapshot of
+ * it, then looks up missing keys and lower bounds in the snapshot.
+ */
+void benchFrozen(size_t n)
+{
+    cout << "frozen snapshot, " << n << " random keys" << endl;
+    mt19937_64 rng(122);
+    vector<uint64_t> probes(n), misses(n);
+    AVLTree<uint64_t, uint64_t> avl;
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t key = rng() & ~uint64_t(1);
+        avl.insert(make_pair(key, key));
+    }
+    vector<uint64_t> keys;
+    for(AVLTree<uint64_t, uint64_t>::iterator it = avl.begin(); it != avl.end(); ++it) keys.push_back(it->first);
+    for(size_t i = 0; i < n; ++i) probes[i] = keys[rng() % keys.size()];
+    for(size_t i = 0; i < n; ++i) misses[i] = keys[rng() % keys.size()] | 1;
+
+    uint64_t sum = 0;
+    Timer t;
+    for(size_t i = 0; i < n; ++i) sum += avl.find(probes[i])->second;
+    report("avl", "find", n, t);
+
+    Timer built;
+    FrozenTree<uint64_t, uint64_t> frozen = avl.freeze();
+    report("frozen", "freeze", keys.size(), built);
+
+    Timer found;
+    for(size_t i = 0; i < n; ++i) sum += frozen.find(probes[i])->second;
+    report("frozen", "find", n, found);
+
+    Timer missed;
+    for(size_t i = 0; i < n; ++i) sum += frozen.find(misses[i]) == frozen.end();
+    report("frozen", "miss", n, missed);
+
+    Timer bounded;
+    for(size_t i = 0; i < n; ++i) {
+        FrozenTree<uint64_t, uint64_t>::iterator it = frozen.lower_bound(misses[i]);
+        if(it != frozen.end()) sum += it->first;
+    }
+    report("frozen", "lower", n, bounded);
+    sink = sum;
+
+    cout << "  " << fixed << setprecision(1) << double(avl.memoryUsage()) / keys.size()
+         << " bytes/key in the tree, " << double(frozen.memoryUsage()) / keys.size()
+         << " in the snapshot" << endl;
+}
+
+/**
+ * Inserts the keys, looks up random live keys, scans everything in key
+ * order and removes half of the keys again, then reports the bytes per
+ * key the tree held at its largest and the levels a lookup descends.
+ */
+template<typename Tree>
+void benchWideOn(const string& name, const vector<uint64_t>& keys, const vector<uint64_t>& probes,
+                 bool hugePages)
+{
+    Tree tree;
+    tree.setHugePages(hugePages);
+    Timer t;
+    for(size_t i = 0; i < keys.size(); ++i) tree.insert(make_pair(keys[i], keys[i]));
+    report(name, "insert", keys.size(), t);
+
+    uint64_t sum = 0;
+    Timer found;
+    for(size_t i = 0; i < probes.size(); ++i) sum += tree.find(probes[i])->second;
+    report(name, "find", probes.size(), found);
+
+    Timer scanned;
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    report(name, "scan", keys.size(), scanned);
+    sink = sum;
+
+    size_t bytes = tree.memoryUsage();
+    int height = tree.height();
+    Timer removed;
+    for(size_t i = 0; i < keys.size(); i += 2) tree.remove(keys[i]);
+    report(name, "remove", (keys.size() + 1) / 2, removed);
+
+    cout << "  " << fixed << setprecision(1) << double(bytes) / keys.size()
+         << " bytes/key, " << height << " levels" << endl;
+}
+
+/**
+ * Compares the AVL tree with the B+tree on random uint64_t keys. Run it
+ * at 1M, 10M and 100M keys to see the gap grow as the trees fall out of
+ * cache; 100M keys take about 5 GB in the AVL tree.
+ */
+void benchWide(size_t n)
+{
+    cout << "avl vs b+tree, " << n << " random keys, " << BPLUS_NODE_BYTES << "-byte nodes" << endl;
+    mt19937_64 rng(123);
+    vector<uint64_t> keys(n), probes(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = rng();
+    for(size_t i = 0; i < n; ++i) probes[i] = keys[rng() % n];
+
+    benchWideOn<AVLTree<uint64_t, uint64_t> >("avl", keys, probes, false);
+    benchWideOn<BPlusTree<uint64_t, uint64_t> >("b+tree", keys, probes, false);
+    benchWideOn<AVLTree<uint64_t, uint64_t> >("avl-huge", keys, probes, true);
+    benchWideOn<BPlusTree<uint64_t, uint64_t> >("b+huge", keys, probes, true);
+}
+
+/**
+ * An AVL tree behind one mutex, the usual way to share a tree that was
+ * not built for it, and the baseline for the concurrent trees.
+ */
+class LockedAVLTree
+{
+public:
+    void insert(const pair<const uint64_t, uint64_t>& item)
+    {
+        lock_guard<mutex> lock(mutex_);
+        tree_.insert(item);
+    }
+    void remove(uint64_t key)
+    {
+        lock_guard<mutex> lock(mutex_);
+        tree_.remove(key);
+    }
+
+    class Handle
+    {
+    public:
+        explicit Handle(LockedAVLTree& tree) : tree_(tree) {}
+
+        bool find(uint64_t key, uint64_t& value)
+        {
+            lock_guard<mutex> lock(tree_.mutex_);
+            AVLTree<uint64_t, uint64_t>::iterator it = tree_.tree_.find(key);
+            if(it == tree_.tree_.end()) return false;
+            value = it->second;
+            return true;
+        }
+        void insert(const pair<const uint64_t, uint64_t>& item)
+        {
+            tree_.insert(item);
+        }
+        void remove(uint64_t key)
+        {
+            tree_.remove(key);
+        }
+
+    private:
+        LockedAVLTree& tree_;
+    };
+    typedef Handle Reader;
+
+private:
+    AVLTree<uint64_t, uint64_t> tree_;
+    mutex mutex_;
+};
+
+/**
+ * Runs threads readers, each looking up every probe once starting at its
+ * own offset, while one writer thread keeps removing and reinserting the
+ * keys. Reports the wall time per lookup across all readers, so perfect
+ * scaling halves it each time the readers double.
+ */
+template<typename Tree>
+void benchReadersOn(const string& name, Tree& tree, const vector<uint64_t>& keys,
+                    const vector<uint64_t>& probes, size_t threads)
+{
+    atomic<bool> done(false);
+    size_t writes = 0;
+    thread writer([&]() {
+        size_t i = 0;
+        for(; !done.load(memory_order_relaxed); ++i) {
+            uint64_t key = keys[i % keys.size()];
+            tree.remove(key);
+            tree.insert(make_pair(key, key));
+        }
+        writes = i;
+    });
+
+    atomic<uint64_t> total(0);
+    vector<thread> readers;
+    Timer t;
+    for(size_t r = 0; r < threads; ++r) {
+        readers.push_back(thread([&, r]() {
+            typename Tree::Reader reader(tree);
+            size_t offset = r * probes.size() / threads;
+            uint64_t sum = 0, value;
+            for(size_t i = 0; i < probes.size(); ++i) {
+                if(reader.find(probes[(offset + i) % probes.size()], value)) sum += value;
+            }
+            total += sum;
+        }));
+    }
+    for(size_t r = 0; r < readers.size(); ++r) readers[r].join();
+    report(name, "read x" + to_string(threads), threads * probes.size(), t);
+    done = true;
+    writer.join();
+    sink = total;
+    cout << "  " << writes << " remove+insert pairs meanwhile" << endl;
+}
+
+/**
+ * Measures how lookup throughput grows with reader threads while one
+ * thread writes, for the epoch-based concurrent tree against an AVL tree
+ * behind a mutex. Readers go up to the core count (and at least 4); on
+ * fewer cores the readers and the writer time-share, and only the
+ * per-lookup cost is comparable.
+ */
+void benchReaders(size_t n)
+{
+    size_t cores = thread::hardware_concurrency();
+    cout << "concurrent readers, " << n << " random keys, one writer, "
+         << cores << " cores" << endl;
+    mt19937_64 rng(124);
+    vector<uint64_t> keys(n), probes(n);
+    for(size_t i = 0; i < n; ++i) keys[i] = rng();
+    for(size_t i = 0; i < n; ++i) probes[i] = keys[rng() % n];
+
+    ConcurrentAVLTree<uint64_t, uint64_t> concurrent;
+    LockedAVLTree locked;
+    for(size_t i = 0; i < n; ++i) {
+        concurrent.insert(make_pair(keys[i], keys[i]));
+        locked.insert(make_pair(keys[i], keys[i]));
+    }
+    size_t most = cores > 4 ? cores : 4;
+    for(size_t threads = 1; threads <= most; threads *= 2) {
+        benchReadersOn("epoch", concurrent, keys, probes, threads);
+        benchReadersOn("mutex", locked, keys, probes, threads);
+    }
+}
+
+/**
+ * One step of a concurrent workload: find, insert or remove the key at
+ * an index into the benchmark's keys.
+ */
+struct ConcurrentOp
+{
+    enum Kind { FIND, INSERT, REMOVE } kind;
+    size_t key;
+};
+
+/**
+ * Splits ops.size() operations between threads, each running its share
+ * through a handle of its own: a find, an insert or a remove of a key
+ * from keys, as ops says. Reports the wall time per operation across
+ * all threads.
+ */
+template<typename Tree>
+void benchWritersOn(const string& name, Tree& tree, const vector<uint64_t>& keys,
+                    const vector<ConcurrentOp>& ops, size_t threads)
+{
+    atomic<uint64_t> total(0);
+    vector<thread> workers;
+    Timer t;
+    for(size_t w = 0; w < threads; ++w) {
+        workers.push_back(thread([&, w]() {
+            typename Tree::Handle handle(tree);
+            size_t first = w * ops.size() / threads, last = (w + 1) * ops.size() / threads;
+            uint64_t sum = 0, value;
+            for(size_t i = first; i < last; ++i) {
+                uint64_t key = keys[ops[i].key];
+                if(ops[i].kind == ConcurrentOp::FIND) {
+                    if(handle.find(key, value)) sum += value;
+                }
+                else if(ops[i].kind == ConcurrentOp::INSERT) handle.insert(make_pair(key, key));
+                else handle.remove(key);
+            }
+            total += sum;
+        }));
+    }
+    for(size_t w = 0; w < workers.size(); ++w) workers[w].join();
+    report(name, "mixed x" + to_string(threads), ops.size(), t);
+    sink = total;
+}
+
+/**
+ * Measures how a half-find, half-update workload scales with threads,
+ * for the optimistic concurrent AVL tree against an AVL tree behind a
+ * mutex. Both start with the same n keys, and updates pick from twice as
+ * many, so the size stays about the same. Threads go up to the core count
+ * (and at least 4); on fewer cores they time-share, and only the
+ * per-operation cost and the price of contention are comparable.
+ */
+void benchWriters(size_t n)
+{
+    size_t cores = thread::hardware_concurrency();
+    cout << "concurrent writers, " << n << " random keys, "
+         << cores << " cores" << endl;
+    mt19937_64 rng(125);
+    vector<uint64_t> keys(2 * n);
+    for(size_t i = 0; i < keys.size(); ++i) keys[i] = rng();
+    vector<ConcurrentOp> ops(2 * n);
+    for(size_t i = 0; i < ops.size(); ++i) {
+        unsigned dice = rng() % 4;
+        ops[i].kind = dice < 2 ? ConcurrentOp::FIND : dice == 2 ? ConcurrentOp::INSERT : ConcurrentOp::REMOVE;
+        ops[i].key = rng() % keys.size();
+    }
+
+    size_t most = cores > 4 ? cores : 4;
+    for(size_t threads = 1; threads <= most; threads *= 2) {
+        OptimisticAVLTree<uint64_t, uint64_t> optimistic;
+        LockedAVLTree locked;
+        {
+            OptimisticAVLTree<uint64_t, uint64_t>::Handle handle(optimistic);
+            for(size_t i = 0; i < n; ++i) {
+                handle.insert(make_pair(keys[2 * i], keys[2 * i]));
+                locked.insert(make_pair(keys[2 * i], keys[2 * i]));
+            }
+        }
+        benchWritersOn("optimist", optimistic, keys, ops, threads);
+        benchWritersOn("mutex", locked, keys, ops, threads);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // usage: bst-bench [keys] [section]
+    size_t n = 1000000;
+    string section = "all";
+    if(argc > 1) n = strtoul(argv[1], NULL, 10);
+    if(argc > 2) section = argv[2];
+
+    if(section == "all" || section == "churn") {
+        cout << "churn benchmark, " << n << " keys" << endl;
+        BinarySearchTree<uint64_t, uint64_t> bst;
+        benchChurn("bst", bst, n, n);
+        AVLTree<uint64_t, uint64_t> avl;
+        benchChurn("avl", avl, n, n);
+        RedBlackTree<uint64_t, uint64_t> rb;
+        benchChurn("rb", rb, n, n);
+        AVLTree<uint64_t, uint64_t> avlHuge;
+        avlHuge.setHugePages(true);
+        benchChurn("avl-huge", avlHuge, n, n);
+        IndexedAVLTree<uint64_t, uint64_t> indexed;
+        benchChurn("avl-index", indexed, n, n);
+    }
+    if(section == "all" || section == "layout") {
+        benchLayout(n);
+    }
+    if(section == "all" || section == "build") {
+        benchBuild(n);
+    }
+    if(section == "all" || section == "batch") {
+        benchBatch(n);
+    }
+    if(section == "all" || section == "setops") {
+        benchSetOps(n);
+    }
+    if(section == "all" || section == "append") {
+        benchAppend(n);
+    }
+    if(section == "all" || section == "count") {
+        benchCount(n);
+    }
+    if(section == "all" || section == "emplace") {
+        benchEmplace(n);
+    }
+    if(section == "all" || section == "scan") {
+        benchScan(n);
+    }
+    if(section == "all" || section == "strings") {
+        benchStrings(n);
+    }
+    if(section == "all" || section == "teardown") {
+        benchTeardown(n);
+    }
+    if(section == "all" || section == "zipf") {
+        benchZipf(n);
+    }
+    if(section == "all" || section == "mixed") {
+        benchMixed(n);
+    }
+    if(section == "all" || section == "memory") {
+        benchMemory(n);
+    }
+    if(section == "all" || section == "frozen") {
+        benchFrozen(n);
+    }
+    if(section == "all" || section == "bplus") {
+        benchWide(n);
+    }
+    if(section == "all" || section == "readers") {
+        benchReaders(n);
+    }
+    if(section == "all" || section == "writers") {
+        benchWriters(n);
+    }
+    return 0;
+}
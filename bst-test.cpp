@@ -1,10 +1,219 @@
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdexcept>
 #include "bst.h"
 #include "avlbst.h"
+#include "indexbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "scapegoatbst.h"
+#include "bplustree.h"
+#include "concurrentavl.h"
+#include "optimisticavl.h"
 
 using namespace std;
 
+// Set when a check fails, so that main can return nonzero
+static bool anyFailed = false;
+
+/**
+ * Prints whether a check held.
+ */
+void check(bool ok, const string& what)
+{
+    cout << (ok ? "Checked: " : "FAILED: ") << what << endl;
+    if(!ok) anyFailed = true;
+}
+
+/**
+ * Returns the keys from first up to but not including last, step apart.
+ */
+vector<int> keyRange(int first, int last, int step)
+{
+    vector<int> keys;
+    for(int key = first; key < last; key += step) keys.push_back(key);
+    return keys;
+}
+
+/**
+ * Returns whether tree holds exactly keys, in order.
+ */
+template<typename Tree>
+bool inOrder(const Tree& tree, const vector<int>& keys)
+{
+    size_t i = 0;
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++i) {
+        if(i == keys.size() || it->first != keys[i]) return false;
+    }
+    return i == keys.size();
+}
+
+/**
+ * Returns whether tree holds exactly keys, in order, and is balanced.
+ */
+template<typename Tree>
+bool holds(const Tree& tree, const vector<int>& keys)
+{
+    return inOrder(tree, keys) && tree.isBalanced();
+}
+
+/**
+ * Inserts and removes ops random keys below range, each key mapped to
+ * itself, and returns the keys that should be left, in order.
+ */
+template<typename Tree>
+vector<int> churn(Tree& tree, unsigned seed, int ops, int range)
+{
+    mt19937 rng(seed);
+    map<int,int> model;
+    for(int i = 0; i < ops; ++i) {
+        int key = (int)(rng() % range);
+        if(rng() % 3 != 0) {
+            tree.insert(std::make_pair(key, key));
+            model[key] = key;
+        }
+        else {
+            tree.remove(key);
+            model.erase(key);
+        }
+    }
+    vector<int> keys;
+    for(map<int,int>::iterator it = model.begin(); it != model.end(); ++it) keys.push_back(it->first);
+    return keys;
+}
+
+
+/**
+ * A value that counts how many times one has been constructed.
+ */
+struct Counted
+{
+    static int built;
+    int value;
+
+    Counted(int v) : value(v) { ++built; }
+    Counted(const Counted& other) : value(other.value) { ++built; }
+    Counted(Counted&& other) : value(other.value) { ++built; }
+    Counted& operator=(const Counted& other) = default;
+};
+
+// The trees print their values
+ostream& operator<<(ostream& out, const Counted& counted)
+{
+    return out << counted.value;
+}
+
+int Counted::built = 0;
+
+/**
+ * Checks that emplace and try_emplace leave an existing key's value alone
+ * and that a try_emplace hit builds nothing, not even from a moved key.
+ */
+template<typename Tree>
+void checkEmplace(const string& name)
+{
+    Tree tree;
+    string key = "alpha";
+    std::pair<typename Tree::iterator, bool> added = tree.try_emplace(std::move(key), 1);
+    check(added.second && added.first->first == "alpha" && added.first->second.value == 1,
+          name + " try_emplace of a new key inserts it");
+    key = "alpha";
+    int before = Counted::built;
+    std::pair<typename Tree::iterator, bool> hit = tree.try_emplace(std::move(key), 2);
+    check(!hit.second && Counted::built == before && key == "alpha" && hit.first->second.value == 1,
+          name + " try_emplace of a present key constructs nothing and keeps the key");
+    hit = tree.emplace(string("alpha"), Counted(3));
+    check(!hit.second && hit.first->second.value == 1 && tree.find("alpha")->second.value == 1,
+          name + " emplace of a present key keeps the old value");
+    added = tree.emplace(string("beta"), Counted(4));
+    check(added.second && tree.find("beta")->second.value == 4 && tree.find("alpha")->second.value == 1,
+          name + " emplace of a new key inserts it");
+}
+
+/**
+ * A BinarySearchTree that can check the heights and balance it keeps in
+ * its nodes against a fresh walk of the tree.
+ */
+class CheckedTree : public BinarySearchTree<int,int>
+{
+public:
+    /**
+     * Returns whether height() and isBalanced(), for the whole tree and
+     * for the subtree at every key, match a walk of the nodes.
+     */
+    bool heightsHold() const
+    {
+        bool balanced;
+        if(height() != walk(root_, balanced) || isBalanced() != balanced) return false;
+        for(iterator it = begin(); it != end(); ++it) {
+            if(height(it) != walk(internalFind(it->first), balanced) || isBalanced(it) != balanced) return false;
+        }
+        return height(end()) == 0 && isBalanced(end());
+    }
+
+    /**
+     * Returns a key whose node has two children, or -1 if there is none.
+     */
+    int keyWithTwoChildren() const
+    {
+        for(iterator it = begin(); it != end(); ++it) {
+            Node<int,int>* node = internalFind(it->first);
+            if(node->getLeft() != nullptr && node->getRight() != nullptr) return it->first;
+        }
+        return -1;
+    }
+
+private:
+    // Height of the subtree at node; balanced tells whether all of it is
+    static int walk(const Node<int,int>* node, bool& balanced)
+    {
+        balanced = true;
+        if(node == nullptr) return 0;
+        bool leftBalanced;
+        bool rightBalanced;
+        int leftHeight = walk(node->getLeft(), leftBalanced);
+        int rightHeight = walk(node->getRight(), rightBalanced);
+        balanced = leftBalanced && rightBalanced && abs(leftHeight - rightHeight) <= 1;
+        return max(leftHeight, rightHeight) + 1;
+    }
+};
+
+/**
+ * A RedBlackTree that can check its own coloring.
+ */
+class CheckedRedBlackTree : public RedBlackTree<int,int>
+{
+public:
+    /**
+     * Returns whether the root is black, no red node has a red child and
+     * every path down to a leaf passes the same number of black nodes.
+     */
+    bool colorsHold() const
+    {
+        const RBNode<int,int>* root = static_cast<const RBNode<int,int>*>(root_);
+        return (root == nullptr || !root->isRed()) && blackHeight(root) >= 0;
+    }
+
+private:
+    // Black nodes on every path down from node, or -1 if the rules break
+    static int blackHeight(const RBNode<int,int>* node)
+    {
+        if(node == nullptr) return 1;
+        const RBNode<int,int>* left = node->getLeft();
+        const RBNode<int,int>* right = node->getRight();
+        if(node->isRed() && ((left != nullptr && left->isRed()) || (right != nullptr && right->isRed()))) return -1;
+        int leftHeight = blackHeight(left);
+        int rightHeight = blackHeight(right);
+        if(leftHeight < 0 || leftHeight != rightHeight) return -1;
+        return leftHeight + (node->isRed() ? 0 : 1);
+    }
+};
 
 int main(int argc, char *argv[])
 {
@@ -43,6 +252,437 @@ int main(int argc, char *argv[])
     }
     cout << "Erasing b" << endl;
     at.remove('b');
+    AVLTree<char,int>::iterator past = at.end();
+    check(++past == at.end(), "++end() stays at end()");
+
+    // Range scans
+    at.insert(std::make_pair('c',3));
+    at.insert(std::make_pair('d',4));
+    at.insert(std::make_pair('e',5));
+    string scanned;
+    for(const std::pair<const char,int>& item : at.range('b', 'e')) {
+        scanned += item.first;
+    }
+    check(scanned == "cd", "range scans [lo, hi)");
+    check(at.range('d', 'd').empty() && at.range('e', 'b').empty() && at.range('x', 'z').empty(),
+          "range is empty when lo >= hi or nothing lies between");
+    check(at.floor('b')->first == 'a' && at.floor('c')->first == 'c' && at.floor('z')->first == 'e' &&
+          at.floor('A') == at.end(), "floor finds the largest key not above, or end() below the smallest");
+    check(at.ceiling('b')->first == 'c' && at.ceiling('a')->first == 'a' && at.ceiling('f') == at.end() &&
+          at.upper_bound('c')->first == 'd', "ceiling and upper_bound");
+    std::pair<AVLTree<char,int>::iterator, AVLTree<char,int>::iterator> present = at.equal_range('c');
+    std::pair<AVLTree<char,int>::iterator, AVLTree<char,int>::iterator> missing = at.equal_range('b');
+    check(present.first->first == 'c' && present.second->first == 'd' &&
+          missing.first == missing.second && missing.first->first == 'c',
+          "equal_range spans a present key and is empty at a missing one");
+    string reversed;
+    for(AVLTree<char,int>::reverse_iterator it = at.rbegin(); it != at.rend(); ++it) {
+        reversed += it->first;
+    }
+    check(reversed == "edca", "reverse iteration visits the keys from the largest down");
+    AVLTree<char,int>::iterator last = at.end();
+    AVLTree<char,int>::iterator fromBound = at.upper_bound('e');
+    check((--last)->first == 'e' && fromBound == at.end() && (--fromBound)->first == 'e',
+          "--end() and stepping back from upper_bound of the largest key reach it");
+    AVLTree<char,int> none;
+    check(none.rbegin() == none.rend(), "rbegin() == rend() on an empty tree");
+
+    // Frozen snapshot of the AVL Tree
+    FrozenTree<char,int> frozen = at.freeze();
+    at.remove('c');
+    cout << "Frozen snapshot contents:";
+    for(FrozenTree<char,int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    cout << "Snapshot lower_bound(b) = " << frozen.lower_bound('b')->first << endl;
+
+    // Split, join and batch insert tests
+    AVLTree<int,int> whole;
+    for(int i = 0; i < 64; ++i) {
+        int key = (i * 37) % 64 * 2;
+        whole.insert(std::make_pair(key, key));
+    }
+    AVLTree<int,int> less;
+    AVLTree<int,int> greater;
+    whole.split(40, less, greater);
+    check(holds(less, keyRange(0, 40, 2)) && holds(greater, keyRange(40, 128, 2)) && whole.empty(),
+          "split at 40 moves the keys from 40 up to greater");
+    whole.join(less, greater);
+    check(holds(whole, keyRange(0, 128, 2)) && less.empty() && greater.empty(),
+          "join puts the two halves back together");
+    whole.split(41, less, greater);
+    check(holds(less, keyRange(0, 42, 2)) && holds(greater, keyRange(42, 128, 2)),
+          "split at a missing key 41");
+    less.split(0, whole, less);
+    check(whole.empty() && holds(less, keyRange(0, 42, 2)), "split into one of its own outputs at the smallest key");
+    whole.join(greater, whole);
+    check(holds(whole, keyRange(42, 128, 2)), "join into one of its own inputs");
+
+    AVLTree<int,int> low;
+    AVLTree<int,int> joined;
+    low.insert(std::make_pair(100, 0));
+    bool threw = false;
+    try {
+        joined.join(low, whole);
+    }
+    catch(const std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw && holds(low, vector<int>(1, 100)) && holds(whole, keyRange(42, 128, 2)) && joined.empty(),
+          "join of overlapping trees throws and changes nothing");
+
+    std::vector<std::pair<int,int> > batch;
+    for(int key = 127; key > 0; key -= 2) batch.push_back(std::make_pair(key, key));
+    for(int key = 0; key < 42; key += 2) batch.push_back(std::make_pair(key, key));
+    batch.push_back(std::make_pair(50, -1));
+    batch.push_back(std::make_pair(50, -2));
+    int* fifty = &whole.find(50)->second;
+    whole.insertBatch(batch.begin(), batch.end());
+    check(holds(whole, keyRange(0, 128, 1)), "insertBatch merges unsorted keys in order");
+    check(whole.find(50)->second == -2 && whole.find(51)->second == 51,
+          "insertBatch keeps the last value given for a key");
+    check(&whole.find(50)->second == fifty && *fifty == -2,
+          "insertBatch assigns an existing key's value in place");
+
+    // Hinted insert tests
+    AVLTree<int,int> hinted;
+    AVLTree<int,int>::iterator hint = hinted.end();
+    for(int key = 0; key < 100; ++key) {
+        hint = hinted.insert(hint, std::make_pair(key, key));
+    }
+    check(holds(hinted, keyRange(0, 100, 1)) && hint->first == 99, "hinted inserts of ascending keys at end()");
+    for(int key = -1; key >= -50; --key) {
+        hinted.insert(hinted.begin(), std::make_pair(key, key));
+    }
+    check(holds(hinted, keyRange(-50, 100, 1)), "hinted inserts of descending keys at begin()");
+    AVLTree<int,int>::iterator far = hinted.insert(hinted.begin(), std::make_pair(1000, 1000));
+    AVLTree<int,int>::iterator nearby = hinted.insert(hinted.find(0), std::make_pair(-1000, -1000));
+    vector<int> expected = keyRange(-50, 100, 1);
+    expected.insert(expected.begin(), -1000);
+    expected.push_back(1000);
+    check(holds(hinted, expected) && far->first == 1000 && nearby->first == -1000,
+          "hinted inserts far from the hint");
+    AVLTree<int,int>::iterator existing = hinted.insert(hinted.end(), std::make_pair(5, -5));
+    check(holds(hinted, expected) && existing->first == 5 && existing->second == -5,
+          "hinted insert of an existing key replaces its value");
+
+    AVLTree<int,int> appended;
+    for(int key = 0; key < 200; ++key) {
+        appended.insert(std::make_pair(key, key));
+    }
+    appended.insert(std::make_pair(50, -50));
+    appended.insert(std::make_pair(-1, -1));
+    check(holds(appended, keyRange(-1, 200, 1)) && appended.find(50)->second == -50,
+          "ascending inserts, then inserts that are not appends");
+
+    // Emplace tests
+    checkEmplace<BinarySearchTree<string,Counted> >("BinarySearchTree");
+    checkEmplace<AVLTree<string,Counted> >("AVLTree");
+    checkEmplace<SplayTree<string,Counted> >("SplayTree");
+
+    // Single-descent lookup tests
+    AVLTree<int,int> counts;
+    int& made = counts.findOrInsert(7);
+    check(made == 0 && counts.find(7) != counts.end(), "findOrInsert of a missing key inserts a default value");
+    made = 3;
+    ++counts.findOrInsert(7);
+    check(&counts.findOrInsert(7) == &made && counts.find(7)->second == 4,
+          "findOrInsert of a present key returns its value");
+    const AVLTree<int,int>& constCounts = counts;
+    check(counts.tryGet(8) == NULL && constCounts.tryGet(8) == NULL && counts.find(8) == counts.end(),
+          "tryGet of a missing key returns NULL and inserts nothing");
+    check(counts.tryGet(7) == &made && constCounts.tryGet(7) == &made, "tryGet of a present key points at its value");
+
+    // Comparator tests
+    AVLTree<string,int,ThreeWayCompare> words;
+    const char* names[] = { "cherry", "apple", "date", "banana" };
+    for(int i = 0; i < 4; ++i) words.insert(std::make_pair(string(names[i]), i));
+    string order;
+    for(AVLTree<string,int,ThreeWayCompare>::iterator it = words.begin(); it != words.end(); ++it) order += it->first + " ";
+    check(order == "apple banana cherry date " && words.isBalanced(), "ThreeWayCompare orders std::string keys");
+    const char* banana = "banana";
+    check(words.find(banana)->second == 3 && words.find("fig") == words.end(),
+          "find by const char* on a ThreeWayCompare tree");
+    check(words.lower_bound("b")->first == "banana" && words.lower_bound("cherry")->first == "cherry" &&
+          words.lower_bound("e") == words.end(), "lower_bound by const char* on a ThreeWayCompare tree");
+    const AVLTree<string,int,ThreeWayCompare>& constWords = words;
+    check(*words.tryGet("date") == 2 && *constWords.tryGet("apple") == 1 && words.tryGet("fig") == NULL &&
+          constWords.tryGet("fig") == NULL, "tryGet by const char* on a ThreeWayCompare tree");
+
+    AVLTree<int,int,std::greater<int> > descending;
+    for(int key = 0; key < 50; ++key) descending.insert(std::make_pair((key * 17) % 50, key));
+    bool downward = true;
+    int nextKey = 49;
+    for(AVLTree<int,int,std::greater<int> >::iterator it = descending.begin(); it != descending.end(); ++it, --nextKey) {
+        downward = downward && it->first == nextKey;
+    }
+    check(downward && nextKey == -1 && descending.isBalanced() && descending.lower_bound(10)->first == 10 &&
+          descending.upper_bound(10)->first == 9, "std::greater tree iterates from the largest key down");
+
+    // Background reclamation tests
+    TreeReclaimer reclaimer;
+    AVLTree<int,string> cleared;
+    for(int key = 0; key < 1000; ++key) cleared.insert(std::make_pair(key, to_string(key)));
+    cleared.setReclaimer(&reclaimer);
+    cleared.clear();
+    check(cleared.empty() && cleared.begin() == cleared.end(), "clear with a reclaimer empties the tree");
+    for(int key = 0; key < 100; ++key) cleared.insert(std::make_pair(key, to_string(key)));
+    check(holds(cleared, keyRange(0, 100, 1)) && cleared.find(42)->second == "42",
+          "a tree cleared in the background can be filled again");
+    reclaimer.drain();
+    check(reclaimer.backlog() == 0, "drain waits until the reclaimer has freed everything");
+    //split leaves both halves on one pool, which clear cannot hand over whole
+    AVLTree<int,string> lowHalf;
+    AVLTree<int,string> highHalf;
+    cleared.split(50, lowHalf, highHalf);
+    lowHalf.setReclaimer(&reclaimer);
+    lowHalf.clear();
+    check(lowHalf.empty() && reclaimer.backlog() == 0 && holds(highHalf, keyRange(50, 100, 1)),
+          "clear of a tree sharing its pool frees the nodes itself");
+    lowHalf.insert(std::make_pair(7, string("7")));
+    check(holds(lowHalf, vector<int>(1, 7)) && holds(highHalf, keyRange(50, 100, 1)),
+          "a tree cleared off a shared pool can be filled again");
+
+    // Height and balance bookkeeping tests
+    CheckedTree plain;
+    mt19937 plainRng(18);
+    bool plainHolds = true;
+    for(int i = 0; i < 1500; ++i) {
+        int key = (int)(plainRng() % 200);
+        if(plainRng() % 3 != 0) plain.insert(std::make_pair(key, key));
+        else plain.remove(key);
+        if(i % 10 == 0) plainHolds = plainHolds && plain.heightsHold();
+    }
+    check(plainHolds && plain.heightsHold(), "BinarySearchTree heights and balance match a walk through inserts and removes");
+    bool twoChildHolds = true;
+    int removedTwoChild = 0;
+    for(int key = plain.keyWithTwoChildren(); key != -1 && removedTwoChild < 30; key = plain.keyWithTwoChildren()) {
+        plain.remove(key);
+        ++removedTwoChild;
+        twoChildHolds = twoChildHolds && plain.find(key) == plain.end() && plain.heightsHold();
+    }
+    check(twoChildHolds && removedTwoChild == 30, "BinarySearchTree heights and balance match a walk through two-child removes");
+
+#ifdef BST_ORDER_STATISTICS
+    // Order statistics tests; whole holds 0 to 127
+    bool selects = whole.size() == 128 && whole.select(128) == whole.end();
+    for(size_t i = 0; i < 128; ++i) {
+        if(whole.select(i)->first != (int)i) selects = false;
+    }
+    check(selects, "select finds the key at every position");
+    check(whole.rank(-5) == 0 && whole.rank(0) == 0 && whole.rank(64) == 64 && whole.rank(1000) == 128,
+          "rank counts the keys less than a key");
+    whole.remove(10);
+    whole.remove(11);
+    check(whole.size() == 126 && whole.rank(12) == 10 && whole.select(10)->first == 12,
+          "remove keeps subtree sizes up to date");
+    check(whole.rangeCount(5, 20) == 13 && whole.rangeCount(20, 5) == 0, "rangeCount counts [lo, hi)");
+    whole.split(64, less, greater);
+    check(less.size() == 62 && greater.size() == 64 && less.select(61)->first == 63 && greater.rank(70) == 6,
+          "split keeps subtree sizes up to date");
+    whole.join(less, greater);
+    check(whole.size() == 126 && whole.select(62)->first == 64, "join keeps subtree sizes up to date");
+#endif
+
+    // Index-linked AVL Tree Tests
+    IndexedAVLTree<int,int> it32;
+    vector<int> indexedKeys = churn(it32, 4, 3000, 500);
+    check(inOrder(it32, indexedKeys) && it32.size() == indexedKeys.size(),
+          "IndexedAVLTree holds the keys left by random inserts and removes");
+    IndexedAVLTree<int,int> snapshot(it32);
+    int firstIndexed = indexedKeys.front();
+    it32.remove(firstIndexed);
+    it32.insert(std::make_pair(-1, -1));
+    check(snapshot.find(firstIndexed) != snapshot.end() && snapshot.find(-1) == snapshot.end() &&
+          inOrder(snapshot, indexedKeys), "IndexedAVLTree copy is independent of the original");
+    //a remove frees a slot that the next insert takes, so the array stays put
+    size_t usage = it32.memoryUsage();
+    for(int i = 0; i < 1000; ++i) {
+        it32.remove(indexedKeys[1 + i % 100]);
+        it32.insert(std::make_pair(indexedKeys[1 + i % 100], i));
+    }
+    check(it32.memoryUsage() == usage, "IndexedAVLTree insert reuses the slots removes free");
+    IndexedAVLTree<int,string> named;
+    named.insert(std::make_pair(0, string("zero")));
+    IndexedAVLTree<int,string>::iterator first = named.begin();
+    //the first insert allocates 16 slots
+    size_t slotSize = named.memoryUsage() / 16;
+    for(int i = 1; i < 40; ++i) named.insert(std::make_pair(i, to_string(i)));
+    //the iterator holds an index, so it survives the array being reallocated
+    check(named.memoryUsage() >= 40 * slotSize && first->second == "zero" &&
+          named.find(39)->second == "39" && named.size() == 40,
+          "IndexedAVLTree grows past 16 slots and iterators survive it");
+
+    // Splay Tree Tests
+    SplayTree<int,int> st;
+    vector<int> splayKeys = churn(st, 19, 2000, 300);
+    check(inOrder(st, splayKeys), "SplayTree holds the keys left by random inserts and removes");
+    //every find restructures the tree, so later finds search a reshaped tree
+    bool allFound = true;
+    for(size_t i = 0; i < splayKeys.size(); i += 7) {
+        SplayTree<int,int>::iterator found = st.find(splayKeys[i]);
+        allFound = allFound && found != st.end() && found->first == splayKeys[i] && found->second == splayKeys[i];
+    }
+    check(allFound && inOrder(st, splayKeys), "SplayTree find after splaying keeps keys and order");
+    check(st.find(-1) == st.end() && st.find(300) == st.end() && inOrder(st, splayKeys),
+          "SplayTree find of a missing key");
+    st.remove(-1);
+    st.remove(300);
+    check(inOrder(st, splayKeys), "SplayTree remove of a missing key changes nothing");
+    int splayed = splayKeys[splayKeys.size() / 3];
+    st.remove(splayed);
+    splayKeys.erase(splayKeys.begin() + splayKeys.size() / 3);
+    check(inOrder(st, splayKeys) && st.find(splayed) == st.end(), "SplayTree remove of a present key");
+
+    // Red-Black Tree Tests
+    //a red-black tree need not be balanced in the AVL sense, so rather than
+    //isBalanced() these check the coloring and the height it guarantees
+    CheckedRedBlackTree rt;
+    vector<int> redBlackKeys = churn(rt, 20, 5000, 1000);
+    check(inOrder(rt, redBlackKeys), "RedBlackTree holds the keys left by random inserts and removes");
+    check(rt.colorsHold(), "RedBlackTree has no red-red pair and equal black heights");
+    check(rt.height() <= 2 * log2(redBlackKeys.size() + 1.0), "RedBlackTree height is at most 2 log2(n + 1)");
+    for(size_t i = 0; i < redBlackKeys.size(); i += 2) rt.remove(redBlackKeys[i]);
+    vector<int> oddKeys;
+    for(size_t i = 1; i < redBlackKeys.size(); i += 2) oddKeys.push_back(redBlackKeys[i]);
+    check(inOrder(rt, oddKeys) && rt.colorsHold() && rt.height() <= 2 * log2(oddKeys.size() + 1.0),
+          "RedBlackTree keeps its coloring through removing every other key");
+
+    // Scapegoat Tree Tests
+    ScapegoatTree<int,int> gt;
+    vector<int> scapegoatKeys = churn(gt, 21, 5000, 1000);
+    check(inOrder(gt, scapegoatKeys), "ScapegoatTree holds the keys left by random inserts and removes");
+    ScapegoatTree<int,int> sortedGoat;
+    for(int i = 0; i < 1000; ++i) sortedGoat.insert(std::make_pair(i, i));
+    //an insert deeper than log base 1/alpha of the size rebuilds a scapegoat
+    int depthBound = 1 + (int)floor(log(1000.0) / log(1 / SCAPEGOAT_ALPHA));
+    check(inOrder(sortedGoat, keyRange(0, 1000, 1)) && sortedGoat.height() <= depthBound,
+          "ScapegoatTree height after sorted inserts is within log base 1/alpha of n");
+    //599 keys left is under alpha of 1000, which rebuilds the whole tree
+    for(int i = 0; i <= 400; ++i) sortedGoat.remove(i);
+    check(inOrder(sortedGoat, keyRange(401, 1000, 1)) && sortedGoat.height() == 10,
+          "ScapegoatTree rebuilds perfectly balanced after removes");
+
+    // B+ Tree Tests
+    //enough keys to split leaves and inner nodes, then enough removes to merge them
+    BPlusTree<int,int> pt;
+    map<int,int> bplusModel;
+    mt19937 bplusRng(23);
+    for(int i = 0; i < 20000; ++i) {
+        int key = (int)(bplusRng() % 100000);
+        pt.insert(std::make_pair(key, key));
+        bplusModel[key] = key;
+    }
+    int grownHeight = pt.height();
+    for(int phase = 0; phase < 2; ++phase) {
+        string when = phase == 0 ? " after splits" : " after merges";
+        bool forward = pt.size() == bplusModel.size();
+        map<int,int>::iterator expected = bplusModel.begin();
+        for(BPlusTree<int,int>::iterator it = pt.begin(); forward && it != pt.end(); ++it, ++expected) {
+            forward = expected != bplusModel.end() && it->first == expected->first && it->second == expected->second;
+        }
+        check(forward && expected == bplusModel.end(), "BPlusTree forward iteration" + when);
+        bool backward = true;
+        map<int,int>::reverse_iterator back = bplusModel.rbegin();
+        BPlusTree<int,int>::iterator it = pt.end();
+        for(; backward && back != bplusModel.rend(); ++back) {
+            --it;
+            backward = it->first == back->first;
+        }
+        check(backward && it == pt.begin(), "BPlusTree backward iteration" + when);
+        bool bounds = true;
+        for(int probe = -1; probe <= 100000; probe += 37) {
+            map<int,int>::iterator lower = bplusModel.lower_bound(probe);
+            map<int,int>::iterator upper = bplusModel.upper_bound(probe);
+            bounds = bounds &&
+                     (lower == bplusModel.end() ? pt.lower_bound(probe) == pt.end() : pt.lower_bound(probe)->first == lower->first) &&
+                     (upper == bplusModel.end() ? pt.upper_bound(probe) == pt.end() : pt.upper_bound(probe)->first == upper->first);
+        }
+        check(bounds, "BPlusTree lower_bound and upper_bound match std::map" + when);
+        if(phase == 0) {
+            //leave about one key in fifty, spread over the whole range
+            for(map<int,int>::iterator kept = bplusModel.begin(); kept != bplusModel.end(); ) {
+                if(kept->first % 50 != 0) {
+                    pt.remove(kept->first);
+                    bplusModel.erase(kept++);
+                }
+                else ++kept;
+            }
+        }
+    }
+    check(grownHeight >= 3 && pt.height() < grownHeight, "BPlusTree grows taller through splits and shorter through merges");
+
+    // Concurrent AVL Tree Tests
+    ConcurrentAVLTree<int,int> ct;
+    for(int i = 0; i < 100; ++i) ct.insert(std::make_pair(i, i * 10));
+    {
+        ConcurrentAVLTree<int,int>::Reader reader(ct);
+        ConcurrentAVLTree<int,int>::Snapshot before(reader);
+        ct.remove(50);
+        int value = -1;
+        check(!reader.find(50, value) && reader.find(51, value) && value == 510,
+              "ConcurrentAVLTree reader sees a remove and finds the other keys");
+        const int* kept = before.tryGet(50);
+        check(kept != NULL && *kept == 500 && before.tryGet(100) == NULL,
+              "ConcurrentAVLTree snapshot taken before a remove still has the key");
+        vector<int> seen;
+        bool valuesHold = true;
+        before.forEach([&](const std::pair<const int,int>& item) {
+            seen.push_back(item.first);
+            valuesHold = valuesHold && item.second == item.first * 10;
+        });
+        check(seen == keyRange(0, 100, 1) && valuesHold, "ConcurrentAVLTree snapshot holds the keys it was taken with");
+        //every update retires at least the node it replaced, and nothing
+        //retired since the snapshot was taken can be freed under it
+        bool allKept = true;
+        for(int i = 0; i < 2000; ++i) {
+            ct.insert(std::make_pair(100 + i % 500, i));
+            allKept = allKept && ct.backlog() >= (size_t)i + 2;
+        }
+        check(allKept && before.tryGet(50) == kept, "ConcurrentAVLTree keeps what it retires while a snapshot is pinned");
+    }
+    ct.clear();
+    check(ct.empty(), "ConcurrentAVLTree clear empties the tree");
+    //once no reader is pinned, enough updates let collect free the backlog
+    size_t peak = ct.backlog();
+    bool dropped = false;
+    for(int i = 0; i < 3000; ++i) {
+        ct.insert(std::make_pair(i % 200, i));
+        dropped = dropped || ct.backlog() < peak;
+        peak = ct.backlog() > peak ? ct.backlog() : peak;
+    }
+    check(dropped && ct.size() == 200, "ConcurrentAVLTree backlog drops after clear and later updates");
+
+    // Optimistic AVL Tree Tests
+    OptimisticAVLTree<int,int> ot;
+    {
+        OptimisticAVLTree<int,int>::Handle handle(ot);
+        bool insertsNew = true;
+        for(int i = 0; i < 300; ++i) insertsNew = handle.insert(std::make_pair(i, i)) && insertsNew;
+        check(insertsNew, "OptimisticAVLTree insert of a new key returns true");
+        bool updates = true;
+        for(int i = 0; i < 300; i += 3) updates = !handle.insert(std::make_pair(i, -i)) && updates;
+        check(updates, "OptimisticAVLTree insert of a present key returns false");
+        bool removes = true;
+        for(int i = 1; i < 300; i += 3) removes = handle.remove(i) && removes;
+        check(removes && !handle.remove(1) && !handle.remove(300), "OptimisticAVLTree remove returns whether the key was there");
+        int value = 0;
+        check(handle.find(3, value) && value == -3 && handle.find(5, value) && value == 5 && !handle.find(4, value),
+              "OptimisticAVLTree find sees updates and removes");
+    }
+    vector<int> optimisticKeys;
+    bool optimisticValues = true;
+    ot.forEach([&](const int& key, const int& value) {
+        optimisticKeys.push_back(key);
+        optimisticValues = optimisticValues && value == (key % 3 == 0 ? -key : key);
+    });
+    vector<int> expectedOptimistic;
+    for(int i = 0; i < 300; ++i) {
+        if(i % 3 != 1) expectedOptimistic.push_back(i);
+    }
+    check(optimisticKeys == expectedOptimistic && optimisticValues && ot.size() == expectedOptimistic.size() && ot.isBalanced(),
+          "OptimisticAVLTree forEach visits the remaining items in order");
 
-    return 0;
+    return anyFailed ? 1 : 0;
 }
@@ -5,20 +5,38 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <type_traits>
+#include <cstdint>
+#include <memory>
+#include <iterator>
+#include <cstddef>
+#include <tuple>
+#include <functional>
+#include <vector>
+#include <atomic>
+#include "node_pool.h"
+#include "key_compare.h"
+#include "tree_reclaimer.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Future kinds of search trees, such as Red Black trees,
+ * Splay trees, and AVL trees, derive their own node type
+ * and redeclare the getters for parent/left/right to return
+ * it. The getters are deliberately not virtual: each tree
+ * knows its node type at compile time, so traversal is plain
+ * loads and nodes carry no vtable pointer.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
+    // Builds an item in the storage its result is returned in
+    typedef std::pair<const Key, Value> (*ItemMaker)(void* context);
+
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(ItemMaker make, void* context, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +44,48 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+#ifdef BST_ORDER_STATISTICS
+    size_t getSize() const;
+    void setSize(size_t size);
+#endif
+    void updateSize();
+#ifdef BST_THREADED
+    Node<Key, Value>* getPrev() const;
+    Node<Key, Value>* getNext() const;
+    void setPrev(Node<Key, Value>* prev);
+    void setNext(Node<Key, Value>* next);
+#endif
 
 protected:
     std::pair<const Key, Value> item_;
+#ifdef AVL_PACKED_BALANCE
+    // The low PACKED_TAG_MASK bits of the parent pointer are free for a
+    // subclass to use (AVLNode keeps its balance there), so they are
+    // masked off on read and preserved on write.
+    static const uintptr_t PACKED_TAG_MASK = 7;
+    uintptr_t parent_;
+#else
     Node<Key, Value>* parent_;
+#endif
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+#ifdef BST_ORDER_STATISTICS
+    // Number of nodes in the subtree rooted here, this one included
+    size_t size_;
+#endif
+#ifdef BST_THREADED
+    // The neighbouring nodes in key order, NULL past either end
+    Node<Key, Value>* prev_;
+    Node<Key, Value>* next_;
+#endif
 };
 
 /*
@@ -54,9 +100,45 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
+#ifdef AVL_PACKED_BALANCE
+    parent_(reinterpret_cast<uintptr_t>(parent)),
+#else
+    parent_(parent),
+#endif
+    left_(NULL),
+    right_(NULL)
+#ifdef BST_ORDER_STATISTICS
+    , size_(1)
+#endif
+#ifdef BST_THREADED
+    , prev_(NULL)
+    , next_(NULL)
+#endif
+{
+
+}
+
+/**
+* Constructor that builds the item in place with make(context), so a key
+* and value made from arbitrary arguments are never copied or moved.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>::Node(ItemMaker make, void* context, Node<Key, Value>* parent) :
+    item_(make(context)),
+#ifdef AVL_PACKED_BALANCE
+    parent_(reinterpret_cast<uintptr_t>(parent)),
+#else
     parent_(parent),
+#endif
     left_(NULL),
     right_(NULL)
+#ifdef BST_ORDER_STATISTICS
+    , size_(1)
+#endif
+#ifdef BST_THREADED
+    , prev_(NULL)
+    , next_(NULL)
+#endif
 {
 
 }
@@ -118,16 +200,20 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
 {
+#ifdef AVL_PACKED_BALANCE
+    return reinterpret_cast<Node<Key, Value>*>(parent_ & ~PACKED_TAG_MASK);
+#else
     return parent_;
+#endif
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +222,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -150,7 +236,11 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
+#ifdef AVL_PACKED_BALANCE
+    parent_ = reinterpret_cast<uintptr_t>(parent) | (parent_ & PACKED_TAG_MASK);
+#else
     parent_ = parent;
+#endif
 }
 
 /**
@@ -180,6 +270,77 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+#ifdef BST_ORDER_STATISTICS
+/**
+* A getter for the number of nodes in this node's subtree.
+*/
+template<typename Key, typename Value>
+size_t Node<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the number of nodes in this node's subtree.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setSize(size_t size)
+{
+    size_ = size;
+}
+#endif
+
+/**
+* Recomputes the subtree size from the children, which must be up to
+* date. Does nothing unless BST_ORDER_STATISTICS is defined, so trees
+* can call it after every relink at no cost otherwise.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::updateSize()
+{
+#ifdef BST_ORDER_STATISTICS
+    size_ = 1 + (left_ != NULL ? left_->size_ : 0) + (right_ != NULL ? right_->size_ : 0);
+#endif
+}
+
+#ifdef BST_THREADED
+/**
+* A getter for the node before this one in key order.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getPrev() const
+{
+    return prev_;
+}
+
+/**
+* A getter for the node after this one in key order.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getNext() const
+{
+    return next_;
+}
+
+/**
+* A setter for the node before this one in key order.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setPrev(Node<Key, Value>* prev)
+{
+    prev_ = prev;
+}
+
+/**
+* A setter for the node after this one in key order.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setNext(Node<Key, Value>* next)
+{
+    next_ = next;
+}
+#endif
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -187,23 +348,189 @@ void Node<Key, Value>::setValue(const Value& value)
 */
 
 /**
-* A templated unbalanced binary search tree.
+* The node of a plain BinarySearchTree, which keeps the height of its
+* subtree and whether every node in it is balanced (children's heights
+* at most one apart). Both depend only on the children's, so after a
+* change they are refreshed from the changed spot upward, and the walk
+* stops at the first node whose values come out the same.
 */
 template <typename Key, typename Value>
+class BSTNode : public Node<Key, Value>
+{
+public:
+    BSTNode(const Key& key, const Value& value, BSTNode<Key, Value>* parent);
+    BSTNode(typename Node<Key, Value>::ItemMaker make, void* context, BSTNode<Key, Value>* parent);
+
+    int getHeight() const;
+    bool isBalanced() const;
+    bool refresh();
+    void swapShape(BSTNode<Key, Value>* other);
+
+    // Redefined to return BSTNodes, hiding the Node versions; see Node
+    BSTNode<Key, Value>* getParent() const;
+    BSTNode<Key, Value>* getLeft() const;
+    BSTNode<Key, Value>* getRight() const;
+
+    static int heightOf(const BSTNode<Key, Value>* node);
+    static bool balancedBelow(const BSTNode<Key, Value>* node);
+
+protected:
+    // Height of the subtree rooted here; 1 for a leaf
+    int height_;
+    // Whether every node of the subtree rooted here is balanced
+    bool balanced_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the BSTNode class.
+  -------------------------------------------
+*/
+
+template<typename Key, typename Value>
+BSTNode<Key, Value>::BSTNode(const Key& key, const Value& value, BSTNode<Key, Value>* parent) :
+    Node<Key, Value>(key, value, parent), height_(1), balanced_(true)
+{
+
+}
+
+template<typename Key, typename Value>
+BSTNode<Key, Value>::BSTNode(typename Node<Key, Value>::ItemMaker make, void* context, BSTNode<Key, Value>* parent) :
+    Node<Key, Value>(make, context, parent), height_(1), balanced_(true)
+{
+
+}
+
+template<typename Key, typename Value>
+int BSTNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+template<typename Key, typename Value>
+bool BSTNode<Key, Value>::isBalanced() const
+{
+    return balanced_;
+}
+
+/**
+* Recomputes the height and balance from the children's. Returns true
+* if either changed, i.e. if the parent needs refreshing too.
+*/
+template<typename Key, typename Value>
+bool BSTNode<Key, Value>::refresh()
+{
+    int leftHeight = heightOf(getLeft());
+    int rightHeight = heightOf(getRight());
+    int height = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+    bool balanced = leftHeight - rightHeight <= 1 && rightHeight - leftHeight <= 1 &&
+                    balancedBelow(getLeft()) && balancedBelow(getRight());
+    if (height == height_ && balanced == balanced_){
+        return false;
+    }
+    height_ = height;
+    balanced_ = balanced;
+    return true;
+}
+
+/**
+* Trades height and balance with other, for two nodes that have just
+* traded places: the values describe the position, not the node.
+*/
+template<typename Key, typename Value>
+void BSTNode<Key, Value>::swapShape(BSTNode<Key, Value>* other)
+{
+    std::swap(height_, other->height_);
+    std::swap(balanced_, other->balanced_);
+}
+
+template<typename Key, typename Value>
+BSTNode<Key, Value>* BSTNode<Key, Value>::getParent() const
+{
+    return static_cast<BSTNode<Key, Value>*>(Node<Key, Value>::getParent());
+}
+
+template<typename Key, typename Value>
+BSTNode<Key, Value>* BSTNode<Key, Value>::getLeft() const
+{
+    return static_cast<BSTNode<Key, Value>*>(this->left_);
+}
+
+template<typename Key, typename Value>
+BSTNode<Key, Value>* BSTNode<Key, Value>::getRight() const
+{
+    return static_cast<BSTNode<Key, Value>*>(this->right_);
+}
+
+/**
+* The height of the subtree at node, 0 for an empty one.
+*/
+template<typename Key, typename Value>
+int BSTNode<Key, Value>::heightOf(const BSTNode<Key, Value>* node)
+{
+    return node != nullptr ? node->height_ : 0;
+}
+
+/**
+* Whether the subtree at node is balanced throughout; an empty one is.
+*/
+template<typename Key, typename Value>
+bool BSTNode<Key, Value>::balancedBelow(const BSTNode<Key, Value>* node)
+{
+    return node == nullptr || node->balanced_;
+}
+
+/*
+  -----------------------------------------
+  End implementations for the BSTNode class.
+  -----------------------------------------
+*/
+
+/**
+* A templated unbalanced binary search tree.
+*
+* Compiling with -DBST_THREADED threads every node onto a doubly linked
+* list in key order, kept up to date by insert, remove and the bulk
+* operations, so that stepping an iterator is a single pointer load
+* instead of a walk up or down the tree. Rotations leave the key order,
+* and so the list, untouched. It costs two pointers per node.
+*
+* Keys are ordered by Compare, a strict weak ordering like std::map's.
+* If it also has a three-way compare(a, b) member (see key_compare.h)
+* each node on a search path costs one call to it rather than up to two
+* calls to operator(). If it declares is_transparent, find, lower_bound,
+* upper_bound and tryGet also take any key type it can compare, so that
+* a lookup need not build a temporary Key.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual void insert(std::pair<const Key, Value>&& keyValuePair);
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+    int height() const;
     void print() const;
     bool empty() const;
+    void setHugePages(bool enable);
+    void setReclaimer(TreeReclaimer* reclaimer);
+    size_t memoryUsage() const;
+    size_t rotations() const;
+#ifdef BST_ORDER_STATISTICS
+    size_t size() const;
+    size_t rank(const Key& key) const;
+    size_t rangeCount(const Key& lo, const Key& hi) const;
+#endif
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    Compare key_comp() const;
+
+    template<typename PPKey, typename PPValue, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare> & tree);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
@@ -211,6 +538,12 @@ public:
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,25 +553,119 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator& operator--();
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
+        friend class BinarySearchTree<Key, Value, Compare>;
         iterator(Node<Key,Value>* ptr);
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare>* tree);
         Node<Key, Value> *current_;
+        // The tree iterated over, so that end() can step back to the last key
+        const BinarySearchTree<Key, Value, Compare>* tree_;
+    };
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    /**
+    * The keys in a half-open interval, for use in a range-based for loop.
+    */
+    class KeyRange
+    {
+    public:
+        KeyRange(const iterator& first, const iterator& last);
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    KeyRange range(const Key& lo, const Key& hi) const;
+#ifdef BST_ORDER_STATISTICS
+    iterator select(size_t index) const;
+#endif
+    iterator insert(const iterator& hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(const iterator& hint, std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
+    Value& findOrInsert(const Key& key);
+    Value* tryGet(const Key& key);
+    const Value* tryGet(const Key& key) const;
+    int height(const iterator& top) const;
+    bool isBalanced(const iterator& top) const;
+
+    // Lookups by any key type a transparent Compare accepts
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value* tryGet(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const Value* tryGet(const K& key) const;
 
 protected:
+    // Destroys a node through its most derived type
+    typedef void (*NodeDestroyer)(Node<Key, Value>* node);
+    typedef typename Node<Key, Value>::ItemMaker ItemMaker;
+
+    // What insertFrom links in for a missing key and does to an existing
+    // one: build a new node's item with make(context), or link in an
+    // already built node; overwrite an existing value with
+    // assign(context, value), or leave it if assign is NULL
+    struct ItemSource
+    {
+        ItemMaker make;
+        void* context;
+        void (*assign)(void* context, Value& value);
+        Node<Key, Value>* node;
+
+        ItemSource(ItemMaker make, void* context, void (*assign)(void* context, Value& value)) :
+            make(make), context(context), assign(assign), node(nullptr) { }
+    };
+
+    // Nodes clearInBackground has cut loose, with what it takes to free them
+    struct DetachedNodes
+    {
+        Node<Key, Value>* top;
+        NodeDestroyer destroyer;
+        std::shared_ptr<NodePool> pool;
+    };
+
+    BinarySearchTree(size_t nodeSize, size_t nodeAlign, NodeDestroyer destroyer,
+                     const Compare& comp = Compare());
+
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    template<typename K>
+    Node<Key, Value>* findNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* lowerBoundNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* upperBoundNode(const K& key) const;
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    static Node<Key, Value>* successor(Node<Key, Value>* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
@@ -247,12 +674,67 @@ protected:
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
 
     // Add helper functions here
-    int findHeight(Node<Key, Value>* node) const; 
+    virtual int heightAt(Node<Key, Value>* top) const;
+    virtual bool balancedAt(Node<Key, Value>* top) const;
+    static void updateHeightsUpward(Node<Key, Value>* node);
+    static int measureSubtree(Node<Key, Value>* top, bool& balanced);
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key,
+                                         const ItemSource& source, bool& inserted);
+    virtual Node<Key, Value>* newNode(ItemMaker make, void* context);
+    template<typename NodeType>
+    NodeType* placeNode(const ItemSource& source, NodeType* parent);
+    static std::pair<const Key, Value> copyItem(void* item);
+    static void copyValue(void* item, Value& value);
+    static std::pair<const Key, Value> moveItem(void* item);
+    static void moveValue(void* item, Value& value);
+    template<typename F>
+    static std::pair<const Key, Value> callMaker(void* maker);
+    Node<Key, Value>* appendStart(const Key& key) const;
+    template<typename A, typename B>
+    KeyOrder orderKeys(const A& a, const B& b) const;
+    Node<Key, Value>* hintStart(Node<Key, Value>* hint, const Key& key) const;
+    iterator iteratorAt(Node<Key, Value>* node) const;
+
+    // Node allocation out of pool_
+    template<typename NodeType>
+    NodeType* createNode(const Key& key, const Value& value, NodeType* parent);
+    template<typename NodeType>
+    NodeType* createNode(ItemMaker make, void* context, NodeType* parent);
+    void destroyNode(Node<Key, Value>* node);
+    void destroySubtree(Node<Key, Value>* top);
+    bool clearInBackground();
+    static void reclaimDetached(void* garbage);
+    template<typename NodeType>
+    static void destroyAs(Node<Key, Value>* node);
+    NodePool& nodePool() const;
+    void sharePool(BinarySearchTree<Key, Value, Compare>& other);
+    static void updateSizesUpward(Node<Key, Value>* node);
+    void noteInserted(Node<Key, Value>* node);
+    void noteRemoving(Node<Key, Value>* node);
+    void adoptRoot(Node<Key, Value>* root);
+    static void threadBetween(Node<Key, Value>* prev, Node<Key, Value>* next);
+    void relinkThreads();
+#ifdef BST_ORDER_STATISTICS
+    static size_t subtreeSize(const Node<Key, Value>* node);
+#endif
 
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // Cached first and last nodes in key order, for O(1) begin() and --end()
+    Node<Key, Value>* leftmost_;
+    Node<Key, Value>* rightmost_;
+    // Slab allocator that owns the memory of every node in the tree.
+    // Shared with the trees this one has exchanged nodes with; always
+    // reach it through nodePool(), which follows merged pools.
+    mutable std::shared_ptr<NodePool> pool_;
+    NodeDestroyer destroyer_;
+    Compare comp_;
+    // Where clear() sends the nodes it detaches, or NULL to free them itself
+    TreeReclaimer* reclaimer_;
+    // Rotations made since construction, by the trees that rotate. Atomic
+    // because AVLTree's parallel set operations rotate on several threads
+    std::atomic<size_t> rotations_;
 };
 
 /*
@@ -264,29 +746,42 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value> *ptr)
 {
     // TODO
     current_ = ptr; 
+    tree_ = nullptr;
+}
+
+/**
+* Constructor for iterators handed out by a tree, which can also be
+* decremented from end().
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value, Compare>* tree)
+{
+    current_ = ptr; 
+    tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator() 
 {
     // TODO
     current_ = nullptr; 
+    tree_ = nullptr;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -294,9 +789,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -305,10 +800,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare>::iterator& rhs) const
 {
     return current_ == rhs.current_; 
 
@@ -318,10 +813,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare>::iterator& rhs) const
 {
     return current_ != rhs.current_; 
 }
@@ -330,38 +825,38 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator++()
 {
-    //check if at the last node
-    if (current_ == nullptr){
-        return *this; 
-    }
-
-    //Case 1: there is no right child 
-    if (current_ -> getRight() == nullptr){
-        //start at the bottom and go up until it is coming from the left child
-        Node<Key, Value>* aboveNode = current_->getParent();
-        while(aboveNode != nullptr && aboveNode->getRight() == current_){
-            //go up
-            current_ = aboveNode; 
-            aboveNode = aboveNode->getParent(); 
-        }
+#ifdef BST_THREADED
+    //end() stays end(), as successor() makes it do without threads
+    if (current_ == nullptr) return *this;
+    current_ = current_->getNext();
+#else
+    current_ = successor(current_);
+#endif
+    return *this; 
+}
 
-        //when it leaves while loop, it is coming from right child 
-        current_ = aboveNode; 
+/**
+* Moves the iterator back using an in-order sequencing; end() moves
+* to the last item in O(1).
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator--()
+{
+    if (current_ == nullptr){
+        current_ = tree_ != nullptr ? tree_->rightmost_ : nullptr;
     }
-    //Case 2: there is a right child 
     else{
-        current_ = current_->getRight(); 
-
-        //after going right once, keep going left 
-        while(current_->getLeft() != nullptr){
-            current_= current_->getLeft(); 
-        }
+#ifdef BST_THREADED
+        current_ = current_->getPrev();
+#else
+        current_ = predecessor(current_);
+#endif
     }
-
     return *this; 
 }
 
@@ -372,6 +867,46 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+-------------------------------------------------------------
+Begin implementations for the BinarySearchTree::KeyRange class.
+-------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::KeyRange::KeyRange(const iterator& first, const iterator& last) :
+    first_(first),
+    last_(last)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::KeyRange::begin() const
+{
+    return first_;
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::KeyRange::end() const
+{
+    return last_;
+}
+
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::KeyRange::empty() const
+{
+    return first_ == last_;
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::KeyRange class.
+-------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -381,14 +916,54 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree() :
+    pool_(std::make_shared<NodePool>(sizeof(BSTNode<Key, Value>), alignof(BSTNode<Key, Value>))),
+    destroyer_(&destroyAs<BSTNode<Key, Value> >)
 {
     root_ = nullptr; 
+    leftmost_ = nullptr;
+    rightmost_ = nullptr;
+    reclaimer_ = nullptr;
+    rotations_ = 0;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(const Compare& comp) :
+    pool_(std::make_shared<NodePool>(sizeof(BSTNode<Key, Value>), alignof(BSTNode<Key, Value>))),
+    destroyer_(&destroyAs<BSTNode<Key, Value> >),
+    comp_(comp)
+{
+    root_ = nullptr; 
+    leftmost_ = nullptr;
+    rightmost_ = nullptr;
+    reclaimer_ = nullptr;
+    rotations_ = 0;
+}
+
+/**
+* Constructor for derived trees, which sizes the node pool for
+* their own node type and says how to destroy it.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(size_t nodeSize, size_t nodeAlign, NodeDestroyer destroyer,
+                                                        const Compare& comp) :
+    pool_(std::make_shared<NodePool>(nodeSize, nodeAlign)),
+    destroyer_(destroyer),
+    comp_(comp)
+{
+    root_ = nullptr; 
+    leftmost_ = nullptr;
+    rightmost_ = nullptr;
+    reclaimer_ = nullptr;
+    rotations_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+BinarySearchTree<Key, Value, Compare>::~BinarySearchTree()
 {
     clear(); 
 }
@@ -396,140 +971,569 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+ * Backs node storage allocated from now on with transparent huge pages
+ * (Linux only), which cuts TLB misses on very large trees.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::setHugePages(bool enable)
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    nodePool().setHugePages(enable);
 }
 
 /**
-* Returns an iterator whose value means INVALID
+ * Makes clear() and the destructor hand the tree's nodes to reclaimer
+ * to be freed on its thread, instead of freeing them on the caller's;
+ * NULL (the default) goes back to freeing them in place. The reclaimer
+ * must outlive the tree.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::setReclaimer(TreeReclaimer* reclaimer)
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    reclaimer_ = reclaimer;
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+ * Returns the number of rotations the tree has made since it was
+ * constructed, for comparing how much rebalancing work trees do.
+ * Always 0 for a plain BinarySearchTree, which never rotates.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<typename Key, typename Value, typename Compare>
+size_t BinarySearchTree<Key, Value, Compare>::rotations() const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    return rotations_.load(std::memory_order_relaxed);
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+ * Returns the bytes of node storage the tree currently holds,
+ * including freed slots that are kept for reuse. Trees that share
+ * a pool after a split or join all report the shared total.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t BinarySearchTree<Key, Value, Compare>::memoryUsage() const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    return nodePool().reservedBytes();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/**
+* Returns an iterator to the "smallest" item in the tree, in O(1)
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::begin() const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    BinarySearchTree<Key, Value, Compare>::iterator begin(leftmost_, this);
+    return begin;
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::end() const
 {
-    Key key = keyValuePair.first;
-    Value val = keyValuePair.second; 
-
+    BinarySearchTree<Key, Value, Compare>::iterator end(NULL, this);
+    return end;
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree, in O(1)
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator past the "smallest" item
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k) const
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare>::iterator it(curr, this);
+    return it;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare>
+Value const & BinarySearchTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* Returns the value associated with the key, inserting the key with a
+* default-constructed value first if it is missing, like std::map's
+* operator[]. Takes one search and, for an AVLTree, one rebalance.
+*/
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::findOrInsert(const Key& key)
+{
+    return try_emplace(key).first->second;
+}
+
+/**
+* Returns a pointer to the value associated with the key, or NULL if the
+* key is not in the tree.
+*/
+template<class Key, class Value, class Compare>
+Value* BinarySearchTree<Key, Value, Compare>::tryGet(const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    return curr != NULL ? &curr->getValue() : NULL;
+}
+
+template<class Key, class Value, class Compare>
+const Value* BinarySearchTree<Key, Value, Compare>::tryGet(const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    return curr != NULL ? &curr->getValue() : NULL;
+}
+
+/**
+* Returns an iterator to the item whose key is equivalent to key, or
+* end(). Only offered when Compare is transparent, and compares key
+* with the stored keys as it is, e.g. a const char* against std::string
+* keys without copying it into a std::string first.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const K& key) const
+{
+    return iterator(findNode(key), this);
+}
+
+/**
+* lower_bound by any key type a transparent Compare accepts.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const K& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* upper_bound by any key type a transparent Compare accepts.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const K& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+/**
+* tryGet by any key type a transparent Compare accepts.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+Value* BinarySearchTree<Key, Value, Compare>::tryGet(const K& key)
+{
+    Node<Key, Value> *curr = findNode(key);
+    return curr != NULL ? &curr->getValue() : NULL;
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+const Value* BinarySearchTree<Key, Value, Compare>::tryGet(const K& key) const
+{
+    Node<Key, Value> *curr = findNode(key);
+    return curr != NULL ? &curr->getValue() : NULL;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare BinarySearchTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+* A key greater than every key in the tree is appended after the last
+* node directly, so ascending keys cost two comparisons each: one
+* against the last node, and one more where insertFrom settles it there.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    bool inserted;
+    ItemSource source(&copyItem, const_cast<std::pair<const Key, Value>*>(&keyValuePair), &copyValue);
+    insertFrom(appendStart(keyValuePair.first), keyValuePair.first, source, inserted);
+}
+
+/**
+* Inserts like insert(keyValuePair), but moves the value into the tree
+* instead of copying it. The key is still copied, being const.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    bool inserted;
+    ItemSource source(&moveItem, &keyValuePair, &moveValue);
+    insertFrom(appendStart(keyValuePair.first), keyValuePair.first, source, inserted);
+}
+
+/**
+* Inserts like insert(keyValuePair), but starts the search at hint
+* instead of the root, and returns an iterator to the key's node. When
+* the key belongs right next to the hint, e.g. at end() for ascending
+* keys, this takes O(1) comparisons; otherwise the search climbs from
+* the hint only as far as it must before going down.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const iterator& hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    bool inserted;
+    ItemSource source(&copyItem, const_cast<std::pair<const Key, Value>*>(&keyValuePair), &copyValue);
+    Node<Key, Value>* start = hintStart(hint.current_, keyValuePair.first);
+    return iterator(insertFrom(start, keyValuePair.first, source, inserted), this);
+}
+
+/**
+* Hinted insert that moves the value into the tree.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const iterator& hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    bool inserted;
+    ItemSource source(&moveItem, &keyValuePair, &moveValue);
+    Node<Key, Value>* start = hintStart(hint.current_, keyValuePair.first);
+    return iterator(insertFrom(start, keyValuePair.first, source, inserted), this);
+}
+
+/**
+* Constructs a key/value pair from args directly inside a new node, then
+* links the node in unless its key is already in the tree, in which case
+* the node is dropped and the existing value is left alone, as with
+* std::map. Returns an iterator to the key's node and whether it was
+* inserted.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::emplace(Args&&... args)
+{
+    auto build = [&]() { return std::pair<const Key, Value>(std::forward<Args>(args)...); };
+    ItemSource source(nullptr, nullptr, nullptr);
+    source.node = newNode(&callMaker<decltype(build)>, &build);
+
+    bool inserted;
+    const Key& key = source.node->getKey();
+    Node<Key, Value>* node = insertFrom(appendStart(key), key, source, inserted);
+    return std::make_pair(iterator(node, this), inserted);
+}
+
+/**
+* If key is not in the tree, inserts it with a value constructed in
+* place from args; otherwise does nothing at all, so no key or value is
+* ever built for a hit. Returns an iterator to the key's node and
+* whether it was inserted.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    auto build = [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(key),
+                                           std::forward_as_tuple(std::forward<Args>(args)...));
+    };
+    ItemSource source(&callMaker<decltype(build)>, &build, nullptr);
+
+    bool inserted;
+    Node<Key, Value>* node = insertFrom(appendStart(key), key, source, inserted);
+    return std::make_pair(iterator(node, this), inserted);
+}
+
+/**
+* try_emplace that moves key into the new node if it is inserted.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    auto build = [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                                           std::forward_as_tuple(std::forward<Args>(args)...));
+    };
+    ItemSource source(&callMaker<decltype(build)>, &build, nullptr);
+
+    bool inserted;
+    Node<Key, Value>* node = insertFrom(appendStart(key), key, source, inserted);
+    return std::make_pair(iterator(node, this), inserted);
+}
+
+/**
+* Finds key searching down from start, which must be a node whose
+* subtree the key belongs in (or NULL for an empty tree), and links in
+* the node source describes if it is missing, or applies source's assign
+* to it if present. Returns the key's node and sets inserted.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::insertFrom(Node<Key, Value>* start, const Key& key,
+                                                           const ItemSource& source, bool& inserted)
+{
+    inserted = true;
+
     //insert if tree is empty
     if (root_ == nullptr){
-        root_ = new Node <Key,Value>(key, val, nullptr);
-        return; 
+        root_ = placeNode<BSTNode<Key, Value> >(source, nullptr);
+        noteInserted(root_);
+        return root_; 
     }
 
-    Node<Key, Value>* curr = root_; 
+    Node<Key, Value>* curr = start; 
 
     while(true){
-        //go left if key < curr 
-        if (key < curr->getKey()){
-            //if the left child node is empty, insert 
-            if (curr->getLeft() == nullptr){
-                curr->setLeft(new Node<Key, Value>(key, val, curr));
-                break; 
+        KeyOrder order = orderKeys(key, curr->getKey());
+        //the key exists
+        if (order.equivalent){
+            inserted = false;
+            if (source.node != nullptr){
+                destroyNode(source.node);
             }
-            //go to next node if not empty
-            curr = curr->getLeft(); 
-        }
-        //go right if key > curr
-        else if (key > curr->getKey()){
-            //if the right child node is empty, insert 
-            if (curr->getRight() == nullptr){
-                curr->setRight(new Node<Key, Value>(key, val, curr));
-                break; 
+            if (source.assign != nullptr){
+                source.assign(source.context, curr->getValue());
             }
-            //go to next node if not empty
-            curr = curr->getRight(); 
+            return curr;
         }
-        else{
-            curr->setValue(val);
-            break;
+
+        //go left if key < curr, right if key > curr; the side is picked
+        //without a branch so the descent does not stall on mispredictions
+        bool goLeft = order.less;
+        Node<Key, Value>* next = goLeft ? curr->getLeft() : curr->getRight();
+
+        //if the child is empty, insert there
+        if (next == nullptr){
+            //(a key moved into the node can no longer be compared)
+            next = placeNode(source, static_cast<BSTNode<Key, Value>*>(curr));
+            if (goLeft){
+                curr->setLeft(next);
+            }
+            else{
+                curr->setRight(next);
+            }
+            noteInserted(next);
+            updateSizesUpward(curr);
+            updateHeightsUpward(curr);
+            return next;
         }
+        //go to next node if not empty
+        curr = next; 
     }
 }
 
+/**
+* Creates a detached node of the tree's own node type with its item
+* built by make(context).
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::newNode(ItemMaker make, void* context)
+{
+    return createNode<BSTNode<Key, Value> >(make, context, nullptr);
+}
+
+/**
+* Returns the node source describes, hung below parent: the one it
+* already holds, or a new one of type NodeType.
+*/
+template<class Key, class Value, class Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::placeNode(const ItemSource& source, NodeType* parent)
+{
+    if (source.node != nullptr){
+        source.node->setParent(parent);
+        return static_cast<NodeType*>(source.node);
+    }
+    return createNode<NodeType>(source.make, source.context, parent);
+}
+
+/**
+* Item makers and value assigners for inserting a given pair, by copy
+* or by move.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key, Value> BinarySearchTree<Key, Value, Compare>::copyItem(void* item)
+{
+    return *static_cast<const std::pair<const Key, Value>*>(item);
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::copyValue(void* item, Value& value)
+{
+    value = static_cast<const std::pair<const Key, Value>*>(item)->second;
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key, Value> BinarySearchTree<Key, Value, Compare>::moveItem(void* item)
+{
+    return std::move(*static_cast<std::pair<const Key, Value>*>(item));
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::moveValue(void* item, Value& value)
+{
+    value = std::move(static_cast<std::pair<const Key, Value>*>(item)->second);
+}
+
+/**
+* Item maker that calls a function object building the item.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+std::pair<const Key, Value> BinarySearchTree<Key, Value, Compare>::callMaker(void* maker)
+{
+    return (*static_cast<F*>(maker))();
+}
+
+/**
+* Returns where an insert of key without a hint starts searching: the
+* last node if key comes after it, since it then hangs right below it,
+* and the root otherwise.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::appendStart(const Key& key) const
+{
+    if (rightmost_ != nullptr && comp_(rightmost_->getKey(), key)){
+        return rightmost_;
+    }
+    return root_;
+}
+
+/**
+* An iterator at node, or end() for NULL, for derived trees that find
+* nodes their own way.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iteratorAt(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Returns where an insert of key hinted at hint (NULL for end()) starts
+* searching. Keys past either end hang right off the end node. Otherwise
+* the search climbs from the hint to the first ancestor that bounds the
+* key on the far side, and starts at the highest node passed on the way
+* whose key is on the key's near side: that is where a search from the
+* top would leave the path to the hint, so nothing is compared twice.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::hintStart(Node<Key, Value>* hint, const Key& key) const
+{
+    if (rightmost_ == nullptr || comp_(rightmost_->getKey(), key)){
+        return rightmost_;
+    }
+    if (comp_(key, leftmost_->getKey())){
+        return leftmost_;
+    }
+    if (hint == nullptr){
+        hint = rightmost_;
+    }
+
+    Node<Key, Value>* start = hint;
+    Node<Key, Value>* curr = hint;
+    Node<Key, Value>* above = hint->getParent();
+    if (comp_(key, hint->getKey())){
+        //climb until an ancestor to the left is less than the key
+        while (above != nullptr && !(curr == above->getRight() && comp_(above->getKey(), key))){
+            if (curr == above->getRight()){
+                start = above;
+            }
+            curr = above;
+            above = above->getParent();
+        }
+    }
+    else if (comp_(hint->getKey(), key)){
+        //climb until an ancestor to the right is greater than the key
+        while (above != nullptr && !(curr == above->getLeft() && comp_(key, above->getKey()))){
+            if (curr == above->getLeft()){
+                start = above;
+            }
+            curr = above;
+            above = above->getParent();
+        }
+    }
+    return start;
+}
 
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::remove(const Key& key)
 {
     //start at the root and find the key to remove 
     Node<Key, Value>* curr = root_; 
 
-    while(curr != nullptr && curr->getKey() != key){
+    while(curr != nullptr){
+        KeyOrder order = orderKeys(key, curr->getKey());
+        if (order.equivalent){
+            break;
+        }
         //go left if key < curr
-        if(key < curr -> getKey()){
+        else if(order.less){
             curr = curr->getLeft(); 
         }
         //key is > curr = go right 
-        else if (key > curr -> getKey()){
+        else{
             curr = curr->getRight(); 
         }
     }
@@ -538,12 +1542,16 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     if (curr == nullptr){
         return; 
     }
+    noteRemoving(curr);
 
     //Case 1: has a left and right child 
     if (curr->getLeft() != nullptr && curr->getRight() != nullptr){
         //swap with pred and remove it
         Node<Key, Value>* pred = predecessor(curr);
         nodeSwap(curr, pred);
+        //heights go with the positions; nodeSwap itself is shared with
+        //AVLTree, whose nodes have none
+        static_cast<BSTNode<Key, Value>*>(curr)->swapShape(static_cast<BSTNode<Key, Value>*>(pred));
     }
 
     //Case 2: has a left child 
@@ -613,14 +1621,16 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         }
     }
 
-    delete curr; 
+    updateSizesUpward(curr->getParent());
+    updateHeightsUpward(curr->getParent());
+    destroyNode(curr); 
 }
 
 
 
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Compare>::predecessor(Node<Key, Value>* current)
 {
     if (current == nullptr){
         return nullptr;
@@ -657,33 +1667,164 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 
 
 
+/**
+* Returns the next node in an in-order sequencing, or NULL
+* if current is the last node.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::successor(Node<Key, Value>* current)
+{
+    //check if at the last node
+    if (current == nullptr){
+        return nullptr; 
+    }
+
+    //Case 1: there is no right child 
+    if (current -> getRight() == nullptr){
+        //start at the bottom and go up until it is coming from the left child
+        Node<Key, Value>* aboveNode = current->getParent();
+        while(aboveNode != nullptr && aboveNode->getRight() == current){
+            //go up
+            current = aboveNode; 
+            aboveNode = aboveNode->getParent(); 
+        }
+
+        //when it leaves while loop, it is coming from right child 
+        return aboveNode; 
+    }
+
+    //Case 2: there is a right child 
+    current = current->getRight(); 
+
+    //after going right once, keep going left 
+    while(current->getLeft() != nullptr){
+        current = current->getLeft(); 
+    }
+    return current; 
+}
+
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* When the keys and values need no destructor, the nodes are
+* dropped with the pool's slabs and never visited. A pool shared
+* with other trees still holds their nodes, so then each node is
+* freed on its own instead. With a reclaimer set, an unshared pool
+* and everything in it is handed over whole, in O(1).
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clear()
+{
+    NodePool& pool = nodePool();
+    if (pool_.use_count() > 1){
+        destroySubtree(root_);
+        adoptRoot(nullptr);
+        return;
+    }
+    if (reclaimer_ != nullptr && clearInBackground()){
+        return;
+    }
+
+    if (!std::is_trivially_destructible<Key>::value ||
+        !std::is_trivially_destructible<Value>::value){
+        destroySubtree(root_);
+    }
+
+    adoptRoot(nullptr);
+    pool.release();
+}
+
+/**
+* Detaches the nodes and the pool they live in, moves the tree onto a
+* fresh pool and retires the old one to reclaimer_. The pool must not
+* be shared. Returns false, leaving the tree as it was, if there is no
+* memory for the fresh pool; if queueing fails, the old nodes are freed
+* right here instead.
+*/
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::clearInBackground()
 {
-    while (root_ != nullptr){
-        Node<Key, Value>* temp = root_;
+    NodePool& pool = nodePool();
+    std::shared_ptr<NodePool> fresh;
+    DetachedNodes* garbage = nullptr;
+    try {
+        fresh = std::make_shared<NodePool>(pool.slotSize(), pool.slotAlign());
+        garbage = new DetachedNodes;
+    }
+    catch(...) {
+        return false;
+    }
+    fresh->setHugePages(pool.hugePages());
+    size_t nodes = pool.liveSlots();
 
-        //Case 1: there is a left child
-        if (root_->getLeft() != nullptr){
-            root_ = root_->getLeft(); 
+    garbage->top = root_;
+    garbage->destroyer = destroyer_;
+    garbage->pool.swap(pool_);
+    pool_.swap(fresh);
+    adoptRoot(nullptr);
+
+    try {
+        reclaimer_->retire(&reclaimDetached, garbage, nodes);
+    }
+    catch(...) {
+        reclaimDetached(garbage);
+    }
+    return true;
+}
+
+/**
+* Frees nodes detached by clearInBackground: runs their destructors if
+* the keys or values have any, then drops the last reference to their
+* pool, which returns every slab at once.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::reclaimDetached(void* garbage)
+{
+    DetachedNodes* detached = static_cast<DetachedNodes*>(garbage);
+    if (!std::is_trivially_destructible<Key>::value ||
+        !std::is_trivially_destructible<Value>::value){
+        //the same walk as destroySubtree, but the slots go with the pool
+        Node<Key, Value>* top = detached->top;
+        while (top != nullptr){
+            Node<Key, Value>* leftChild = top->getLeft();
+            if (leftChild != nullptr){
+                top->setLeft(leftChild->getRight());
+                leftChild->setRight(top);
+                top = leftChild;
+            }
+            else{
+                Node<Key, Value>* temp = top;
+                top = top->getRight();
+                detached->destroyer(temp);
+            }
         }
-        //Case 2: there is a right child (no left child)
-        else if(root_->getRight() != nullptr){
-            root_ = root_->getRight(); 
+    }
+    delete detached;
+}
+
+/**
+* Destroys every node of a subtree one by one, without recursion:
+* while the top node has a left child, rotate it up; otherwise delete
+* the top node and continue with its right subtree.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destroySubtree(Node<Key, Value>* top)
+{
+    while (top != nullptr){
+        Node<Key, Value>* leftChild = top->getLeft();
+
+        //Case 1: there is a left child, rotate right
+        if (leftChild != nullptr){
+            top->setLeft(leftChild->getRight());
+            leftChild->setRight(top);
+            top = leftChild;
         }
-        //Case 3: there is no left nor right child (set root to nullptr)
+        //Case 2: no left child, delete top and move to the right
         else{
-            delete root_; 
-            root_= nullptr; 
-        }
-
-        //delete old root if moved
-        if (root_ != nullptr && temp != root_){
-            delete temp; 
+            Node<Key, Value>* temp = top;
+            top = top->getRight();
+            destroyNode(temp);
         }
     }
 }
@@ -692,9 +1833,9 @@ void BinarySearchTree<Key, Value>::clear()
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare>::getSmallestNode() const
 {
     //start from the root and go down
     Node<Key, Value>* curr = root_; 
@@ -716,18 +1857,29 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalFind(const Key& key) const
+{
+    return findNode(key);
+}
+
+/**
+* internalFind for any key type Compare can order against Key.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::findNode(const K& key) const
 {
     //start from the root and go down
     Node<Key, Value>* curr = root_; 
 
     //if key < curr, go left, else go right 
     while (curr != nullptr){
-        if (curr->getKey() == key){
+        KeyOrder order = orderKeys(key, curr->getKey());
+        if (order.equivalent){
             return curr;
         }
-        else if (key < curr->getKey()){
+        else if (order.less){
             curr = curr->getLeft();
         }
         else{
@@ -737,70 +1889,567 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     return nullptr; 
 }
 
-//helper function to find height of tree
-template<typename Key, typename Value> 
+/**
+* Says whether a orders before b under comp_, and whether the two are
+* equivalent, with a single compare call when Compare has one.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename A, typename B>
+KeyOrder BinarySearchTree<Key, Value, Compare>::orderKeys(const A& a, const B& b) const
+{
+    return ::orderKeys(comp_, a, b);
+}
 
-int BinarySearchTree<Key, Value>::findHeight(Node<Key, Value>* node) const
+/**
+* Returns the height of the subtree at top, in O(1) from the heights
+* the nodes keep. Trees with their own node type override it.
+*/
+template<typename Key, typename Value, typename Compare>
+int BinarySearchTree<Key, Value, Compare>::heightAt(Node<Key, Value>* top) const
 {
-    //Case 1: there are no nodes 
-    if (node == nullptr){
-        return 0; 
+    return BSTNode<Key, Value>::heightOf(static_cast<BSTNode<Key, Value>*>(top));
+}
+
+/**
+* Returns whether every node of the subtree at top is balanced, in O(1).
+* Trees with their own node type override it.
+*/
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::balancedAt(Node<Key, Value>* top) const
+{
+    return BSTNode<Key, Value>::balancedBelow(static_cast<BSTNode<Key, Value>*>(top));
+}
+
+/**
+* Returns the height of the subtree at top and sets balanced to whether
+* each of its nodes has subtrees that differ in height by at most one,
+* by visiting all of it. For trees whose nodes keep no heights. The walk
+* is post-order on an explicit stack rather than recursive, since an
+* unbalanced tree can be a single path n nodes long.
+*/
+template<typename Key, typename Value, typename Compare>
+int BinarySearchTree<Key, Value, Compare>::measureSubtree(Node<Key, Value>* top, bool& balanced)
+{
+    balanced = true;
+    if (top == nullptr){
+        return 0;
     }
 
-    int leftHeight = findHeight(node->getLeft());
-    if (leftHeight == -1){
-        return -1; //error
+    struct Frame
+    {
+        Node<Key, Value>* node;
+        int leftHeight;
+        // 0: nothing measured yet, 1: left subtree measured
+        int stage;
+    };
+    std::vector<Frame> stack;
+    Frame first = { top, 0, 0 };
+    stack.push_back(first);
+    //height of the subtree measured last
+    int measured = 0;
+
+    while (!stack.empty()){
+        Frame& frame = stack.back();
+        if (frame.stage == 0){
+            frame.stage = 1;
+            Node<Key, Value>* left = frame.node->getLeft();
+            measured = 0;
+            if (left != nullptr){
+                Frame next = { left, 0, 0 };
+                stack.push_back(next);
+                continue;
+            }
+        }
+        if (frame.stage == 1){
+            frame.leftHeight = measured;
+            frame.stage = 2;
+            Node<Key, Value>* right = frame.node->getRight();
+            measured = 0;
+            if (right != nullptr){
+                Frame next = { right, 0, 0 };
+                stack.push_back(next);
+                continue;
+            }
+        }
+        //both subtrees measured
+        int leftHeight = frame.leftHeight;
+        int rightHeight = measured;
+        if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1){
+            balanced = false;
+        }
+        measured = (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+        stack.pop_back();
     }
+    return measured;
+}
 
-    int rightHeight = findHeight(node->getRight());
-    if (rightHeight == -1){
-        return -1; //error
+/**
+* Refreshes the heights and balances of the BSTNodes from node up to
+* the root after a child below node was linked or unlinked, stopping
+* early once they no longer change.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::updateHeightsUpward(Node<Key, Value>* node)
+{
+    BSTNode<Key, Value>* curr = static_cast<BSTNode<Key, Value>*>(node);
+    while (curr != nullptr && curr->refresh()){
+        curr = curr->getParent();
     }
+}
 
-    //return -1 if not balanced
-    if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1){
-        return -1; 
+
+/**
+* Constructs a node of the given type in a slot from the pool.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(const Key& key, const Value& value, NodeType* parent)
+{
+    NodePool& pool = nodePool();
+    void* slot = pool.allocate();
+    try {
+        return new (slot) NodeType(key, value, parent);
     }
+    catch(...) {
+        pool.deallocate(slot);
+        throw;
+    }
+}
 
-    //if previous returns not executed = balanced 
-    if (leftHeight > rightHeight){
-        leftHeight = leftHeight + 1; 
-        return leftHeight; 
+/**
+* Constructs a node of the given type in a slot from the pool, with its
+* item built in place by make(context).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(ItemMaker make, void* context, NodeType* parent)
+{
+    NodePool& pool = nodePool();
+    void* slot = pool.allocate();
+    try {
+        return new (slot) NodeType(make, context, parent);
     }
-    else{
-        rightHeight = rightHeight + 1;
-        return rightHeight; 
+    catch(...) {
+        pool.deallocate(slot);
+        throw;
     }
+}
 
-    return -1; 
+/**
+* Destroys a node and returns its slot to the pool.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destroyNode(Node<Key, Value>* node)
+{
+    destroyer_(node);
+    nodePool().deallocate(node);
 }
 
+/**
+* Returns the pool the tree's nodes currently live in.
+*/
+template<typename Key, typename Value, typename Compare>
+NodePool& BinarySearchTree<Key, Value, Compare>::nodePool() const
+{
+    return NodePool::resolve(pool_);
+}
 
 /**
- * Return true iff the BST is balanced.
- */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+* Makes this tree and other allocate from, and free to, the same pool,
+* so that nodes can be moved between them.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::sharePool(BinarySearchTree<Key, Value, Compare>& other)
 {
-    //check if tree is empty (balanced)
-    if (root_ == nullptr){
-        return true; 
+    NodePool::merge(pool_, other.pool_);
+}
+
+/**
+* Updates the cached end nodes, and the threads, for a node just linked
+* in as a leaf. It is the new first node exactly when it hangs left of
+* the old one, and it goes right before or after its parent in key order.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::noteInserted(Node<Key, Value>* node)
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* parent = node->getParent();
+    if (parent != nullptr && parent->getLeft() == node){
+        threadBetween(parent->getPrev(), node);
+        threadBetween(node, parent);
+    }
+    else if (parent != nullptr){
+        threadBetween(node, parent->getNext());
+        threadBetween(parent, node);
+    }
+#endif
+    if (leftmost_ == nullptr || leftmost_->getLeft() == node){
+        leftmost_ = node;
     }
+    if (rightmost_ == nullptr || rightmost_->getRight() == node){
+        rightmost_ = node;
+    }
+}
 
-    int height = findHeight(root_);
+/**
+* Updates the cached end nodes for a node about to be removed; must be
+* called while it is still linked in.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::noteRemoving(Node<Key, Value>* node)
+{
+    if (node == leftmost_){
+        leftmost_ = successor(node);
+    }
+    if (node == rightmost_){
+        rightmost_ = predecessor(node);
+    }
+#ifdef BST_THREADED
+    threadBetween(node->getPrev(), node->getNext());
+#endif
+}
+
+/**
+* Installs a new root after a bulk restructuring and recomputes the
+* cached end nodes, in O(height).
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::adoptRoot(Node<Key, Value>* root)
+{
+    root_ = root;
+    leftmost_ = root;
+    rightmost_ = root;
+    if (root == nullptr){
+        return;
+    }
+    while (leftmost_->getLeft() != nullptr){
+        leftmost_ = leftmost_->getLeft();
+    }
+    while (rightmost_->getRight() != nullptr){
+        rightmost_ = rightmost_->getRight();
+    }
+#ifdef BST_THREADED
+    //the root may have been cut out of a longer run of threads
+    leftmost_->setPrev(nullptr);
+    rightmost_->setNext(nullptr);
+#endif
+}
 
-    if (height == -1){
-        return false; 
+/**
+* Makes next follow prev in key order; either may be NULL for an end of
+* the order. Does nothing unless BST_THREADED is defined.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::threadBetween(Node<Key, Value>* prev, Node<Key, Value>* next)
+{
+#ifdef BST_THREADED
+    if (prev != nullptr){
+        prev->setNext(next);
+    }
+    if (next != nullptr){
+        next->setPrev(prev);
     }
+#else
+    (void)prev;
+    (void)next;
+#endif
+}
 
-    //if -1 was not returned = balanced 
-    return true; 
+/**
+* Rethreads every node from the tree's structure, in O(n), after an
+* operation that reassembled it from several trees. Does nothing unless
+* BST_THREADED is defined.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::relinkThreads()
+{
+#ifdef BST_THREADED
+    Node<Key, Value>* prev = nullptr;
+    for (Node<Key, Value>* curr = leftmost_; curr != nullptr; curr = successor(curr)){
+        threadBetween(prev, curr);
+        prev = curr;
+    }
+    threadBetween(prev, nullptr);
+#endif
 }
 
+/**
+* Recomputes the subtree sizes from node up to the root after a node
+* below it was linked in or cut out. Does nothing unless
+* BST_ORDER_STATISTICS is defined.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::updateSizesUpward(Node<Key, Value>* node)
+{
+#ifdef BST_ORDER_STATISTICS
+    while (node != nullptr){
+        node->updateSize();
+        node = node->getParent();
+    }
+#else
+    (void)node;
+#endif
+}
 
+#ifdef BST_ORDER_STATISTICS
+/**
+* Returns the number of nodes in a subtree, 0 for an empty one.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t BinarySearchTree<Key, Value, Compare>::subtreeSize(const Node<Key, Value>* node)
+{
+    return node != nullptr ? node->getSize() : 0;
+}
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+/**
+* Returns the number of keys in the tree in O(1).
+*/
+template<typename Key, typename Value, typename Compare>
+size_t BinarySearchTree<Key, Value, Compare>::size() const
+{
+    return subtreeSize(root_);
+}
+
+/**
+* Returns an iterator to the key with the given zero-based position in
+* sorted order, or end() if there are not that many keys, in O(height).
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::select(size_t index) const
+{
+    Node<Key, Value>* curr = root_;
+    while (curr != nullptr){
+        size_t leftSize = subtreeSize(curr->getLeft());
+        if (index < leftSize){
+            curr = curr->getLeft();
+        }
+        else if (index == leftSize){
+            break;
+        }
+        else{
+            index -= leftSize + 1;
+            curr = curr->getRight();
+        }
+    }
+    return iterator(curr, this);
+}
+
+/**
+* Returns the number of keys less than key, in O(height). This is also
+* the position key has, or would have, in sorted order.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t BinarySearchTree<Key, Value, Compare>::rank(const Key& key) const
+{
+    size_t count = 0;
+    Node<Key, Value>* curr = root_;
+    while (curr != nullptr){
+        if (comp_(curr->getKey(), key)){
+            count += subtreeSize(curr->getLeft()) + 1;
+            curr = curr->getRight();
+        }
+        else{
+            curr = curr->getLeft();
+        }
+    }
+    return count;
+}
+
+/**
+* Returns the number of keys in [lo, hi), in O(height).
+*/
+template<typename Key, typename Value, typename Compare>
+size_t BinarySearchTree<Key, Value, Compare>::rangeCount(const Key& lo, const Key& hi) const
+{
+    if (!comp_(lo, hi)){
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+#endif
+
+/**
+* Runs the destructor of the tree's node type, since Node has
+* no virtual destructor to do it.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::destroyAs(Node<Key, Value>* node)
+{
+    static_cast<NodeType*>(node)->~NodeType();
+}
+
+/**
+* Returns an iterator to the first key not less than key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the first key greater than key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the greatest key not greater than key, or
+* end() if every key is greater.
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::floor(const Key& key) const
+{
+    Node<Key, Value>* best = nullptr;
+    Node<Key, Value>* curr = root_;
+    while (curr != nullptr){
+        if (comp_(key, curr->getKey())){
+            curr = curr->getLeft();
+        }
+        else{
+            best = curr;
+            curr = curr->getRight();
+        }
+    }
+    return iterator(best, this);
+}
+
+/**
+* Returns an iterator to the smallest key not less than key, or end()
+* if every key is less. The same as lower_bound.
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::ceiling(const Key& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns the range of keys equal to key: either just that key, or an
+* empty range at the position it would have.
+*/
+template<typename Key, typename Value, typename Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& key) const
+{
+    Node<Key, Value>* first = lowerBoundNode(key);
+    if (first != nullptr && !comp_(key, first->getKey())){
+        return std::make_pair(iterator(first, this), iterator(successor(first), this));
+    }
+    return std::make_pair(iterator(first, this), iterator(first, this));
+}
+
+/**
+* Returns the keys in [lo, hi). Both ends are found in O(height), and
+* iterating over k keys then takes O(k).
+*/
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::KeyRange
+BinarySearchTree<Key, Value, Compare>::range(const Key& lo, const Key& hi) const
+{
+    if (!comp_(lo, hi)){
+        return KeyRange(end(), end());
+    }
+    return KeyRange(lower_bound(lo), lower_bound(hi));
+}
+
+/**
+* Returns the node with the smallest key not less than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::lowerBoundNode(const K& key) const
+{
+    Node<Key, Value>* best = nullptr;
+    Node<Key, Value>* curr = root_;
+    while (curr != nullptr){
+        if (comp_(curr->getKey(), key)){
+            curr = curr->getRight();
+        }
+        else{
+            best = curr;
+            curr = curr->getLeft();
+        }
+    }
+    return best;
+}
+
+/**
+* Returns the node with the smallest key greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::upperBoundNode(const K& key) const
+{
+    Node<Key, Value>* best = nullptr;
+    Node<Key, Value>* curr = root_;
+    while (curr != nullptr){
+        if (comp_(key, curr->getKey())){
+            best = curr;
+            curr = curr->getLeft();
+        }
+        else{
+            curr = curr->getRight();
+        }
+    }
+    return best;
+}
+
+/**
+ * Return true iff the BST is balanced, i.e. the heights of the two
+ * subtrees of every node differ by at most one. O(1): the nodes keep
+ * track of it as the tree changes.
+ */
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced() const
+{
+    return balancedAt(root_);
+}
+
+/**
+ * Returns the number of levels in the tree, 0 when it is empty, in O(1)
+ * (O(log n) for an AVLTree, which works it out from the balances, and
+ * O(n) for the trees whose nodes keep no heights).
+ */
+template<typename Key, typename Value, typename Compare>
+int BinarySearchTree<Key, Value, Compare>::height() const
+{
+    return heightAt(root_);
+}
+
+/**
+ * Returns the height of the subtree rooted at top's node, or 0 for
+ * end(), in the same time as height().
+ */
+template<typename Key, typename Value, typename Compare>
+int BinarySearchTree<Key, Value, Compare>::height(const iterator& top) const
+{
+    return heightAt(top.current_);
+}
+
+/**
+ * Returns whether the subtree rooted at top's node is balanced, in the
+ * same time as isBalanced(); end() counts as an empty subtree.
+ */
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced(const iterator& top) const
+{
+    return balancedAt(top.current_);
+}
+
+
+
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
@@ -881,6 +2530,12 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+#ifdef BST_ORDER_STATISTICS
+    // sizes belong to the positions, which the nodes just traded
+    size_t tempSize = n1->getSize();
+    n1->setSize(n2->getSize());
+    n2->setSize(tempSize);
+#endif
 }
 
 /**
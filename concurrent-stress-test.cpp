@@ -0,0 +1,100 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include "optimisticavl.h"
+
+using namespace std;
+
+// Keys below STABLE_KEYS are inserted up front and never removed
+static const int STABLE_KEYS = 1000;
+
+/**
+ * One thread's share of the stress test: random inserts, removes and
+ * finds on the keys congruent to id mod threads, checked against a
+ * std::map of its own since no other thread touches them, plus finds of
+ * stable keys that must never go missing however the tree is rotating.
+ */
+void stress(OptimisticAVLTree<int, string>& tree, int id, int threads, int ops, int range,
+            map<int, string>& model, atomic<int>& failures)
+{
+    OptimisticAVLTree<int, string>::Handle handle(tree);
+    mt19937 rng(id);
+    string value;
+    for(int i = 0; i < ops; ++i) {
+        int key = STABLE_KEYS + (int)(rng() % range) * threads + id;
+        unsigned dice = rng() % 4;
+        if(dice == 0) {
+            bool inserted = handle.insert(make_pair(key, to_string(i)));
+            if(inserted != (model.count(key) == 0)) ++failures;
+            model[key] = to_string(i);
+        }
+        else if(dice == 1) {
+            bool removed = handle.remove(key);
+            if(removed != (model.erase(key) == 1)) ++failures;
+        }
+        else if(dice == 2) {
+            bool found = handle.find(key, value);
+            map<int, string>::iterator it = model.find(key);
+            if(found != (it != model.end()) || (found && value != it->second)) ++failures;
+        }
+        else {
+            int stable = (int)(rng() % STABLE_KEYS);
+            if(!handle.find(stable, value) || value != to_string(stable)) ++failures;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // usage: concurrent-stress-test [threads] [ops per thread]
+    int threads = (int)thread::hardware_concurrency();
+    if(threads < 4) threads = 4;
+    int ops = 200000;
+    if(argc > 1) threads = atoi(argv[1]);
+    if(argc > 2) ops = atoi(argv[2]);
+    // Small enough per thread that keys are often re-inserted and removed
+    int range = 2000;
+
+    OptimisticAVLTree<int, string> tree;
+    {
+        OptimisticAVLTree<int, string>::Handle handle(tree);
+        for(int key = 0; key < STABLE_KEYS; ++key) {
+            handle.insert(make_pair(key, to_string(key)));
+        }
+    }
+
+    vector<map<int, string> > models(threads);
+    atomic<int> failures(0);
+    vector<thread> workers;
+    for(int id = 0; id < threads; ++id) {
+        workers.push_back(thread(stress, ref(tree), id, threads, ops, range, ref(models[id]), ref(failures)));
+    }
+    for(int id = 0; id < threads; ++id) {
+        workers[id].join();
+    }
+    cout << threads << " threads x " << ops << " ops: " << failures << " wrong answers" << endl;
+
+    // Quiescent now: the tree must hold exactly the stable keys and what
+    // each thread's model says, in order, and be balanced again
+    map<int, string> expected;
+    for(int key = 0; key < STABLE_KEYS; ++key) expected[key] = to_string(key);
+    for(int id = 0; id < threads; ++id) expected.insert(models[id].begin(), models[id].end());
+    map<int, string>::iterator it = expected.begin();
+    bool matches = tree.size() == expected.size();
+    tree.forEach([&](const int& key, const string& value) {
+        if(it == expected.end() || it->first != key || it->second != value) matches = false;
+        else ++it;
+    });
+    cout << "Contents " << (matches ? "match" : "DO NOT match") << ", " << expected.size() << " keys" << endl;
+    bool balanced = tree.isBalanced();
+    cout << "Tree " << (balanced ? "is" : "is NOT") << " balanced" << endl;
+
+    bool passed = failures == 0 && matches && balanced;
+    cout << (passed ? "PASSED" : "FAILED") << endl;
+    return passed ? 0 : 1;
+}
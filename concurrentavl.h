@@ -0,0 +1,757 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+#include "node_pool.h"
+#include "key_compare.h"
+#include "epoch_reclaimer.h"
+
+/**
+* A node of a ConcurrentAVLTree. Once a node has been published, which
+* is when a root it can be reached from is, it never changes again.
+*/
+template <typename Key, typename Value>
+struct PersistentAVLNode
+{
+    std::pair<const Key, Value> item_;
+    PersistentAVLNode* left_;
+    PersistentAVLNode* right_;
+    int height_;
+
+    PersistentAVLNode(const std::pair<const Key, Value>& item, PersistentAVLNode* left, PersistentAVLNode* right) :
+        item_(item), left_(left), right_(right), height_(1) { }
+};
+
+/**
+* An AVL tree for one writer thread and any number of reader threads,
+* where readers never lock, never wait and never see a change halfway.
+*
+* The tree is persistent: the writer never changes a published node.
+* An insert or remove copies the nodes on its search path, and the
+* siblings its rotations move, links the copies into a new root that
+* shares every other node with the old one, and publishes the new root
+* with one atomic store. A reader loads the root once and then walks an
+* unchanging tree, so whatever it reads, all of it comes from one
+* version of the tree: a snapshot, however long the walk takes.
+*
+* The nodes a change replaces cannot be freed while a reader that loaded
+* an older root may still be walking them. They go to an EpochReclaimer
+* instead, which frees them once every reader has moved past the epoch
+* they were replaced in; clear() hands over the whole old tree the same
+* way.
+*
+* Each reader thread needs a Reader of its own. A Snapshot taken through
+* it pins one version of the tree for lookups and in-order visits, and
+* keeps its nodes from being freed until it goes away, so snapshots
+* should be short-lived. Readers and snapshots must be gone before the
+* tree is destroyed.
+*
+* An update copies O(log n) keys and values, so keys and values should
+* be cheap to copy. insert, remove and clear must all come from the same
+* thread, or be serialized by the caller.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ~ConcurrentAVLTree();
+
+    // Writer side
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    size_t backlog() const;
+
+    typedef PersistentAVLNode<Key, Value> Node;
+    class Snapshot;
+
+    /**
+    * A reader thread's registration with the tree. Not to be shared
+    * between threads.
+    */
+    class Reader
+    {
+    public:
+        explicit Reader(const ConcurrentAVLTree<Key, Value, Compare>& tree);
+        ~Reader();
+
+        bool find(const Key& key, Value& value);
+
+    private:
+        friend class Snapshot;
+        // Not copyable: a reader owns a slot in the tree's reclaimer
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        void pin();
+        void unpin();
+
+        const ConcurrentAVLTree<Key, Value, Compare>* tree_;
+        size_t slot_;
+        // Snapshots open on this reader; the slot stays pinned while any are
+        int pins_;
+    };
+
+    /**
+    * One version of the tree, held still for as long as the snapshot
+    * lives.
+    */
+    class Snapshot
+    {
+    public:
+        explicit Snapshot(Reader& reader);
+        ~Snapshot();
+
+        const Value* tryGet(const Key& key) const;
+        template<typename F>
+        void forEach(F f) const;
+        template<typename F>
+        void forRange(const Key& lo, const Key& hi, F f) const;
+
+    private:
+        // Not copyable: each snapshot pins and unpins its reader once
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+
+        template<typename F>
+        void visit(const Node* node, const Key* lo, const Key* hi, F& f) const;
+
+        Reader& reader_;
+        const Node* root_;
+    };
+
+protected:
+    Node* makeNode(const std::pair<const Key, Value>& item, Node* left, Node* right);
+    Node* copyNode(const Node* node);
+    Node* insertAt(Node* node, const std::pair<const Key, Value>& item, bool& inserted);
+    Node* removeAt(Node* node, const Key& key);
+    Node* removeMin(Node* node, const Node*& min);
+    Node* rebalance(Node* node, bool shared);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static int heightOf(const Node* node);
+    static void updateHeight(Node* node);
+    const Node* findNode(const Node* root, const Key& key) const;
+    void prepareUpdate();
+    void publish(Node* root);
+    void abandonUpdate();
+    void destroyNode(Node* node);
+    void destroySubtree(Node* node);
+    static void reclaimNode(void* tree, void* node);
+    static void reclaimSubtree(void* tree, void* node);
+
+private:
+    // Not copyable: readers hold a pointer to the tree
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+protected:
+    // The published version; readers load it, only the writer stores it
+    std::atomic<Node*> root_;
+    size_t size_;
+    Compare comp_;
+    // Nodes come from and go back to the pool on the writer's thread only
+    NodePool pool_;
+    mutable EpochReclaimer reclaimer_;
+    // The current update's new nodes and the published nodes they
+    // replace, kept until it is published or abandoned
+    std::vector<Node*> created_;
+    std::vector<const Node*> replaced_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::Reader class.
+  -------------------------------------------
+*/
+
+/**
+* Registers the calling thread as a reader of tree; throws
+* std::runtime_error if the tree has EPOCH_MAX_READERS already.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Reader::Reader(const ConcurrentAVLTree<Key, Value, Compare>& tree) :
+    tree_(&tree),
+    slot_(tree.reclaimer_.registerReader()),
+    pins_(0)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Reader::~Reader()
+{
+    tree_->reclaimer_.unregisterReader(slot_);
+}
+
+/**
+* Copies the value for key into value and returns true, or returns
+* false if key is missing.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::Reader::find(const Key& key, Value& value)
+{
+    Snapshot snapshot(*this);
+    const Value* found = snapshot.tryGet(key);
+    if (found == nullptr){
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::Reader::pin()
+{
+    if (pins_++ == 0){
+        tree_->reclaimer_.pin(slot_);
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::Reader::unpin()
+{
+    if (--pins_ == 0){
+        tree_->reclaimer_.unpin(slot_);
+    }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the ConcurrentAVLTree::Reader class.
+  -------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::Snapshot class.
+  -------------------------------------------
+*/
+
+/**
+* Pins reader, then takes the version of the tree published last.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(Reader& reader) :
+    reader_(reader),
+    root_(nullptr)
+{
+    reader_.pin();
+    root_ = reader_.tree_->root_.load(std::memory_order_acquire);
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    reader_.unpin();
+}
+
+/**
+* Returns a pointer to the value for key in this version, or NULL if it
+* is missing. The pointer is good for as long as the snapshot.
+*/
+template<class Key, class Value, class Compare>
+const Value* ConcurrentAVLTree<Key, Value, Compare>::Snapshot::tryGet(const Key& key) const
+{
+    const Node* found = reader_.tree_->findNode(root_, key);
+    return found != nullptr ? &found->item_.second : nullptr;
+}
+
+/**
+* Calls f(item) for every item of this version, in key order.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+void ConcurrentAVLTree<Key, Value, Compare>::Snapshot::forEach(F f) const
+{
+    visit(root_, nullptr, nullptr, f);
+}
+
+/**
+* Calls f(item) for every item of this version with a key in [lo, hi),
+* in key order.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+void ConcurrentAVLTree<Key, Value, Compare>::Snapshot::forRange(const Key& lo, const Key& hi, F f) const
+{
+    visit(root_, &lo, &hi, f);
+}
+
+/**
+* Visits the items of the subtree at node with keys in [lo, hi) in
+* order, skipping the subtrees that lie wholly outside; a NULL bound is
+* open.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+void ConcurrentAVLTree<Key, Value, Compare>::Snapshot::visit(const Node* node, const Key* lo, const Key* hi,
+                                                             F& f) const
+{
+    const Compare& comp = reader_.tree_->comp_;
+    while (node != nullptr){
+        bool aboveLo = lo == nullptr || !comp(node->item_.first, *lo);
+        bool belowHi = hi == nullptr || comp(node->item_.first, *hi);
+        if (aboveLo){
+            visit(node->left_, lo, hi, f);
+        }
+        if (aboveLo && belowHi){
+            f(node->item_);
+        }
+        if (!belowHi){
+            return;
+        }
+        node = node->right_;
+    }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the ConcurrentAVLTree::Snapshot class.
+  -------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    root_(nullptr),
+    size_(0),
+    comp_(),
+    pool_(sizeof(Node), alignof(Node))
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    root_(nullptr),
+    size_(0),
+    comp_(comp),
+    pool_(sizeof(Node), alignof(Node))
+{
+
+}
+
+/**
+* Frees every node, retired or not. No reader may be left.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    reclaimer_.collectAll();
+    destroySubtree(root_.load(std::memory_order_relaxed));
+}
+
+/**
+* Inserts the item, or replaces the value of an existing key, and
+* publishes the result as the new version of the tree.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    prepareUpdate();
+    bool inserted = false;
+    Node* root;
+    try {
+        root = insertAt(root_.load(std::memory_order_relaxed), keyValuePair, inserted);
+    }
+    catch(...) {
+        abandonUpdate();
+        throw;
+    }
+    publish(root);
+    if (inserted){
+        ++size_;
+    }
+}
+
+/**
+* Removes key, if it is in the tree, and publishes the result as the new
+* version of the tree.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Node* current = root_.load(std::memory_order_relaxed);
+    if (findNode(current, key) == nullptr){
+        return;
+    }
+    prepareUpdate();
+    Node* root;
+    try {
+        root = removeAt(current, key);
+    }
+    catch(...) {
+        abandonUpdate();
+        throw;
+    }
+    publish(root);
+    --size_;
+}
+
+/**
+* Publishes an empty tree and retires the old one whole.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    Node* old = root_.load(std::memory_order_relaxed);
+    if (old == nullptr){
+        return;
+    }
+    root_.store(nullptr, std::memory_order_release);
+    size_ = 0;
+    reclaimer_.retire(&reclaimSubtree, this, old);
+    reclaimer_.advance();
+    reclaimer_.collect();
+}
+
+/**
+* Returns true if the latest version is empty. For the writer's thread.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns the number of items in the latest version. For the writer's
+* thread.
+*/
+template<class Key, class Value, class Compare>
+size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns the number of replaced nodes (or cleared trees) waiting for
+* readers to move on before they are freed.
+*/
+template<class Key, class Value, class Compare>
+size_t ConcurrentAVLTree<Key, Value, Compare>::backlog() const
+{
+    return reclaimer_.backlog();
+}
+
+/**
+* Creates an unpublished node holding a copy of item.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::makeNode(const std::pair<const Key, Value>& item,
+                                                                                Node* left, Node* right)
+{
+    void* slot = pool_.allocate();
+    Node* node;
+    try {
+        node = new (slot) Node(item, left, right);
+    }
+    catch(...) {
+        pool_.deallocate(slot);
+        throw;
+    }
+    updateHeight(node);
+    created_.push_back(node);
+    return node;
+}
+
+/**
+* Creates an unpublished copy of a published node, to be changed in its
+* place; the original is retired once the update is published.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::copyNode(const Node* node)
+{
+    Node* copy = makeNode(node->item_, node->left_, node->right_);
+    replaced_.push_back(node);
+    return copy;
+}
+
+/**
+* Returns the new root of the subtree at node with item inserted. Every
+* node on the search path is copied; the copies are private to the
+* writer until published, so the rotations change them in place.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::insertAt(Node* node,
+                                                                                const std::pair<const Key, Value>& item,
+                                                                                bool& inserted)
+{
+    if (node == nullptr){
+        inserted = true;
+        return makeNode(item, nullptr, nullptr);
+    }
+    KeyOrder order = orderKeys(comp_, item.first, node->item_.first);
+    //the key exists: a new node carries the new value
+    if (order.equivalent){
+        Node* replacement = makeNode(item, node->left_, node->right_);
+        replaced_.push_back(node);
+        return replacement;
+    }
+    Node* copy = copyNode(node);
+    if (order.less){
+        copy->left_ = insertAt(node->left_, item, inserted);
+    }
+    else{
+        copy->right_ = insertAt(node->right_, item, inserted);
+    }
+    return rebalance(copy, false);
+}
+
+/**
+* Returns the new root of the subtree at node with key, which must be in
+* it, removed. A node with two children is replaced by a new node
+* holding its successor's item.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::removeAt(Node* node, const Key& key)
+{
+    KeyOrder order = orderKeys(comp_, key, node->item_.first);
+    if (!order.equivalent){
+        Node* copy = copyNode(node);
+        if (order.less){
+            copy->left_ = removeAt(node->left_, key);
+        }
+        else{
+            copy->right_ = removeAt(node->right_, key);
+        }
+        return rebalance(copy, true);
+    }
+
+    replaced_.push_back(node);
+    if (node->left_ == nullptr){
+        return node->right_;
+    }
+    if (node->right_ == nullptr){
+        return node->left_;
+    }
+    const Node* min = nullptr;
+    Node* right = removeMin(node->right_, min);
+    return rebalance(makeNode(min->item_, node->left_, right), true);
+}
+
+/**
+* Returns the new root of the subtree at node without its smallest node,
+* which is retired and returned through min.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::removeMin(Node* node, const Node*& min)
+{
+    if (node->left_ == nullptr){
+        min = node;
+        replaced_.push_back(node);
+        return node->right_;
+    }
+    Node* copy = copyNode(node);
+    copy->left_ = removeMin(node->left_, min);
+    return rebalance(copy, true);
+}
+
+/**
+* Restores the AVL balance at node, an unpublished node whose subtrees
+* are balanced, and returns the subtree's new root. After an insert the
+* taller child is on the search path and already a copy; after a remove
+* (shared) it is on the other side, a published node, and it and the
+* grandchild a double rotation moves are copied first.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::rebalance(Node* node, bool shared)
+{
+    updateHeight(node);
+    int balance = heightOf(node->left_) - heightOf(node->right_);
+    if (balance > 1){
+        Node* child = shared ? copyNode(node->left_) : node->left_;
+        if (heightOf(child->left_) < heightOf(child->right_)){
+            if (shared){
+                child->right_ = copyNode(child->right_);
+            }
+            child = rotateLeft(child);
+        }
+        node->left_ = child;
+        return rotateRight(node);
+    }
+    if (balance < -1){
+        Node* child = shared ? copyNode(node->right_) : node->right_;
+        if (heightOf(child->right_) < heightOf(child->left_)){
+            if (shared){
+                child->left_ = copyNode(child->left_);
+            }
+            child = rotateRight(child);
+        }
+        node->right_ = child;
+        return rotateLeft(node);
+    }
+    return node;
+}
+
+/**
+* Rotates node's right child above it and returns the child. Both must
+* be unpublished.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* child = node->right_;
+    node->right_ = child->left_;
+    child->left_ = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+/**
+* Rotates node's left child above it and returns the child. Both must be
+* unpublished.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* child = node->left_;
+    node->left_ = child->right_;
+    child->right_ = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::heightOf(const Node* node)
+{
+    return node != nullptr ? node->height_ : 0;
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::updateHeight(Node* node)
+{
+    int left = heightOf(node->left_);
+    int right = heightOf(node->right_);
+    node->height_ = (left > right ? left : right) + 1;
+}
+
+/**
+* Returns the node with key in the version at root, or NULL.
+*/
+template<class Key, class Value, class Compare>
+const PersistentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value, Compare>::findNode(const Node* root,
+                                                                                      const Key& key) const
+{
+    const Node* curr = root;
+    while (curr != nullptr){
+        KeyOrder order = orderKeys(comp_, key, curr->item_.first);
+        if (order.equivalent){
+            return curr;
+        }
+        curr = order.less ? curr->left_ : curr->right_;
+    }
+    return nullptr;
+}
+
+/**
+* Makes room to record an update's nodes up front, so that recording
+* them cannot throw halfway: an update copies at most three nodes per
+* level, counting the siblings and grandchildren its rotations move.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::prepareUpdate()
+{
+    size_t most = 3 * static_cast<size_t>(heightOf(root_.load(std::memory_order_relaxed)) + 2);
+    created_.reserve(most);
+    replaced_.reserve(most);
+}
+
+/**
+* Makes root the version readers see, then retires the nodes it no
+* longer uses and frees what readers have moved past.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::publish(Node* root)
+{
+    root_.store(root, std::memory_order_release);
+    try {
+        for (size_t i = 0; i < replaced_.size(); ++i){
+            reclaimer_.retire(&reclaimNode, this, const_cast<Node*>(replaced_[i]));
+        }
+    }
+    catch(...) {
+        //the rest are leaked rather than freed under a reader
+    }
+    created_.clear();
+    replaced_.clear();
+    reclaimer_.advance();
+    reclaimer_.collect();
+}
+
+/**
+* Frees the nodes of an update that failed before it was published.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::abandonUpdate()
+{
+    for (size_t i = 0; i < created_.size(); ++i){
+        destroyNode(created_[i]);
+    }
+    created_.clear();
+    replaced_.clear();
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroyNode(Node* node)
+{
+    node->~Node();
+    pool_.deallocate(node);
+}
+
+/**
+* Frees every node of a tree no reader can reach any more.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::destroySubtree(Node* node)
+{
+    while (node != nullptr){
+        destroySubtree(node->left_);
+        Node* right = node->right_;
+        destroyNode(node);
+        node = right;
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaimNode(void* tree, void* node)
+{
+    static_cast<ConcurrentAVLTree<Key, Value, Compare>*>(tree)->destroyNode(static_cast<Node*>(node));
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaimSubtree(void* tree, void* node)
+{
+    static_cast<ConcurrentAVLTree<Key, Value, Compare>*>(tree)->destroySubtree(static_cast<Node*>(node));
+}
+
+/*
+  -----------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -----------------------------------------
+*/
+
+#endif
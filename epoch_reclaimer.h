@@ -0,0 +1,234 @@
+#ifndef EPOCH_RECLAIMER_H
+#define EPOCH_RECLAIMER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+
+// Most reader threads that can be registered with one EpochReclaimer
+#ifndef EPOCH_MAX_READERS
+#define EPOCH_MAX_READERS 64
+#endif
+// Retired objects collect() lets pile up before it scans the readers
+#define EPOCH_COLLECT_BATCH 1024
+
+/**
+* Epoch-based reclamation for one writer thread and many reader threads
+* that read a shared structure without locks.
+*
+* The writer unlinks objects from the structure and hands them to
+* retire(), tagged with the current epoch, instead of freeing them, then
+* moves the epoch on with advance(). A reader pins itself to the epoch
+* it saw before it looks at the structure, and unpins when it is done.
+* An object retired in epoch e can only still be seen by a reader that
+* pinned an epoch no later than e, so collect() frees whatever was
+* retired before the oldest epoch any reader is pinned to.
+*
+* Readers take a slot with registerReader() once and pin and unpin it
+* around each read; a pin is one store, and readers never wait for the
+* writer or for each other. retire(), advance() and collect() must only
+* be called from the writer's thread. A reader that stays pinned holds
+* back every object retired since it pinned, so reads should be short.
+*/
+class EpochReclaimer
+{
+public:
+    EpochReclaimer();
+    ~EpochReclaimer();
+
+    size_t registerReader();
+    void unregisterReader(size_t slot);
+    void pin(size_t slot);
+    void unpin(size_t slot);
+
+    void retire(void (*reclaim)(void* context, void* garbage), void* context, void* garbage);
+    void advance();
+    void collect();
+    void collectAll();
+    size_t backlog() const;
+
+private:
+    // Not copyable: readers hold slot numbers into this reclaimer
+    EpochReclaimer(const EpochReclaimer&);
+    EpochReclaimer& operator=(const EpochReclaimer&);
+
+    // A reader's slot, on a cache line of its own so that pinning does
+    // not invalidate the line other readers pin in
+    struct alignas(64) Slot
+    {
+        // Epoch the reader is pinned to, or 0 when it is not reading
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> used;
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;
+        void (*reclaim)(void* context, void* garbage);
+        void* context;
+        void* garbage;
+    };
+
+    void reclaimBefore(uint64_t epoch);
+
+    Slot slots_[EPOCH_MAX_READERS];
+    // Starts at 1 so that 0 can mean unpinned
+    std::atomic<uint64_t> epoch_;
+    // Written by the writer only; oldest first
+    std::deque<Retired> retired_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the EpochReclaimer class.
+  -------------------------------------------
+*/
+
+/**
+* Starts at epoch 1 with no readers.
+*/
+inline EpochReclaimer::EpochReclaimer() :
+    epoch_(1)
+{
+    for (size_t i = 0; i < EPOCH_MAX_READERS; ++i){
+        slots_[i].epoch.store(0, std::memory_order_relaxed);
+        slots_[i].used.store(false, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Frees everything still retired. No reader may be pinned any more.
+*/
+inline EpochReclaimer::~EpochReclaimer()
+{
+    collectAll();
+}
+
+/**
+* Takes a free reader slot for the calling thread and returns its number;
+* throws std::runtime_error if all EPOCH_MAX_READERS are taken.
+*/
+inline size_t EpochReclaimer::registerReader()
+{
+    for (size_t i = 0; i < EPOCH_MAX_READERS; ++i){
+        bool expected = false;
+        if (!slots_[i].used.load(std::memory_order_relaxed) &&
+           slots_[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)){
+            return i;
+        }
+    }
+    throw std::runtime_error("EpochReclaimer: too many readers");
+}
+
+/**
+* Gives a reader slot back. The reader must not be pinned.
+*/
+inline void EpochReclaimer::unregisterReader(size_t slot)
+{
+    slots_[slot].epoch.store(0, std::memory_order_release);
+    slots_[slot].used.store(false, std::memory_order_release);
+}
+
+/**
+* Pins a reader to the current epoch, before it loads anything from the
+* shared structure. The fence pairs with the one in collect(): either
+* collect() sees this pin, or the loads after it see the writer's latest
+* change, and with it nothing collect() is about to free. The store
+* releases the reads of this reader's last pin, which collect() acquires
+* before it frees what they saw.
+*/
+inline void EpochReclaimer::pin(size_t slot)
+{
+    uint64_t epoch = epoch_.load(std::memory_order_acquire);
+    slots_[slot].epoch.store(epoch, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/**
+* Unpins a reader once it holds no more pointers into the structure.
+*/
+inline void EpochReclaimer::unpin(size_t slot)
+{
+    slots_[slot].epoch.store(0, std::memory_order_release);
+}
+
+/**
+* Queues reclaim(context, garbage) to run once no reader can still see
+* garbage, which the writer must already have unlinked. reclaim must not
+* throw. If queueing throws, nothing was queued.
+*/
+inline void EpochReclaimer::retire(void (*reclaim)(void* context, void* garbage), void* context, void* garbage)
+{
+    Retired retired;
+    retired.epoch = epoch_.load(std::memory_order_relaxed);
+    retired.reclaim = reclaim;
+    retired.context = context;
+    retired.garbage = garbage;
+    retired_.push_back(retired);
+}
+
+/**
+* Starts a new epoch, after the writer has published a change and
+* retired what the change unlinked.
+*/
+inline void EpochReclaimer::advance()
+{
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+}
+
+/**
+* Frees what no pinned reader can see any more, once enough has been
+* retired to be worth scanning the reader slots for.
+*/
+inline void EpochReclaimer::collect()
+{
+    if (retired_.size() < EPOCH_COLLECT_BATCH) return;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = epoch_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < EPOCH_MAX_READERS; ++i){
+        uint64_t pinned = slots_[i].epoch.load(std::memory_order_acquire);
+        if (pinned != 0 && pinned < oldest) oldest = pinned;
+    }
+    reclaimBefore(oldest);
+}
+
+/**
+* Frees everything retired so far, whether readers are pinned or not.
+* Only for when no reader can be reading, such as at teardown.
+*/
+inline void EpochReclaimer::collectAll()
+{
+    reclaimBefore(UINT64_MAX);
+}
+
+/**
+* Returns the number of retired objects not yet freed.
+*/
+inline size_t EpochReclaimer::backlog() const
+{
+    return retired_.size();
+}
+
+/**
+* Frees the objects retired in epochs before epoch, which are at the
+* front of the queue.
+*/
+inline void EpochReclaimer::reclaimBefore(uint64_t epoch)
+{
+    while(!retired_.empty() && retired_.front().epoch < epoch){
+        Retired retired = retired_.front();
+        retired_.pop_front();
+        retired.reclaim(retired.context, retired.garbage);
+    }
+}
+
+/*
+  -----------------------------------------
+  End implementations for the EpochReclaimer class.
+  -----------------------------------------
+*/
+
+#endif
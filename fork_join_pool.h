@@ -0,0 +1,212 @@
+#ifndef FORK_JOIN_POOL_H
+#define FORK_JOIN_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A small fork-join thread pool for divide-and-conquer algorithms.
+*
+* invoke(f, g) runs f and g, possibly at the same time, and returns once
+* both have finished. f is offered to the pool's workers while the
+* calling thread runs g; if no worker has picked f up by then, the
+* caller runs it itself. A thread waiting for its f runs other pending
+* tasks in the meantime, so nested invokes never leave the pool idle
+* or deadlocked.
+*
+* The calling thread counts as one of the pool's threads, so a pool of
+* n threads starts n - 1 workers, and a pool of one runs everything
+* inline. An exception thrown by f or g is rethrown from invoke, after
+* both have finished.
+*/
+class ForkJoinPool
+{
+public:
+    explicit ForkJoinPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ForkJoinPool();
+
+    template<typename F, typename G>
+    void invoke(F f, G g);
+
+    unsigned threads() const;
+
+private:
+    // Not copyable: the workers hold a pointer to the pool
+    ForkJoinPool(const ForkJoinPool&);
+    ForkJoinPool& operator=(const ForkJoinPool&);
+
+    struct Task
+    {
+        void (*run)(void* function);
+        void* function;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    template<typename F>
+    static void call(void* function);
+    static void runTask(Task* task);
+    void waitFor(Task* task);
+    void workerLoop();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    // Forked tasks not yet started; workers take the oldest, which is the
+    // largest piece of work, and waiting threads the newest
+    std::deque<Task*> pending_;
+    std::vector<std::thread> workers_;
+    bool stopping_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the ForkJoinPool class.
+  -------------------------------------------
+*/
+
+/**
+* Starts threads - 1 workers; zero is treated as one.
+*/
+inline ForkJoinPool::ForkJoinPool(unsigned threads) :
+    stopping_(false)
+{
+    for(unsigned i = 1; i < threads; ++i){
+        workers_.push_back(std::thread(&ForkJoinPool::workerLoop, this));
+    }
+}
+
+/**
+* Stops and joins the workers. Must not be called while an invoke on
+* the pool is still running.
+*/
+inline ForkJoinPool::~ForkJoinPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for(size_t i = 0; i < workers_.size(); ++i){
+        workers_[i].join();
+    }
+}
+
+inline unsigned ForkJoinPool::threads() const
+{
+    return unsigned(workers_.size()) + 1;
+}
+
+/**
+* Runs f and g, in parallel if a worker is free, and returns when both
+* are done.
+*/
+template<typename F, typename G>
+void ForkJoinPool::invoke(F f, G g)
+{
+    if(workers_.empty()){
+        f();
+        g();
+        return;
+    }
+
+    Task task;
+    task.run = &call<F>;
+    task.function = &f;
+    task.done.store(false, std::memory_order_relaxed);
+    try {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(&task);
+    }
+    catch(...) {
+        // could not fork; run both here instead
+        f();
+        g();
+        return;
+    }
+    wake_.notify_one();
+
+    try {
+        g();
+    }
+    catch(...) {
+        waitFor(&task);
+        throw;
+    }
+    waitFor(&task);
+    if(task.error){
+        std::rethrow_exception(task.error);
+    }
+}
+
+template<typename F>
+void ForkJoinPool::call(void* function)
+{
+    (*static_cast<F*>(function))();
+}
+
+inline void ForkJoinPool::runTask(Task* task)
+{
+    try {
+        task->run(task->function);
+    }
+    catch(...) {
+        task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+/**
+* Runs pending tasks, newest first, until task is done. That picks the
+* caller's own task back up if no worker has started it yet.
+*/
+inline void ForkJoinPool::waitFor(Task* task)
+{
+    while(!task->done.load(std::memory_order_acquire)){
+        Task* next = NULL;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!pending_.empty()){
+                next = pending_.back();
+                pending_.pop_back();
+            }
+        }
+        if(next != NULL){
+            runTask(next);
+        }
+        else{
+            std::this_thread::yield();
+        }
+    }
+}
+
+inline void ForkJoinPool::workerLoop()
+{
+    for(;;){
+        Task* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while(!stopping_ && pending_.empty()){
+                wake_.wait(lock);
+            }
+            if(pending_.empty()){
+                return;
+            }
+            task = pending_.front();
+            pending_.pop_front();
+        }
+        runTask(task);
+    }
+}
+
+/*
+  -----------------------------------------
+  End implementations for the ForkJoinPool class.
+  -----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,632 @@
+#ifndef FROZENBST_H
+#define FROZENBST_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Cache line size the snapshot's key array is laid out for
+#define FROZEN_CACHE_LINE_BYTES 64
+
+/**
+* An immutable, read-only copy of a search tree's items, laid out for
+* lookups rather than for updates.
+*
+* There are no nodes and no links. The keys sit in one flat array in
+* breadth-first (Eytzinger) order: the root is in slot 1 and the
+* children of slot k are in slots 2k and 2k+1. The items sit in a second
+* array in the same order. A search only reads the key array, descends
+* by index arithmetic instead of loading a pointer, and picks the next
+* slot with a compare added into the index, so it has no branch to
+* mispredict. The descendants of slot k a few levels down share one
+* cache line, so every step prefetches the line the search will need
+* that many levels later, and the misses down the path overlap instead
+* of waiting on each other.
+*
+* find, lower_bound and upper_bound mean what they do on
+* BinarySearchTree, and iterating visits the items in key order.
+* Stepping an iterator follows the implicit tree in O(1) amortized time,
+* but a scan jumps around memory, so a snapshot is not the thing to
+* build for full scans.
+*
+* Copies share one read-only array, so passing a snapshot around is
+* cheap, and any number of threads may read it at once.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    FrozenTree();
+    explicit FrozenTree(const Compare& comp);
+    template<typename Iterator>
+    FrozenTree(Iterator first, Iterator last, const Compare& comp = Compare());
+    bool empty() const;
+    size_t size() const;
+    size_t memoryUsage() const;
+    Compare key_comp() const;
+
+public:
+    /**
+    * Visits the items of a snapshot in key order. The items cannot be
+    * changed through it.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator& operator--();
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        iterator(const std::pair<const Key, Value>* items, size_t count, size_t slot);
+        const std::pair<const Key, Value>* items_;
+        size_t count_;
+        // Slot of the current item, or 0 at end()
+        size_t slot_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    const Value* tryGet(const Key& key) const;
+
+    // Lookups by any key type a transparent Compare accepts
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+
+protected:
+    // The arrays a snapshot and its copies share. Slot 0 of each is
+    // unused, so that slot k's children are at 2k and 2k+1.
+    struct Storage
+    {
+        size_t count;
+        // Slots filled so far, in key order; all of them once built
+        size_t built;
+        void* keyBlock;
+        Key* keys;
+        std::pair<const Key, Value>* items;
+
+        explicit Storage(size_t count);
+        ~Storage();
+
+    private:
+        Storage(const Storage&);
+        Storage& operator=(const Storage&);
+    };
+
+    // Keys per cache line: the descendants of slot k this many slots
+    // wide start at slot k times it, on a line of their own
+    static const size_t KEYS_PER_LINE =
+        sizeof(Key) < FROZEN_CACHE_LINE_BYTES ? FROZEN_CACHE_LINE_BYTES / sizeof(Key) : 1;
+
+    template<typename K>
+    size_t lowerBoundSlot(const K& key) const;
+    template<typename K>
+    size_t upperBoundSlot(const K& key) const;
+    template<typename K>
+    iterator findSlot(const K& key) const;
+    iterator iteratorAt(size_t slot) const;
+    static size_t firstSlot(size_t count);
+    static size_t lastSlot(size_t count);
+    static size_t nextSlot(size_t slot, size_t count);
+    static size_t prevSlot(size_t slot, size_t count);
+    static size_t slotAbove(size_t slot);
+
+    std::shared_ptr<const Storage> storage_;
+    // Copies of the storage's fields, to save the searches a load
+    const Key* keys_;
+    size_t count_;
+    Compare comp_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the FrozenTree::iterator class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor for an iterator that refers to no snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator() :
+    items_(nullptr),
+    count_(0),
+    slot_(0)
+{
+
+}
+
+/**
+* Initializes an iterator at the given slot of a snapshot's items.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator(const std::pair<const Key, Value>* items,
+                                                    size_t count, size_t slot) :
+    items_(items),
+    count_(count),
+    slot_(slot)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>& FrozenTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return items_[slot_];
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>* FrozenTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &items_[slot_];
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return slot_ == rhs.slot_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return slot_ != rhs.slot_;
+}
+
+/**
+* Advances the iterator to the next key; past the last key it is end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator& FrozenTree<Key, Value, Compare>::iterator::operator++()
+{
+    slot_ = FrozenTree<Key, Value, Compare>::nextSlot(slot_, count_);
+    return *this;
+}
+
+/**
+* Moves the iterator back to the previous key. Stepping back from end()
+* reaches the last key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator& FrozenTree<Key, Value, Compare>::iterator::operator--()
+{
+    slot_ = slot_ == 0 ? FrozenTree<Key, Value, Compare>::lastSlot(count_)
+                       : FrozenTree<Key, Value, Compare>::prevSlot(slot_, count_);
+    return *this;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the FrozenTree::iterator class.
+  -------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the FrozenTree class.
+  -------------------------------------------
+*/
+
+/**
+* Allocates the arrays for count items, with the key array starting on
+* a cache line boundary. Nothing is constructed in them yet.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::Storage::Storage(size_t count) :
+    count(count),
+    built(0),
+    keyBlock(nullptr),
+    keys(nullptr),
+    items(nullptr)
+{
+    keyBlock = ::operator new((count + 1) * sizeof(Key) + FROZEN_CACHE_LINE_BYTES);
+    size_t misalign = reinterpret_cast<size_t>(keyBlock) % FROZEN_CACHE_LINE_BYTES;
+    size_t head = misalign == 0 ? 0 : FROZEN_CACHE_LINE_BYTES - misalign;
+    keys = reinterpret_cast<Key*>(static_cast<char*>(keyBlock) + head);
+    try {
+        items = static_cast<std::pair<const Key, Value>*>(
+            ::operator new((count + 1) * sizeof(std::pair<const Key, Value>)));
+    }
+    catch(...) {
+        ::operator delete(keyBlock);
+        throw;
+    }
+}
+
+/**
+* Destroys the items built so far, which are the first ones in key
+* order, and frees both arrays.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::Storage::~Storage()
+{
+    size_t slot = FrozenTree<Key, Value, Compare>::firstSlot(count);
+    for (size_t i = 0; i < built; ++i){
+        keys[slot].~Key();
+        items[slot].~pair();
+        slot = FrozenTree<Key, Value, Compare>::nextSlot(slot, count);
+    }
+    ::operator delete(items);
+    ::operator delete(keyBlock);
+}
+
+/**
+* Default constructor for an empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree() :
+    keys_(nullptr),
+    count_(0),
+    comp_()
+{
+
+}
+
+/**
+* Constructor for an empty snapshot ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree(const Compare& comp) :
+    keys_(nullptr),
+    count_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Copies the items of [first, last), which must be in strictly
+* increasing key order under comp, into a new snapshot.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+FrozenTree<Key, Value, Compare>::FrozenTree(Iterator first, Iterator last, const Compare& comp) :
+    keys_(nullptr),
+    count_(0),
+    comp_(comp)
+{
+    size_t count = std::distance(first, last);
+    if (count == 0){
+        return;
+    }
+    std::shared_ptr<Storage> storage = std::make_shared<Storage>(count);
+
+    //visiting the slots in key order places the sorted items breadth-first
+    size_t slot = firstSlot(count);
+    for (; first != last; ++first){
+        new (&storage->keys[slot]) Key(first->first);
+        try {
+            new (&storage->items[slot]) std::pair<const Key, Value>(*first);
+        }
+        catch(...) {
+            storage->keys[slot].~Key();
+            throw;
+        }
+        ++storage->built;
+        slot = nextSlot(slot, count);
+    }
+
+    storage_ = storage;
+    keys_ = storage->keys;
+    count_ = count;
+}
+
+/**
+* Returns true if the snapshot holds no items.
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return count_ == 0;
+}
+
+/**
+* Returns the number of items in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return count_;
+}
+
+/**
+* Returns the bytes held by the snapshot's arrays, which its copies
+* share.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::memoryUsage() const
+{
+    if (count_ == 0){
+        return 0;
+    }
+    return (count_ + 1) * (sizeof(Key) + sizeof(std::pair<const Key, Value>)) + FROZEN_CACHE_LINE_BYTES;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare FrozenTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns an iterator to the smallest key, or end() if empty.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::begin() const
+{
+    return iteratorAt(firstSlot(count_));
+}
+
+/**
+* Returns an iterator past the largest key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::end() const
+{
+    return iteratorAt(0);
+}
+
+/**
+* Returns an iterator to the item with key, or end() if it is missing.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return findSlot(key);
+}
+
+/**
+* Returns an iterator to the first key not less than key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iteratorAt(lowerBoundSlot(key));
+}
+
+/**
+* Returns an iterator to the first key greater than key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return iteratorAt(upperBoundSlot(key));
+}
+
+/**
+* Returns a pointer to the value for key, or NULL if it is missing.
+*/
+template<class Key, class Value, class Compare>
+const Value* FrozenTree<Key, Value, Compare>::tryGet(const Key& key) const
+{
+    iterator found = findSlot(key);
+    return found != end() ? &found->second : nullptr;
+}
+
+/**
+* find, lower_bound and upper_bound by any key type a transparent
+* Compare accepts.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::find(const K& key) const
+{
+    return findSlot(key);
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::lower_bound(const K& key) const
+{
+    return iteratorAt(lowerBoundSlot(key));
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::upper_bound(const K& key) const
+{
+    return iteratorAt(upperBoundSlot(key));
+}
+
+/**
+* Returns the slot of the first key not less than key, or 0 if there is
+* none. The descent runs all the way to the bottom of the implicit tree
+* whatever the keys, appending one bit per level for the way it went
+* (1 for right); the answer is the last slot where it went left, which
+* is what is left after dropping the trailing 1 bits and one 0 bit.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const K& key) const
+{
+    const Key* keys = keys_;
+    size_t count = count_;
+    size_t slot = 1;
+    while (slot <= count){
+#ifdef __GNUC__
+        __builtin_prefetch(keys + KEYS_PER_LINE * slot);
+#endif
+        slot = 2 * slot + static_cast<size_t>(comp_(keys[slot], key));
+    }
+    return slotAbove(slot);
+}
+
+/**
+* Like lowerBoundSlot, for the first key greater than key.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+size_t FrozenTree<Key, Value, Compare>::upperBoundSlot(const K& key) const
+{
+    const Key* keys = keys_;
+    size_t count = count_;
+    size_t slot = 1;
+    while (slot <= count){
+#ifdef __GNUC__
+        __builtin_prefetch(keys + KEYS_PER_LINE * slot);
+#endif
+        slot = 2 * slot + static_cast<size_t>(!comp_(key, keys[slot]));
+    }
+    return slotAbove(slot);
+}
+
+/**
+* Returns an iterator to the item with key, or end(): the lower bound,
+* if key is not less than it either.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::findSlot(const K& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if (slot == 0 || comp_(key, keys_[slot])){
+        return end();
+    }
+    return iteratorAt(slot);
+}
+
+/**
+* Returns an iterator to the given slot, 0 being end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator FrozenTree<Key, Value, Compare>::iteratorAt(size_t slot) const
+{
+    return iterator(storage_ ? storage_->items : nullptr, count_, slot);
+}
+
+/**
+* Returns the slot of the smallest of count keys, or 0 if there are none.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::firstSlot(size_t count)
+{
+    if (count == 0){
+        return 0;
+    }
+    size_t slot = 1;
+    while (2 * slot <= count){
+        slot = 2 * slot;
+    }
+    return slot;
+}
+
+/**
+* Returns the slot of the largest of count keys, or 0 if there are none.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::lastSlot(size_t count)
+{
+    if (count == 0){
+        return 0;
+    }
+    size_t slot = 1;
+    while (2 * slot + 1 <= count){
+        slot = 2 * slot + 1;
+    }
+    return slot;
+}
+
+/**
+* Returns the slot after slot in key order, or 0 after the last one:
+* the leftmost slot of its right subtree if it has one, and otherwise
+* the nearest slot it is in the left subtree of.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::nextSlot(size_t slot, size_t count)
+{
+    if (2 * slot + 1 <= count){
+        slot = 2 * slot + 1;
+        while (2 * slot <= count){
+            slot = 2 * slot;
+        }
+        return slot;
+    }
+    return slotAbove(slot);
+}
+
+/**
+* Returns the slot before slot in key order, or 0 before the first one.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::prevSlot(size_t slot, size_t count)
+{
+    if (2 * slot <= count){
+        slot = 2 * slot;
+        while (2 * slot + 1 <= count){
+            slot = 2 * slot + 1;
+        }
+        return slot;
+    }
+    //climb while slot is a left child, then once more
+    while ((slot & 1) == 0){
+        slot >>= 1;
+    }
+    return slot >> 1;
+}
+
+/**
+* Climbs from slot while it is a right child, then once more, giving
+* the nearest slot that has slot in its left subtree, or 0 if none does.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::slotAbove(size_t slot)
+{
+#ifdef __GNUC__
+    return slot >> __builtin_ffsll(~static_cast<unsigned long long>(slot));
+#else
+    while ((slot & 1) != 0){
+        slot >>= 1;
+    }
+    return slot >> 1;
+#endif
+}
+
+/*
+  -----------------------------------------
+  End implementations for the FrozenTree class.
+  -----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,1006 @@
+#ifndef INDEXBST_H
+#define INDEXBST_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/**
+* A node of an index-linked search tree.
+* Links are 32-bit positions in the owning tree's node array
+* rather than pointers, which halves their size on 64-bit builds
+* and lets the whole array be copied without fixing links up.
+*/
+template <typename Key, typename Value>
+struct IndexNode
+{
+    uint32_t parent_;
+    uint32_t left_;
+    uint32_t right_;
+    int8_t balance_;    // only used by IndexedAVLTree
+    std::pair<const Key, Value> item_;
+};
+
+/**
+* An unbalanced binary search tree with the same interface as
+* BinarySearchTree, whose nodes all live in one contiguous array
+* and link to each other with 32-bit indices.
+*
+* The array only grows; removed slots are kept on a free list and
+* reused. Iterators hold an index, so they stay valid when the
+* array is reallocated. Copying a tree of trivially copyable keys
+* and values is a single memcpy.
+*/
+template <typename Key, typename Value>
+class IndexedBinarySearchTree
+{
+public:
+    // Index used for a missing parent/child, like NULL for pointers
+    static const uint32_t NIL = 0xFFFFFFFFu;
+    // Largest number of nodes a tree can hold
+    static const uint32_t MAX_NODES = 0xFFFFFFFEu;
+
+    IndexedBinarySearchTree();
+    IndexedBinarySearchTree(const IndexedBinarySearchTree<Key, Value>& other);
+    IndexedBinarySearchTree<Key, Value>& operator=(const IndexedBinarySearchTree<Key, Value>& other);
+    virtual ~IndexedBinarySearchTree();
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+    void clear();
+    void reserve(size_t n);
+    bool empty() const;
+    size_t size() const;
+    size_t memoryUsage() const;
+
+public:
+    /**
+    * An internal iterator class for traversing the contents of the tree.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class IndexedBinarySearchTree<Key, Value>;
+        iterator(const IndexedBinarySearchTree<Key, Value>* tree, uint32_t index);
+        const IndexedBinarySearchTree<Key, Value>* tree_;
+        uint32_t current_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    IndexNode<Key, Value>& at(uint32_t index) const;
+    uint32_t internalFind(const Key& key) const;
+    uint32_t getSmallestNode() const;
+    uint32_t predecessor(uint32_t current) const;
+    uint32_t successor(uint32_t current) const;
+    void nodeSwap(uint32_t n1, uint32_t n2);
+
+    // Slot management for nodes_
+    uint32_t createNode(const Key& key, const Value& value, uint32_t parent);
+    void destroyNode(uint32_t index);
+    void destroyAll();
+    void grow(size_t minCapacity);
+
+protected:
+    IndexNode<Key, Value>* nodes_;
+    uint32_t root_;
+    uint32_t capacity_;     // slots allocated in nodes_
+    uint32_t used_;         // slots below this index have been handed out
+    uint32_t count_;        // live nodes
+    uint32_t freeList_;     // first freed slot, linked through left_
+};
+
+// Marks a freed slot (in its parent_ link) so bulk operations can skip it
+#define INDEXBST_FREE_SLOT 0xFFFFFFFEu
+
+/*
+--------------------------------------------------------------------
+Begin implementations for the IndexedBinarySearchTree::iterator class.
+--------------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+IndexedBinarySearchTree<Key, Value>::iterator::iterator(
+    const IndexedBinarySearchTree<Key, Value>* tree, uint32_t index) :
+    tree_(tree),
+    current_(index)
+{
+
+}
+
+template<class Key, class Value>
+IndexedBinarySearchTree<Key, Value>::iterator::iterator() :
+    tree_(NULL),
+    current_(NIL)
+{
+
+}
+
+template<class Key, class Value>
+std::pair<const Key,Value> &
+IndexedBinarySearchTree<Key, Value>::iterator::operator*() const
+{
+    return tree_->at(current_).item_;
+}
+
+template<class Key, class Value>
+std::pair<const Key,Value> *
+IndexedBinarySearchTree<Key, Value>::iterator::operator->() const
+{
+    return &(tree_->at(current_).item_);
+}
+
+template<class Key, class Value>
+bool
+IndexedBinarySearchTree<Key, Value>::iterator::operator==(
+    const IndexedBinarySearchTree<Key, Value>::iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<class Key, class Value>
+bool
+IndexedBinarySearchTree<Key, Value>::iterator::operator!=(
+    const IndexedBinarySearchTree<Key, Value>::iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value>
+typename IndexedBinarySearchTree<Key, Value>::iterator&
+IndexedBinarySearchTree<Key, Value>::iterator::operator++()
+{
+    if (current_ != NIL){
+        current_ = tree_->successor(current_);
+    }
+    return *this;
+}
+
+/*
+------------------------------------------------------------------
+End implementations for the IndexedBinarySearchTree::iterator class.
+------------------------------------------------------------------
+*/
+
+/*
+------------------------------------------------------------
+Begin implementations for the IndexedBinarySearchTree class.
+------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+IndexedBinarySearchTree<Key, Value>::IndexedBinarySearchTree() :
+    nodes_(NULL),
+    root_(NIL),
+    capacity_(0),
+    used_(0),
+    count_(0),
+    freeList_(NIL)
+{
+
+}
+
+/**
+* Copy constructor. The node array is copied slot for slot, so every
+* link stays valid as is; trivially copyable keys and values make
+* this one memcpy.
+*/
+template<class Key, class Value>
+IndexedBinarySearchTree<Key, Value>::IndexedBinarySearchTree(const IndexedBinarySearchTree<Key, Value>& other) :
+    nodes_(NULL),
+    root_(NIL),
+    capacity_(0),
+    used_(0),
+    count_(0),
+    freeList_(NIL)
+{
+    *this = other;
+}
+
+template<class Key, class Value>
+IndexedBinarySearchTree<Key, Value>&
+IndexedBinarySearchTree<Key, Value>::operator=(const IndexedBinarySearchTree<Key, Value>& other)
+{
+    if (this == &other){
+        return *this;
+    }
+    clear();
+    if (capacity_ < other.used_){
+        grow(other.used_);
+    }
+
+    if (std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value){
+        if (other.used_ != 0){
+            std::memcpy(static_cast<void*>(nodes_), other.nodes_, sizeof(IndexNode<Key, Value>) * other.used_);
+        }
+        used_ = other.used_;
+        count_ = other.count_;
+    }
+    else{
+        for (uint32_t i = 0; i < other.used_; ++i){
+            IndexNode<Key, Value>& from = other.at(i);
+            IndexNode<Key, Value>& to = at(i);
+            //mark the slot free until its item exists, so that clear()
+            //can undo a partial copy if an item's copy throws
+            to.parent_ = INDEXBST_FREE_SLOT;
+            used_ = i + 1;
+            if (from.parent_ != INDEXBST_FREE_SLOT){
+                try {
+                    new (&to.item_) std::pair<const Key, Value>(from.item_);
+                }
+                catch(...) {
+                    clear();
+                    throw;
+                }
+                ++count_;
+            }
+            to.parent_ = from.parent_;
+            to.left_ = from.left_;
+            to.right_ = from.right_;
+            to.balance_ = from.balance_;
+        }
+    }
+
+    root_ = other.root_;
+    freeList_ = other.freeList_;
+    return *this;
+}
+
+template<typename Key, typename Value>
+IndexedBinarySearchTree<Key, Value>::~IndexedBinarySearchTree()
+{
+    clear();
+    ::operator delete(nodes_);
+}
+
+template<class Key, class Value>
+bool IndexedBinarySearchTree<Key, Value>::empty() const
+{
+    return root_ == NIL;
+}
+
+template<class Key, class Value>
+size_t IndexedBinarySearchTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+/**
+* Returns the bytes held by the node array, including free slots.
+*/
+template<class Key, class Value>
+size_t IndexedBinarySearchTree<Key, Value>::memoryUsage() const
+{
+    return size_t(capacity_) * sizeof(IndexNode<Key, Value>);
+}
+
+/**
+* Makes room for n nodes up front so that inserts don't reallocate.
+*/
+template<class Key, class Value>
+void IndexedBinarySearchTree<Key, Value>::reserve(size_t n)
+{
+    if (n > capacity_){
+        grow(n);
+    }
+}
+
+template<class Key, class Value>
+typename IndexedBinarySearchTree<Key, Value>::iterator
+IndexedBinarySearchTree<Key, Value>::begin() const
+{
+    return iterator(this, getSmallestNode());
+}
+
+template<class Key, class Value>
+typename IndexedBinarySearchTree<Key, Value>::iterator
+IndexedBinarySearchTree<Key, Value>::end() const
+{
+    return iterator(this, NIL);
+}
+
+template<class Key, class Value>
+typename IndexedBinarySearchTree<Key, Value>::iterator
+IndexedBinarySearchTree<Key, Value>::find(const Key & k) const
+{
+    return iterator(this, internalFind(k));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& IndexedBinarySearchTree<Key, Value>::operator[](const Key& key)
+{
+    uint32_t curr = internalFind(key);
+    if(curr == NIL) throw std::out_of_range("Invalid key");
+    return at(curr).item_.second;
+}
+template<class Key, class Value>
+Value const & IndexedBinarySearchTree<Key, Value>::operator[](const Key& key) const
+{
+    uint32_t curr = internalFind(key);
+    if(curr == NIL) throw std::out_of_range("Invalid key");
+    return at(curr).item_.second;
+}
+
+/**
+* Inserts into the tree without rebalancing. If the key is already
+* in the tree, its value is overwritten.
+*/
+template<class Key, class Value>
+void IndexedBinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+
+    //insert if tree is empty
+    if (root_ == NIL){
+        root_ = createNode(key, keyValuePair.second, NIL);
+        return;
+    }
+
+    uint32_t curr = root_;
+
+    while(true){
+        //go left if key < curr
+        if (key < at(curr).item_.first){
+            if (at(curr).left_ == NIL){
+                //createNode may move the array, so link up afterwards
+                uint32_t node = createNode(key, keyValuePair.second, curr);
+                at(curr).left_ = node;
+                break;
+            }
+            curr = at(curr).left_;
+        }
+        //go right if key > curr
+        else if (at(curr).item_.first < key){
+            if (at(curr).right_ == NIL){
+                uint32_t node = createNode(key, keyValuePair.second, curr);
+                at(curr).right_ = node;
+                break;
+            }
+            curr = at(curr).right_;
+        }
+        else{
+            at(curr).item_.second = keyValuePair.second;
+            break;
+        }
+    }
+}
+
+/**
+* Removes a key, swapping with the predecessor first when the
+* node has 2 children.
+*/
+template<typename Key, typename Value>
+void IndexedBinarySearchTree<Key, Value>::remove(const Key& key)
+{
+    uint32_t curr = internalFind(key);
+
+    //key is not found
+    if (curr == NIL){
+        return;
+    }
+
+    //has a left and right child: swap with pred and remove it
+    if (at(curr).left_ != NIL && at(curr).right_ != NIL){
+        nodeSwap(curr, predecessor(curr));
+    }
+
+    //at most one child is left; splice it into curr's place
+    uint32_t child = at(curr).left_ != NIL ? at(curr).left_ : at(curr).right_;
+    uint32_t parent = at(curr).parent_;
+
+    if (child != NIL){
+        at(child).parent_ = parent;
+    }
+    if (parent == NIL){
+        root_ = child;
+    }
+    else if (at(parent).left_ == curr){
+        at(parent).left_ = child;
+    }
+    else{
+        at(parent).right_ = child;
+    }
+
+    destroyNode(curr);
+}
+
+/**
+* Removes every node. The node array is kept for reuse.
+*/
+template<typename Key, typename Value>
+void IndexedBinarySearchTree<Key, Value>::clear()
+{
+    destroyAll();
+    root_ = NIL;
+    used_ = 0;
+    count_ = 0;
+    freeList_ = NIL;
+}
+
+template<typename Key, typename Value>
+IndexNode<Key, Value>& IndexedBinarySearchTree<Key, Value>::at(uint32_t index) const
+{
+    return nodes_[index];
+}
+
+template<typename Key, typename Value>
+uint32_t IndexedBinarySearchTree<Key, Value>::internalFind(const Key& key) const
+{
+    uint32_t curr = root_;
+    while (curr != NIL){
+        const IndexNode<Key, Value>& node = at(curr);
+        if (node.item_.first == key){
+            return curr;
+        }
+        curr = key < node.item_.first ? node.left_ : node.right_;
+    }
+    return NIL;
+}
+
+template<typename Key, typename Value>
+uint32_t IndexedBinarySearchTree<Key, Value>::getSmallestNode() const
+{
+    uint32_t curr = root_;
+
+    if (curr == NIL){
+        return NIL;
+    }
+    while (at(curr).left_ != NIL){
+        curr = at(curr).left_;
+    }
+    return curr;
+}
+
+template<class Key, class Value>
+uint32_t IndexedBinarySearchTree<Key, Value>::predecessor(uint32_t current) const
+{
+    //left child exists: biggest node of the left tree
+    if (at(current).left_ != NIL){
+        current = at(current).left_;
+        while (at(current).right_ != NIL){
+            current = at(current).right_;
+        }
+        return current;
+    }
+
+    //otherwise go up until we come from a right child
+    uint32_t above = at(current).parent_;
+    while (above != NIL && at(above).left_ == current){
+        current = above;
+        above = at(above).parent_;
+    }
+    return above;
+}
+
+template<class Key, class Value>
+uint32_t IndexedBinarySearchTree<Key, Value>::successor(uint32_t current) const
+{
+    //right child exists: smallest node of the right tree
+    if (at(current).right_ != NIL){
+        current = at(current).right_;
+        while (at(current).left_ != NIL){
+            current = at(current).left_;
+        }
+        return current;
+    }
+
+    //otherwise go up until we come from a left child
+    uint32_t above = at(current).parent_;
+    while (above != NIL && at(above).right_ == current){
+        current = above;
+        above = at(above).parent_;
+    }
+    return above;
+}
+
+/**
+* Swaps the positions of two nodes in the tree, the same way
+* BinarySearchTree::nodeSwap does for pointer-linked nodes.
+*/
+template<typename Key, typename Value>
+void IndexedBinarySearchTree<Key, Value>::nodeSwap(uint32_t n1, uint32_t n2)
+{
+    if (n1 == n2 || n1 == NIL || n2 == NIL){
+        return;
+    }
+    IndexNode<Key, Value>& a = at(n1);
+    IndexNode<Key, Value>& b = at(n2);
+    uint32_t n1p = a.parent_, n1r = a.right_, n1lt = a.left_;
+    uint32_t n2p = b.parent_, n2r = b.right_, n2lt = b.left_;
+    bool n1isLeft = n1p != NIL && at(n1p).left_ == n1;
+    bool n2isLeft = n2p != NIL && at(n2p).left_ == n2;
+
+    std::swap(a.parent_, b.parent_);
+    std::swap(a.left_, b.left_);
+    std::swap(a.right_, b.right_);
+
+    if (n1r == n2){
+        b.right_ = n1;
+        a.parent_ = n2;
+    }
+    else if (n2r == n1){
+        a.right_ = n2;
+        b.parent_ = n1;
+    }
+    else if (n1lt == n2){
+        b.left_ = n1;
+        a.parent_ = n2;
+    }
+    else if (n2lt == n1){
+        a.left_ = n2;
+        b.parent_ = n1;
+    }
+
+    if (n1p != NIL && n1p != n2){
+        if (n1isLeft) at(n1p).left_ = n2;
+        else at(n1p).right_ = n2;
+    }
+    if (n1r != NIL && n1r != n2) at(n1r).parent_ = n2;
+    if (n1lt != NIL && n1lt != n2) at(n1lt).parent_ = n2;
+
+    if (n2p != NIL && n2p != n1){
+        if (n2isLeft) at(n2p).left_ = n1;
+        else at(n2p).right_ = n1;
+    }
+    if (n2r != NIL && n2r != n1) at(n2r).parent_ = n1;
+    if (n2lt != NIL && n2lt != n1) at(n2lt).parent_ = n1;
+
+    if (root_ == n1){
+        root_ = n2;
+    }
+    else if (root_ == n2){
+        root_ = n1;
+    }
+}
+
+/**
+* Constructs a node in a free slot, growing the array if needed.
+* References into the array are invalid after this call.
+*/
+template<typename Key, typename Value>
+uint32_t IndexedBinarySearchTree<Key, Value>::createNode(const Key& key, const Value& value, uint32_t parent)
+{
+    uint32_t index = freeList_;
+    if (index == NIL){
+        if (used_ == MAX_NODES){
+            throw std::length_error("IndexedBinarySearchTree is full");
+        }
+        if (used_ == capacity_){
+            grow(size_t(capacity_) + 1);
+        }
+        index = used_;
+    }
+
+    IndexNode<Key, Value>& node = at(index);
+    uint32_t nextFree = node.left_;
+    new (&node.item_) std::pair<const Key, Value>(key, value);
+    if (index == freeList_){
+        freeList_ = nextFree;
+    }
+    else{
+        ++used_;
+    }
+    node.parent_ = parent;
+    node.left_ = NIL;
+    node.right_ = NIL;
+    node.balance_ = 0;
+    ++count_;
+    return index;
+}
+
+/**
+* Destroys a node's item and puts its slot on the free list.
+*/
+template<typename Key, typename Value>
+void IndexedBinarySearchTree<Key, Value>::destroyNode(uint32_t index)
+{
+    IndexNode<Key, Value>& node = at(index);
+    node.item_.~pair();
+    node.parent_ = INDEXBST_FREE_SLOT;
+    node.left_ = freeList_;
+    freeList_ = index;
+    --count_;
+}
+
+/**
+* Runs the destructor of every live item with one linear sweep
+* over the array instead of a tree walk.
+*/
+template<typename Key, typename Value>
+void IndexedBinarySearchTree<Key, Value>::destroyAll()
+{
+    if (std::is_trivially_destructible<Key>::value &&
+        std::is_trivially_destructible<Value>::value){
+        return;
+    }
+    for (uint32_t i = 0; i < used_ && count_ != 0; ++i){
+        if (at(i).parent_ != INDEXBST_FREE_SLOT){
+            at(i).item_.~pair();
+            at(i).parent_ = INDEXBST_FREE_SLOT;
+            --count_;
+        }
+    }
+}
+
+/**
+* Reallocates the node array with room for at least minCapacity
+* nodes, moving the live items across. Links are indices, so
+* nothing else has to change.
+*/
+template<typename Key, typename Value>
+void IndexedBinarySearchTree<Key, Value>::grow(size_t minCapacity)
+{
+    size_t capacity = capacity_ == 0 ? 16 : size_t(capacity_) * 2;
+    if (capacity < minCapacity) capacity = minCapacity;
+    if (capacity > MAX_NODES) capacity = MAX_NODES;
+    if (capacity < minCapacity){
+        throw std::length_error("IndexedBinarySearchTree is full");
+    }
+
+    IndexNode<Key, Value>* nodes = static_cast<IndexNode<Key, Value>*>(
+        ::operator new(capacity * sizeof(IndexNode<Key, Value>)));
+
+    if (std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value){
+        if (used_ != 0){
+            std::memcpy(static_cast<void*>(nodes), nodes_, sizeof(IndexNode<Key, Value>) * used_);
+        }
+    }
+    else{
+        for (uint32_t i = 0; i < used_; ++i){
+            IndexNode<Key, Value>& from = at(i);
+            if (from.parent_ != INDEXBST_FREE_SLOT){
+                //the key is const, so it is copied; the value is moved
+                new (&nodes[i].item_) std::pair<const Key, Value>(
+                    from.item_.first, std::move(from.item_.second));
+                from.item_.~pair();
+            }
+            nodes[i].parent_ = from.parent_;
+            nodes[i].left_ = from.left_;
+            nodes[i].right_ = from.right_;
+            nodes[i].balance_ = from.balance_;
+        }
+    }
+
+    ::operator delete(nodes_);
+    nodes_ = nodes;
+    capacity_ = uint32_t(capacity);
+}
+
+/*
+----------------------------------------------------------
+End implementations for the IndexedBinarySearchTree class.
+----------------------------------------------------------
+*/
+
+/**
+* An AVL tree over index-linked nodes. Insert and remove follow
+* AVLTree exactly, with indices in place of node pointers.
+*/
+template <class Key, class Value>
+class IndexedAVLTree : public IndexedBinarySearchTree<Key, Value>
+{
+public:
+    virtual void insert(const std::pair<const Key, Value> &new_item);
+    virtual void remove(const Key& key);
+protected:
+    static const uint32_t NIL = IndexedBinarySearchTree<Key, Value>::NIL;
+
+    void nodeSwap(uint32_t n1, uint32_t n2);
+    void rotateLeft(uint32_t upperNode);
+    void rotateRight(uint32_t upperNode);
+};
+
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::rotateLeft(uint32_t upperNode)
+{
+    uint32_t rightChild = this->at(upperNode).right_;
+
+    //right child's left tree moves to the right of upperNode
+    uint32_t leftNodeOfRightChild = this->at(rightChild).left_;
+    this->at(upperNode).right_ = leftNodeOfRightChild;
+    if (leftNodeOfRightChild != NIL){
+        this->at(leftNodeOfRightChild).parent_ = upperNode;
+    }
+
+    //right child takes the place of upperNode
+    uint32_t prevParent = this->at(upperNode).parent_;
+    this->at(rightChild).parent_ = prevParent;
+    if (prevParent == NIL){
+        this->root_ = rightChild;
+    }
+    else if (this->at(prevParent).left_ == upperNode){
+        this->at(prevParent).left_ = rightChild;
+    }
+    else{
+        this->at(prevParent).right_ = rightChild;
+    }
+
+    //upperNode goes to the left of right child
+    this->at(rightChild).left_ = upperNode;
+    this->at(upperNode).parent_ = rightChild;
+}
+
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::rotateRight(uint32_t upperNode)
+{
+    uint32_t leftChild = this->at(upperNode).left_;
+
+    //left child's right tree moves to the left of upperNode
+    uint32_t rightNodeOfLeftChild = this->at(leftChild).right_;
+    this->at(upperNode).left_ = rightNodeOfLeftChild;
+    if (rightNodeOfLeftChild != NIL){
+        this->at(rightNodeOfLeftChild).parent_ = upperNode;
+    }
+
+    //left child takes the place of upperNode
+    uint32_t prevParent = this->at(upperNode).parent_;
+    this->at(leftChild).parent_ = prevParent;
+    if (prevParent == NIL){
+        this->root_ = leftChild;
+    }
+    else if (this->at(prevParent).left_ == upperNode){
+        this->at(prevParent).left_ = leftChild;
+    }
+    else{
+        this->at(prevParent).right_ = leftChild;
+    }
+
+    //upperNode goes to the right of left child
+    this->at(leftChild).right_ = upperNode;
+    this->at(upperNode).parent_ = leftChild;
+}
+
+/**
+* Inserts the item and rebalances on the way back up, or overwrites the
+* value if the key is already in the tree.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
+{
+    const Key& key = new_item.first;
+
+    //Case 1: tree is empty
+    if (this->root_ == NIL){
+        this->root_ = this->createNode(key, new_item.second, NIL);
+        return;
+    }
+
+    //Case 2: find where to insert the item
+    uint32_t curr = this->root_;
+    uint32_t aboveNode = NIL;
+    bool goLeft = false;
+    while (curr != NIL){
+        aboveNode = curr;
+        if (key < this->at(curr).item_.first){
+            curr = this->at(curr).left_;
+            goLeft = true;
+        }
+        else if (this->at(curr).item_.first < key){
+            curr = this->at(curr).right_;
+            goLeft = false;
+        }
+        else{
+            this->at(curr).item_.second = new_item.second;
+            return;
+        }
+    }
+
+    uint32_t newNode = this->createNode(key, new_item.second, aboveNode);
+    if (goLeft){
+        this->at(aboveNode).left_ = newNode;
+    }
+    else{
+        this->at(aboveNode).right_ = newNode;
+    }
+
+    //walk up updating balances (left height - right height) until
+    //a node becomes balanced or a rotation fixes the height
+    uint32_t parent = aboveNode;
+    while (parent != NIL){
+        IndexNode<Key, Value>& p = this->at(parent);
+        p.balance_ += (p.left_ == newNode) ? 1 : -1;
+
+        if (p.balance_ == 2){
+            uint32_t leftChild = p.left_;
+
+            //left-left: one right rotation
+            if (this->at(leftChild).balance_ >= 1){
+                rotateRight(parent);
+                this->at(parent).balance_ = 0;
+                this->at(leftChild).balance_ = 0;
+            }
+            //left-right: rotate left on left child, then right on parent
+            else{
+                uint32_t grandChild = this->at(leftChild).right_;
+                int8_t grandBalance = this->at(grandChild).balance_;
+                rotateLeft(leftChild);
+                rotateRight(parent);
+                this->at(leftChild).balance_ = grandBalance == -1 ? 1 : 0;
+                this->at(parent).balance_ = grandBalance == 1 ? -1 : 0;
+                this->at(grandChild).balance_ = 0;
+            }
+            break;
+        }
+        else if (p.balance_ == -2){
+            uint32_t rightChild = p.right_;
+
+            //right-right: one left rotation
+            if (this->at(rightChild).balance_ <= -1){
+                rotateLeft(parent);
+                this->at(parent).balance_ = 0;
+                this->at(rightChild).balance_ = 0;
+            }
+            //right-left: rotate right on right child, then left on parent
+            else{
+                uint32_t grandChild = this->at(rightChild).left_;
+                int8_t grandBalance = this->at(grandChild).balance_;
+                rotateRight(rightChild);
+                rotateLeft(parent);
+                this->at(rightChild).balance_ = grandBalance == 1 ? -1 : 0;
+                this->at(parent).balance_ = grandBalance == -1 ? 1 : 0;
+                this->at(grandChild).balance_ = 0;
+            }
+            break;
+        }
+        else if (p.balance_ == 0){
+            break;
+        }
+
+        newNode = parent;
+        parent = p.parent_;
+    }
+}
+
+/**
+* Removes key, if present, swapping a node with two children with its
+* predecessor first, and rebalances on the way back up.
+*/
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::remove(const Key& key)
+{
+    uint32_t curr = this->internalFind(key);
+    if (curr == NIL){
+        return;
+    }
+
+    //node has 2 children: swap with the predecessor
+    if (this->at(curr).left_ != NIL && this->at(curr).right_ != NIL){
+        nodeSwap(curr, this->predecessor(curr));
+    }
+
+    //which side of the parent loses height: -1 for left, 1 for right
+    uint32_t aboveNode = this->at(curr).parent_;
+    int sideRemoved = 0;
+    if (aboveNode != NIL){
+        sideRemoved = (this->at(aboveNode).left_ == curr) ? -1 : 1;
+    }
+
+    //splice out curr, which has at most one child now
+    uint32_t childNode = this->at(curr).left_ != NIL ? this->at(curr).left_ : this->at(curr).right_;
+    if (childNode != NIL){
+        this->at(childNode).parent_ = aboveNode;
+    }
+    if (aboveNode == NIL){
+        this->root_ = childNode;
+    }
+    else if (sideRemoved == -1){
+        this->at(aboveNode).left_ = childNode;
+    }
+    else{
+        this->at(aboveNode).right_ = childNode;
+    }
+    this->destroyNode(curr);
+
+    //walk up rebalancing until the height of a subtree stops shrinking
+    uint32_t node = aboveNode;
+    while (node != NIL){
+        uint32_t nodesParent = this->at(node).parent_;
+        int nextSideRemoved = 0;
+        if (nodesParent != NIL){
+            nextSideRemoved = (this->at(nodesParent).left_ == node) ? -1 : 1;
+        }
+
+        bool goUp = false;
+        int newBF = this->at(node).balance_ + sideRemoved;
+
+        if (newBF == -2){
+            uint32_t rightChild = this->at(node).right_;
+            int8_t childBalance = this->at(rightChild).balance_;
+            if (childBalance == -1){
+                rotateLeft(node);
+                this->at(node).balance_ = 0;
+                this->at(rightChild).balance_ = 0;
+                goUp = true;
+            }
+            else if (childBalance == 0){
+                rotateLeft(node);
+                this->at(node).balance_ = -1;
+                this->at(rightChild).balance_ = 1;
+            }
+            else{
+                uint32_t grandChild = this->at(rightChild).left_;
+                int8_t grandBalance = this->at(grandChild).balance_;
+                rotateRight(rightChild);
+                rotateLeft(node);
+                this->at(node).balance_ = grandBalance == -1 ? 1 : 0;
+                this->at(rightChild).balance_ = grandBalance == 1 ? -1 : 0;
+                this->at(grandChild).balance_ = 0;
+                goUp = true;
+            }
+        }
+        else if (newBF == 2){
+            uint32_t leftChild = this->at(node).left_;
+            int8_t childBalance = this->at(leftChild).balance_;
+            if (childBalance == 1){
+                rotateRight(node);
+                this->at(node).balance_ = 0;
+                this->at(leftChild).balance_ = 0;
+                goUp = true;
+            }
+            else if (childBalance == 0){
+                rotateRight(node);
+                this->at(node).balance_ = 1;
+                this->at(leftChild).balance_ = -1;
+            }
+            else{
+                uint32_t grandChild = this->at(leftChild).right_;
+                int8_t grandBalance = this->at(grandChild).balance_;
+                rotateLeft(leftChild);
+                rotateRight(node);
+                this->at(node).balance_ = grandBalance == 1 ? -1 : 0;
+                this->at(leftChild).balance_ = grandBalance == -1 ? 1 : 0;
+                this->at(grandChild).balance_ = 0;
+                goUp = true;
+            }
+        }
+        else{
+            //-1/1 means the height didn't change; 0 means it shrank
+            this->at(node).balance_ = int8_t(newBF);
+            goUp = (newBF == 0);
+        }
+
+        if (!goUp){
+            break;
+        }
+        node = nodesParent;
+        sideRemoved = nextSideRemoved;
+    }
+}
+
+template<class Key, class Value>
+void IndexedAVLTree<Key, Value>::nodeSwap(uint32_t n1, uint32_t n2)
+{
+    IndexedBinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    std::swap(this->at(n1).balance_, this->at(n2).balance_);
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef KEY_COMPARE_H
+#define KEY_COMPARE_H
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+/**
+* Tells whether a comparator offers a three-way compare(a, b) member,
+* returning a negative number, zero or a positive number as a is less
+* than, equivalent to or greater than b. The search trees use it to
+* settle each node with one call instead of two calls to operator().
+*/
+template<typename Compare, typename A, typename B>
+class HasThreeWayCompare
+{
+    template<typename C>
+    static auto test(int) -> decltype(std::declval<const C&>().compare(std::declval<const A&>(),
+                                                                       std::declval<const B&>()),
+                                      std::true_type());
+    template<typename C>
+    static std::false_type test(...);
+
+public:
+    static const bool value = decltype(test<Compare>(0))::value;
+};
+
+/**
+* Tells whether Compare is std::less or std::greater on a built-in type,
+* under which two keys are equivalent exactly when they are ==.
+*/
+template<typename Compare, typename A, typename B>
+struct IsBuiltinOrder : std::false_type
+{
+};
+
+template<typename T>
+struct IsBuiltinOrder<std::less<T>, T, T> :
+    std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_pointer<T>::value>
+{
+};
+
+template<typename T>
+struct IsBuiltinOrder<std::greater<T>, T, T> :
+    std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_pointer<T>::value>
+{
+};
+
+/**
+* Where a key falls relative to another: before it, or equivalent to it
+* (or, if neither, after it).
+*/
+struct KeyOrder
+{
+    bool less;
+    bool equivalent;
+};
+
+// How orderKeys settles equivalence for a given comparator
+struct ThreeWayOrderTag { };
+struct BuiltinOrderTag { };
+struct LessOrderTag { };
+
+template<typename Compare, typename A, typename B>
+KeyOrder orderKeys(const Compare& comp, const A& a, const B& b, ThreeWayOrderTag)
+{
+    int order = comp.compare(a, b);
+    KeyOrder result = { order < 0, order == 0 };
+    return result;
+}
+
+//a plain == keeps the equality test off the path that picks the next
+//child, which a search over integer keys is bound by
+template<typename Compare, typename A, typename B>
+KeyOrder orderKeys(const Compare& comp, const A& a, const B& b, BuiltinOrderTag)
+{
+    KeyOrder result = { comp(a, b), a == b };
+    return result;
+}
+
+template<typename Compare, typename A, typename B>
+KeyOrder orderKeys(const Compare& comp, const A& a, const B& b, LessOrderTag)
+{
+    bool less = comp(a, b);
+    KeyOrder result = { less, less == comp(b, a) };
+    return result;
+}
+
+/**
+* Orders a against b through comp: with one call to its compare member
+* if it has one, with one less-than and an == for built-in keys under
+* std::less or std::greater, and with two less-than calls otherwise.
+*/
+template<typename Compare, typename A, typename B>
+KeyOrder orderKeys(const Compare& comp, const A& a, const B& b)
+{
+    typedef typename std::conditional<HasThreeWayCompare<Compare, A, B>::value, ThreeWayOrderTag,
+        typename std::conditional<IsBuiltinOrder<Compare, A, B>::value, BuiltinOrderTag,
+                                  LessOrderTag>::type>::type Tag;
+    return orderKeys(comp, a, b, Tag());
+}
+
+/**
+* A transparent comparator for keys with a three-way compare member of
+* their own, such as std::string, whose compare is a single memcmp.
+* Being transparent, it also lets the trees look a std::string key up
+* by a const char* or any other type the key's compare accepts, without
+* building a temporary key.
+*/
+struct ThreeWayCompare
+{
+    typedef void is_transparent;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return compare(a, b) < 0;
+    }
+
+    template<typename A, typename B>
+    auto compare(const A& a, const B& b) const -> decltype(int(a.compare(b)))
+    {
+        return a.compare(b);
+    }
+
+    //for a key on the right only, e.g. a const char* against a std::string
+    template<typename A, typename B>
+    auto compare(const A& a, const B& b) const
+        -> typename std::enable_if<!std::is_class<A>::value, decltype(int(b.compare(a)))>::type
+    {
+        return -b.compare(a);
+    }
+};
+
+#endif
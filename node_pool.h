@@ -0,0 +1,351 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <utility>
+#include <memory>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/**
+* A slab allocator for fixed-size tree nodes.
+*
+* Memory is requested from the system in large slabs and carved into
+* slots of a single size. Freed slots go onto an intrusive free list and
+* are handed out again before the slab is grown, so insert/remove churn
+* does not touch malloc at all. release() gives every slab back in one go,
+* which lets a tree drop all of its nodes without visiting them.
+*
+* The pool only hands out raw memory; constructing and destroying the
+* nodes that live in it is up to the owning tree.
+*
+* Trees that move nodes between each other (split, join) must share a
+* pool, since a node's slot is freed to whichever pool its current tree
+* uses. merge() combines two pools: the slabs of one are handed to the
+* other, and the emptied pool is left forwarding to the survivor so that
+* any other tree still holding it finds the live pool through resolve().
+*/
+class NodePool
+{
+public:
+    NodePool(size_t slotSize, size_t slotAlign);
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* slot);
+    void release();
+
+    void setHugePages(bool enable);
+    bool hugePages() const;
+
+    size_t slotSize() const;
+    size_t slotAlign() const;
+    size_t liveSlots() const;
+    size_t slabCount() const;
+    size_t reservedBytes() const;
+
+    static NodePool& resolve(std::shared_ptr<NodePool>& pool);
+    static void merge(std::shared_ptr<NodePool>& into, std::shared_ptr<NodePool>& from);
+
+private:
+    // Not copyable: slots are referenced by raw pointers from the tree
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    struct Slab
+    {
+        char* memory;
+        size_t bytes;
+        bool mapped;
+    };
+
+    void grow();
+    static void freeSlab(const Slab& slab);
+
+    size_t slotSize_;
+    size_t slotAlign_;
+    bool hugePages_;
+    FreeSlot* freeList_;
+    FreeSlot* freeTail_;
+    char* bumpCurr_;
+    char* bumpEnd_;
+    size_t nextSlabBytes_;
+    size_t live_;
+    size_t reserved_;
+    std::vector<Slab> slabs_;
+    // Set once this pool has been merged into another one
+    std::shared_ptr<NodePool> forward_;
+};
+
+// Slabs start small so tiny trees stay tiny, and double up to this size
+#define NODE_POOL_MIN_SLAB_BYTES (4 * 1024)
+#define NODE_POOL_MAX_SLAB_BYTES (1024 * 1024)
+// Size (and alignment) of a transparent huge page on x86-64/aarch64
+#define NODE_POOL_HUGE_PAGE_BYTES (2 * 1024 * 1024)
+
+/*
+  -------------------------------------------
+  Begin implementations for the NodePool class.
+  -------------------------------------------
+*/
+
+/**
+* Creates an empty pool for slots of the given size and alignment.
+* Slots are at least large enough to hold a free-list link.
+*/
+inline NodePool::NodePool(size_t slotSize, size_t slotAlign) :
+    hugePages_(false),
+    freeList_(NULL),
+    freeTail_(NULL),
+    bumpCurr_(NULL),
+    bumpEnd_(NULL),
+    nextSlabBytes_(NODE_POOL_MIN_SLAB_BYTES),
+    live_(0),
+    reserved_(0)
+{
+    if(slotSize < sizeof(FreeSlot)) slotSize = sizeof(FreeSlot);
+    if(slotAlign < alignof(FreeSlot)) slotAlign = alignof(FreeSlot);
+    slotSize_ = (slotSize + slotAlign - 1) / slotAlign * slotAlign;
+    slotAlign_ = slotAlign;
+}
+
+/**
+* Returns every slab to the system.
+*/
+inline NodePool::~NodePool()
+{
+    release();
+}
+
+/**
+* Returns an uninitialized slot, reusing a freed one if there is any.
+*/
+inline void* NodePool::allocate()
+{
+    if(freeList_ != NULL){
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        ++live_;
+        return slot;
+    }
+    if(bumpCurr_ == bumpEnd_){
+        grow();
+    }
+    void* slot = bumpCurr_;
+    bumpCurr_ += slotSize_;
+    ++live_;
+    return slot;
+}
+
+/**
+* Puts a slot back on the free list. The object in it must already
+* have been destroyed.
+*/
+inline void NodePool::deallocate(void* slot)
+{
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    if(freeList_ == NULL) freeTail_ = freed;
+    freed->next = freeList_;
+    freeList_ = freed;
+    --live_;
+}
+
+/**
+* Gives all slabs back at once, invalidating every slot handed out so far.
+* Objects still living in the pool are not destroyed.
+*/
+inline void NodePool::release()
+{
+    for(size_t i = 0; i < slabs_.size(); ++i){
+        freeSlab(slabs_[i]);
+    }
+    slabs_.clear();
+    freeList_ = NULL;
+    freeTail_ = NULL;
+    bumpCurr_ = NULL;
+    bumpEnd_ = NULL;
+    nextSlabBytes_ = NODE_POOL_MIN_SLAB_BYTES;
+    live_ = 0;
+    reserved_ = 0;
+}
+
+/**
+* Requests that future slabs be backed by transparent huge pages.
+* Has no effect on slabs already allocated, or off Linux.
+*/
+inline void NodePool::setHugePages(bool enable)
+{
+    hugePages_ = enable;
+}
+
+inline bool NodePool::hugePages() const
+{
+    return hugePages_;
+}
+
+inline size_t NodePool::slotSize() const
+{
+    return slotSize_;
+}
+
+inline size_t NodePool::slotAlign() const
+{
+    return slotAlign_;
+}
+
+/**
+* Number of slots currently handed out.
+*/
+inline size_t NodePool::liveSlots() const
+{
+    return live_;
+}
+
+/**
+* Number of slabs currently held, i.e. calls made to the system allocator.
+*/
+inline size_t NodePool::slabCount() const
+{
+    return slabs_.size();
+}
+
+/**
+* Total bytes of slab memory currently held, live or free.
+*/
+inline size_t NodePool::reservedBytes() const
+{
+    return reserved_;
+}
+
+/**
+* Follows a pool handle to the pool that currently owns its slabs,
+* updating the handle on the way so the next lookup is direct.
+*/
+inline NodePool& NodePool::resolve(std::shared_ptr<NodePool>& pool)
+{
+    while(pool->forward_){
+        pool = pool->forward_;
+    }
+    return *pool;
+}
+
+/**
+* Makes two handles share one pool. The slabs, free slots and counters
+* of from's pool move into into's pool, which from's pool then forwards
+* to, and both handles are pointed at the survivor. Costs O(slabs), not
+* O(slots); the unused tail of from's current slab is not reused until
+* the pool is released.
+*/
+inline void NodePool::merge(std::shared_ptr<NodePool>& into, std::shared_ptr<NodePool>& from)
+{
+    NodePool& survivor = resolve(into);
+    NodePool& merged = resolve(from);
+    if(&survivor == &merged) return;
+
+    survivor.slabs_.reserve(survivor.slabs_.size() + merged.slabs_.size());
+    survivor.slabs_.insert(survivor.slabs_.end(), merged.slabs_.begin(), merged.slabs_.end());
+    merged.slabs_.clear();
+    if(merged.freeList_ != NULL){
+        if(survivor.freeList_ == NULL) survivor.freeTail_ = merged.freeTail_;
+        merged.freeTail_->next = survivor.freeList_;
+        survivor.freeList_ = merged.freeList_;
+    }
+    survivor.live_ += merged.live_;
+    survivor.reserved_ += merged.reserved_;
+    survivor.hugePages_ = survivor.hugePages_ || merged.hugePages_;
+
+    merged.freeList_ = NULL;
+    merged.freeTail_ = NULL;
+    merged.bumpCurr_ = NULL;
+    merged.bumpEnd_ = NULL;
+    merged.live_ = 0;
+    merged.reserved_ = 0;
+    merged.forward_ = into;
+    from = into;
+}
+
+/**
+* Allocates a new slab and points the bump allocator at it.
+*/
+inline void NodePool::grow()
+{
+    Slab slab;
+    slab.memory = NULL;
+    slab.bytes = nextSlabBytes_;
+    slab.mapped = false;
+    if(slab.bytes < slotSize_) slab.bytes = slotSize_;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if(hugePages_){
+        // over-allocate so the slab can be trimmed to a huge page boundary
+        size_t bytes = (slab.bytes + NODE_POOL_HUGE_PAGE_BYTES - 1)
+            / NODE_POOL_HUGE_PAGE_BYTES * NODE_POOL_HUGE_PAGE_BYTES;
+        size_t mapBytes = bytes + NODE_POOL_HUGE_PAGE_BYTES;
+        void* p = mmap(NULL, mapBytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p != MAP_FAILED){
+            char* base = static_cast<char*>(p);
+            size_t misalign = reinterpret_cast<size_t>(base) % NODE_POOL_HUGE_PAGE_BYTES;
+            size_t head = misalign == 0 ? 0 : NODE_POOL_HUGE_PAGE_BYTES - misalign;
+            if(head != 0) munmap(base, head);
+            if(mapBytes - head - bytes != 0) munmap(base + head + bytes, mapBytes - head - bytes);
+            madvise(base + head, bytes, MADV_HUGEPAGE);
+            slab.memory = base + head;
+            slab.bytes = bytes;
+            slab.mapped = true;
+        }
+    }
+#endif
+
+    // operator new only promises max_align_t, so leave room to align
+    // the first slot of a more strictly aligned node by hand
+    size_t head = 0;
+    if(slab.memory == NULL){
+        if(slotAlign_ > alignof(std::max_align_t)) slab.bytes += slotAlign_;
+        slab.memory = static_cast<char*>(::operator new(slab.bytes));
+        size_t misalign = reinterpret_cast<size_t>(slab.memory) % slotAlign_;
+        head = misalign == 0 ? 0 : slotAlign_ - misalign;
+    }
+
+    // make sure the bookkeeping can't fail after the slab is live
+    try {
+        slabs_.push_back(slab);
+    }
+    catch(...) {
+        freeSlab(slab);
+        throw;
+    }
+
+    reserved_ += slab.bytes;
+    bumpCurr_ = slab.memory + head;
+    bumpEnd_ = bumpCurr_ + (slab.bytes - head) / slotSize_ * slotSize_;
+    if(nextSlabBytes_ < NODE_POOL_MAX_SLAB_BYTES) nextSlabBytes_ *= 2;
+}
+
+inline void NodePool::freeSlab(const Slab& slab)
+{
+#ifdef __linux__
+    if(slab.mapped){
+        munmap(slab.memory, slab.bytes);
+        return;
+    }
+#endif
+    ::operator delete(slab.memory);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the NodePool class.
+  -----------------------------------------
+*/
+
+#endif
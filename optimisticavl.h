@@ -0,0 +1,1360 @@
+#ifndef OPTIMISTICAVL_H
+#define OPTIMISTICAVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "node_pool.h"
+#include "key_compare.h"
+#include "epoch_reclaimer.h"
+
+// Retired nodes and values a handle keeps before it passes them on, and
+// node slots it takes from the tree's pool at a time
+#define OPTIMISTIC_RETIRE_BATCH 64
+#define OPTIMISTIC_SLOT_BATCH 64
+// Times a search re-reads a shrinking node's version before it blocks
+#define OPTIMISTIC_SPIN_COUNT 100
+
+/**
+* A one-byte lock for each node, where a std::mutex would double the
+* node's size. A thread that finds it held spins briefly, then yields,
+* so that it gives way on an oversubscribed machine.
+*/
+class OptimisticAVLLock
+{
+public:
+    OptimisticAVLLock() : locked_(false) { }
+
+    void lock()
+    {
+        int spins = 0;
+        while (locked_.exchange(true, std::memory_order_acquire)){
+            while (locked_.load(std::memory_order_relaxed)){
+                if (++spins > OPTIMISTIC_SPIN_COUNT){
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+    void unlock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked_;
+};
+
+/**
+* The links and key of an OptimisticAVLTree node, and the whole of the
+* tree's root holder, which has no key. Every field that a search reads
+* without the lock is atomic; they only change with the lock held. The
+* fields a search reads at every level come first, to share a cache line.
+*/
+template <typename Key, typename Value>
+struct OptimisticAVLLink
+{
+    // UNLINKED, SHRINKING and a count of finished shrinks, see below
+    std::atomic<uint64_t> version_;
+    std::atomic<OptimisticAVLLink*> left_;
+    std::atomic<OptimisticAVLLink*> right_;
+    // Constructed by OptimisticAVLNode; never in the root holder
+    typename std::aligned_storage<sizeof(Key), alignof(Key)>::type key_;
+    // NULL in a routing node: one whose key was removed while it had two
+    // children, kept to route searches until it can be unlinked
+    std::atomic<Value*> value_;
+    std::atomic<OptimisticAVLLink*> parent_;
+    std::atomic<int> height_;
+    OptimisticAVLLock lock_;
+
+    explicit OptimisticAVLLink(OptimisticAVLLink* parent) :
+        version_(0), left_(nullptr), right_(nullptr), value_(nullptr), parent_(parent), height_(1) { }
+
+    std::atomic<OptimisticAVLLink*>& child(int dir)
+    {
+        return dir < 0 ? left_ : right_;
+    }
+};
+
+/**
+* A node, with its key and the value it was inserted with, which stays
+* in the node until the node is freed; a value that replaces it is
+* allocated on its own.
+*/
+template <typename Key, typename Value>
+struct OptimisticAVLNode : public OptimisticAVLLink<Key, Value>
+{
+    Value initial_;
+
+    OptimisticAVLNode(const Key& key, const Value& value, OptimisticAVLLink<Key, Value>* parent) :
+        OptimisticAVLLink<Key, Value>(parent), initial_(value)
+    {
+        new (&this->key_) Key(key);
+        this->value_.store(&initial_);
+    }
+    ~OptimisticAVLNode()
+    {
+        reinterpret_cast<Key*>(&this->key_)->~Key();
+    }
+};
+
+/**
+* An AVL tree that any number of threads can search and update at once,
+* after Bronson, Casper, Chafi and Olukotun, "A Practical Concurrent
+* Binary Search Tree" (PPoPP 2010).
+*
+* Searches take no locks. Each node carries a version that a rotation
+* marks as shrinking before it moves the node down and bumps when it is
+* done; a search reads a child, then checks that its node's version has
+* not changed since it arrived, so a key can never be missed because a
+* rotation moved it out of the subtree being searched. Instead the
+* search steps back to the parent, hand over hand, and tries again from
+* there. Updates lock only the nodes they change, parents before
+* children: an insert locks the node it links the new leaf under, and a
+* remove of a node with two children just clears its value, leaving a
+* routing node. Afterwards the updater walks up fixing heights and
+* rotating, a few locks at a time, with the same height and balance
+* rules as AVLTree; the tree is strictly balanced again once the
+* updates stop.
+*
+* Nodes that are unlinked, and values that are replaced or removed, may
+* still be in use by a search on another thread. They go to an
+* EpochReclaimer and are freed once every thread has moved past them.
+* So every thread that uses the tree does so through a Handle of its
+* own, and all handles must be gone before the tree is destroyed.
+*
+* insert, remove and find are linearizable. size, isBalanced and forEach
+* read the tree without synchronization and are only for when no thread
+* is updating it.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class OptimisticAVLTree
+{
+public:
+    OptimisticAVLTree();
+    explicit OptimisticAVLTree(const Compare& comp);
+    ~OptimisticAVLTree();
+
+    typedef OptimisticAVLLink<Key, Value> Link;
+    typedef OptimisticAVLNode<Key, Value> Node;
+
+    /**
+    * A thread's access to the tree. Not to be shared between threads.
+    */
+    class Handle
+    {
+    public:
+        explicit Handle(OptimisticAVLTree<Key, Value, Compare>& tree);
+        ~Handle();
+
+        bool find(const Key& key, Value& value);
+        bool insert(const std::pair<const Key, Value>& keyValuePair);
+        bool remove(const Key& key);
+
+    private:
+        friend class OptimisticAVLTree<Key, Value, Compare>;
+        // Not copyable: a handle owns a slot in the tree's reclaimer
+        Handle(const Handle&);
+        Handle& operator=(const Handle&);
+
+        // Keeps the handle pinned for the length of one operation
+        struct Pin
+        {
+            explicit Pin(Handle& handle);
+            ~Pin();
+            Handle& handle_;
+        };
+
+        struct Garbage
+        {
+            void (*reclaim)(void* tree, void* garbage);
+            void* garbage;
+        };
+
+        void retire(void (*reclaim)(void* tree, void* garbage), void* garbage);
+        void flush();
+        void revisit(Link* node);
+        void* takeSlot();
+        void returnSlot(void* slot);
+
+        OptimisticAVLTree<Key, Value, Compare>* tree_;
+        size_t slot_;
+        std::vector<Garbage> garbage_;
+        // Node slots taken from the tree's pool and not used yet
+        std::vector<void*> slots_;
+        // Parents of this walk's rotations, whose heights are fixed last
+        std::vector<Link*> revisits_;
+    };
+
+    // Only while no thread is updating the tree
+    size_t size() const;
+    bool isBalanced() const;
+    template<typename F>
+    void forEach(F f) const;
+
+protected:
+    enum Outcome { RETRY, FOUND, ABSENT, INSERTED, UPDATED, REMOVED };
+
+    Outcome attemptGet(const Key& key, Link* node, int dir, uint64_t nodeVersion, Value& value);
+    Outcome attemptPut(const std::pair<const Key, Value>& item, Link* node, int dir, uint64_t nodeVersion,
+                       Handle& handle);
+    Outcome attemptInsert(const std::pair<const Key, Value>& item, Link* node, int dir, uint64_t nodeVersion,
+                          Handle& handle);
+    Outcome attemptUpdate(Link* node, const Value& value, Handle& handle);
+    Outcome attemptRemove(const Key& key, Link* node, int dir, uint64_t nodeVersion, Handle& handle);
+    Outcome attemptRemoveNode(Link* parent, Link* node, Handle& handle);
+    bool attemptUnlink(Link* parent, Link* node);
+
+    void fixHeightAndRebalance(Link* node, Handle& handle);
+    int nodeCondition(Link* node);
+    Link* fixHeight(Link* node);
+    Link* rebalanceNode(Link* parent, Link* node, Handle& handle);
+    Link* rebalanceToRight(Link* parent, Link* node, Link* left, int rightHeight);
+    Link* rebalanceToLeft(Link* parent, Link* node, Link* right, int leftHeight);
+    Link* rotateRight(Link* parent, Link* node, Link* left, int rightHeight, int leftLeftHeight,
+                      Link* leftRight, int leftRightHeight);
+    Link* rotateLeft(Link* parent, Link* node, int leftHeight, Link* right, Link* rightLeft,
+                     int rightLeftHeight, int rightRightHeight);
+    Link* rotateRightOverLeft(Link* parent, Link* node, Link* left, int rightHeight, int leftLeftHeight,
+                              Link* leftRight, int leftRightLeftHeight);
+    Link* rotateLeftOverRight(Link* parent, Link* node, int leftHeight, Link* right, int rightRightHeight,
+                              Link* rightLeft, int rightLeftRightHeight);
+
+    static void waitUntilNotChanging(Link* node);
+    static int heightOf(Link* node);
+    static bool canUnlink(Link* node);
+    static const Key& keyOf(Link* node);
+    int checkBalance(Link* node, bool& balanced) const;
+    template<typename F>
+    void visit(Link* node, F& f) const;
+    void destroySubtree(Link* node);
+    void destroyNode(Link* node);
+    static void retireValue(Link* node, Value* value, Handle& handle);
+    static void reclaimNode(void* tree, void* node);
+    static void reclaimValue(void* tree, void* value);
+
+    // Version bits: UNLINKED is final; SHRINKING is set while a rotation
+    // moves the node down, and clearing it carries into the count above
+    static const uint64_t UNLINKED = 1;
+    static const uint64_t SHRINKING = 2;
+    // What nodeCondition() returns other than a new height
+    static const int NOTHING_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int UNLINK_REQUIRED = -3;
+
+private:
+    // Not copyable: handles hold a pointer to the tree
+    OptimisticAVLTree(const OptimisticAVLTree&);
+    OptimisticAVLTree& operator=(const OptimisticAVLTree&);
+
+protected:
+    // Never moves and never shrinks; the tree hangs off its right child
+    Link holder_;
+    Compare comp_;
+    // Serves node slots to handles in batches, and takes reclaimed ones back
+    NodePool pool_;
+    EpochReclaimer reclaimer_;
+    // The reclaimer, and the pool, take one thread at a time
+    std::mutex reclaimerLock_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the OptimisticAVLTree::Handle class.
+  -------------------------------------------
+*/
+
+/**
+* Registers the calling thread with tree; throws std::runtime_error if
+* EPOCH_MAX_READERS handles exist already.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::Handle::Handle(OptimisticAVLTree<Key, Value, Compare>& tree) :
+    tree_(&tree),
+    slot_(tree.reclaimer_.registerReader())
+{
+    garbage_.reserve(2 * OPTIMISTIC_RETIRE_BATCH);
+    slots_.reserve(OPTIMISTIC_SLOT_BATCH);
+    revisits_.reserve(64);
+}
+
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::Handle::~Handle()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(tree_->reclaimerLock_);
+        for (size_t i = 0; i < slots_.size(); ++i){
+            tree_->pool_.deallocate(slots_[i]);
+        }
+    }
+    tree_->reclaimer_.unregisterReader(slot_);
+}
+
+/**
+* Copies the value for key into value and returns true, or returns
+* false if key is missing.
+*/
+template<class Key, class Value, class Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::Handle::find(const Key& key, Value& value)
+{
+    Pin pin(*this);
+    Outcome outcome;
+    do {
+        outcome = tree_->attemptGet(key, &tree_->holder_, 1, 0, value);
+    } while (outcome == RETRY);
+    return outcome == FOUND;
+}
+
+/**
+* Inserts the item, or replaces the value of an existing key. Returns
+* true if the key was new.
+*/
+template<class Key, class Value, class Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::Handle::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Outcome outcome;
+    {
+        Pin pin(*this);
+        do {
+            outcome = tree_->attemptPut(keyValuePair, &tree_->holder_, 1, 0, *this);
+        } while (outcome == RETRY);
+    }
+    if (garbage_.size() >= OPTIMISTIC_RETIRE_BATCH){
+        flush();
+    }
+    return outcome == INSERTED;
+}
+
+/**
+* Removes key and returns true, or returns false if it was missing.
+*/
+template<class Key, class Value, class Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::Handle::remove(const Key& key)
+{
+    Outcome outcome;
+    {
+        Pin pin(*this);
+        do {
+            outcome = tree_->attemptRemove(key, &tree_->holder_, 1, 0, *this);
+        } while (outcome == RETRY);
+    }
+    if (garbage_.size() >= OPTIMISTIC_RETIRE_BATCH){
+        flush();
+    }
+    return outcome == REMOVED;
+}
+
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::Handle::Pin::Pin(Handle& handle) :
+    handle_(handle)
+{
+    handle_.tree_->reclaimer_.pin(handle_.slot_);
+}
+
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::Handle::Pin::~Pin()
+{
+    handle_.tree_->reclaimer_.unpin(handle_.slot_);
+}
+
+/**
+* Keeps something this thread unlinked until the next flush(). Holding
+* it locally spares every update a trip through the reclaimer's lock.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::Handle::retire(void (*reclaim)(void* tree, void* garbage),
+                                                            void* garbage)
+{
+    Garbage entry;
+    entry.reclaim = reclaim;
+    entry.garbage = garbage;
+    try {
+        garbage_.push_back(entry);
+    }
+    catch(...) {
+        //leaked rather than freed under a search
+    }
+}
+
+/**
+* Hands this thread's garbage to the reclaimer and frees whatever no
+* thread can reach any more. The epoch it is tagged with is no earlier
+* than the one it was unlinked in, which only delays the free.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::Handle::flush()
+{
+    std::lock_guard<std::mutex> lock(tree_->reclaimerLock_);
+    size_t queued = 0;
+    try {
+        for (; queued < garbage_.size(); ++queued){
+            tree_->reclaimer_.retire(garbage_[queued].reclaim, tree_, garbage_[queued].garbage);
+        }
+    }
+    catch(...) {
+        //the rest are leaked rather than freed under a search
+    }
+    garbage_.clear();
+    tree_->reclaimer_.advance();
+    tree_->reclaimer_.collect();
+}
+
+/**
+* Returns memory for a node, taking a batch of slots from the tree's pool
+* when this handle has run out, so that nodes are packed into the pool's
+* slabs as in AVLTree while threads seldom meet on the pool's lock.
+*/
+template<class Key, class Value, class Compare>
+void* OptimisticAVLTree<Key, Value, Compare>::Handle::takeSlot()
+{
+    if (slots_.empty()){
+        std::lock_guard<std::mutex> lock(tree_->reclaimerLock_);
+        try {
+            while (slots_.size() < OPTIMISTIC_SLOT_BATCH){
+                slots_.push_back(tree_->pool_.allocate());
+            }
+        }
+        catch(...) {
+            if (slots_.empty()){
+                throw;
+            }
+        }
+    }
+    void* slot = slots_.back();
+    slots_.pop_back();
+    return slot;
+}
+
+/**
+* Takes back a slot from takeSlot() that was not used.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::Handle::returnSlot(void* slot)
+{
+    slots_.push_back(slot);
+}
+
+/**
+* Asks for node to be looked at again once the current walk up is done.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::Handle::revisit(Link* node)
+{
+    try {
+        revisits_.push_back(node);
+    }
+    catch(...) {
+        //its height is left for a later walk to fix
+    }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the OptimisticAVLTree::Handle class.
+  -------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the OptimisticAVLTree class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::OptimisticAVLTree() :
+    holder_(nullptr),
+    comp_(),
+    pool_(sizeof(Node), alignof(Node))
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::OptimisticAVLTree(const Compare& comp) :
+    holder_(nullptr),
+    comp_(comp),
+    pool_(sizeof(Node), alignof(Node))
+{
+
+}
+
+/**
+* Frees every node and value, retired or not. No handle may be left.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLTree<Key, Value, Compare>::~OptimisticAVLTree()
+{
+    reclaimer_.collectAll();
+    destroySubtree(holder_.right_.load());
+}
+
+/**
+* Returns the number of keys. Only while no thread is updating the tree.
+*/
+template<class Key, class Value, class Compare>
+size_t OptimisticAVLTree<Key, Value, Compare>::size() const
+{
+    size_t count = 0;
+    forEach([&count](const Key&, const Value&) { ++count; });
+    return count;
+}
+
+/**
+* Returns true if every node's subtrees differ in height by at most one.
+* Only while no thread is updating the tree.
+*/
+template<class Key, class Value, class Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    bool balanced = true;
+    checkBalance(holder_.right_.load(), balanced);
+    return balanced;
+}
+
+/**
+* Calls f(key, value) for every key in order. Only while no thread is
+* updating the tree.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+void OptimisticAVLTree<Key, Value, Compare>::forEach(F f) const
+{
+    visit(holder_.right_.load(), f);
+}
+
+/**
+* Looks key up below node's child in direction dir, as long as node's
+* version is still nodeVersion. Returns RETRY as soon as it is not, for
+* the caller to look again from one level up.
+*/
+template<class Key, class Value, class Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptGet(const Key& key, Link* node, int dir, uint64_t nodeVersion,
+                                                   Value& value)
+{
+    while (true){
+        Link* child = node->child(dir).load();
+        if (node->version_.load() != nodeVersion){
+            return RETRY;
+        }
+        if (child == nullptr){
+            return ABSENT;
+        }
+        KeyOrder order = orderKeys(comp_, key, keyOf(child));
+        if (order.equivalent){
+            Value* found = child->value_.load();
+            if (found == nullptr){
+                return ABSENT;
+            }
+            value = *found;
+            return FOUND;
+        }
+        uint64_t childVersion = child->version_.load();
+        if (childVersion & SHRINKING){
+            waitUntilNotChanging(child);
+        }
+        else if (!(childVersion & UNLINKED) && child == node->child(dir).load()){
+            //the child was still node's when its version was read
+            if (node->version_.load() != nodeVersion){
+                return RETRY;
+            }
+            Outcome outcome = attemptGet(key, child, order.less ? -1 : 1, childVersion, value);
+            if (outcome != RETRY){
+                return outcome;
+            }
+        }
+    }
+}
+
+/**
+* Inserts or updates the item below node's child in direction dir, with
+* the same hand-over-hand validation as attemptGet().
+*/
+template<class Key, class Value, class Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptPut(const std::pair<const Key, Value>& item, Link* node, int dir,
+                                                   uint64_t nodeVersion, Handle& handle)
+{
+    while (true){
+        Link* child = node->child(dir).load();
+        if (node->version_.load() != nodeVersion){
+            return RETRY;
+        }
+        Outcome outcome = RETRY;
+        if (child == nullptr){
+            outcome = attemptInsert(item, node, dir, nodeVersion, handle);
+        }
+        else{
+            KeyOrder order = orderKeys(comp_, item.first, keyOf(child));
+            if (order.equivalent){
+                outcome = attemptUpdate(child, item.second, handle);
+            }
+            else{
+                uint64_t childVersion = child->version_.load();
+                if (childVersion & SHRINKING){
+                    waitUntilNotChanging(child);
+                }
+                else if (!(childVersion & UNLINKED) && child == node->child(dir).load()){
+                    if (node->version_.load() != nodeVersion){
+                        return RETRY;
+                    }
+                    outcome = attemptPut(item, child, order.less ? -1 : 1, childVersion, handle);
+                }
+            }
+        }
+        if (outcome != RETRY){
+            return outcome;
+        }
+    }
+}
+
+/**
+* Links a new leaf as node's child in direction dir, if that is still
+* empty and node is unchanged, then repairs heights above it.
+*/
+template<class Key, class Value, class Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptInsert(const std::pair<const Key, Value>& item, Link* node, int dir,
+                                                      uint64_t nodeVersion, Handle& handle)
+{
+    void* slot = handle.takeSlot();
+    {
+        std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+        if (node->version_.load() != nodeVersion || node->child(dir).load() != nullptr){
+            handle.returnSlot(slot);
+            return RETRY;
+        }
+        Node* leaf;
+        try {
+            leaf = new (slot) Node(item.first, item.second, node);
+        }
+        catch(...) {
+            handle.returnSlot(slot);
+            throw;
+        }
+        node->child(dir).store(leaf);
+    }
+    fixHeightAndRebalance(node, handle);
+    return INSERTED;
+}
+
+/**
+* Gives node a new value, unless it has been unlinked. Reviving a
+* routing node counts as an insert.
+*/
+template<class Key, class Value, class Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptUpdate(Link* node, const Value& value, Handle& handle)
+{
+    Value* replacement = new Value(value);
+    Value* previous;
+    {
+        std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+        if (node->version_.load() & UNLINKED){
+            delete replacement;
+            return RETRY;
+        }
+        previous = node->value_.exchange(replacement);
+    }
+    if (previous == nullptr){
+        return INSERTED;
+    }
+    retireValue(node, previous, handle);
+    return UPDATED;
+}
+
+/**
+* Removes key from below node's child in direction dir, with the same
+* hand-over-hand validation as attemptGet().
+*/
+template<class Key, class Value, class Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptRemove(const Key& key, Link* node, int dir, uint64_t nodeVersion,
+                                                      Handle& handle)
+{
+    while (true){
+        Link* child = node->child(dir).load();
+        if (node->version_.load() != nodeVersion){
+            return RETRY;
+        }
+        if (child == nullptr){
+            return ABSENT;
+        }
+        Outcome outcome = RETRY;
+        KeyOrder order = orderKeys(comp_, key, keyOf(child));
+        if (order.equivalent){
+            outcome = attemptRemoveNode(node, child, handle);
+        }
+        else{
+            uint64_t childVersion = child->version_.load();
+            if (childVersion & SHRINKING){
+                waitUntilNotChanging(child);
+            }
+            else if (!(childVersion & UNLINKED) && child == node->child(dir).load()){
+                if (node->version_.load() != nodeVersion){
+                    return RETRY;
+                }
+                outcome = attemptRemove(key, child, order.less ? -1 : 1, childVersion, handle);
+            }
+        }
+        if (outcome != RETRY){
+            return outcome;
+        }
+    }
+}
+
+/**
+* Removes node's key. A node with two children only loses its value and
+* stays on as a routing node; one with fewer is unlinked, with its parent
+* and itself locked, and heights are repaired from the parent up.
+*/
+template<class Key, class Value, class Compare>
+typename OptimisticAVLTree<Key, Value, Compare>::Outcome
+OptimisticAVLTree<Key, Value, Compare>::attemptRemoveNode(Link* parent, Link* node, Handle& handle)
+{
+    if (node->value_.load() == nullptr){
+        return ABSENT;
+    }
+    Value* previous;
+    if (!canUnlink(node)){
+        std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+        if ((node->version_.load() & UNLINKED) || canUnlink(node)){
+            return RETRY;
+        }
+        previous = node->value_.exchange(nullptr);
+    }
+    else{
+        {
+            std::lock_guard<OptimisticAVLLock> parentLock(parent->lock_);
+            if ((parent->version_.load() & UNLINKED) || node->parent_.load() != parent){
+                return RETRY;
+            }
+            std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+            previous = node->value_.load();
+            if (previous == nullptr){
+                return ABSENT;
+            }
+            if (!attemptUnlink(parent, node)){
+                return RETRY;
+            }
+        }
+        handle.retire(&reclaimNode, node);
+        fixHeightAndRebalance(parent, handle);
+    }
+    if (previous == nullptr){
+        return ABSENT;
+    }
+    retireValue(node, previous, handle);
+    return REMOVED;
+}
+
+/**
+* Splices node, which has at most one child, out from under parent. Both
+* must be locked. Returns false if node has moved or gained a child.
+*/
+template<class Key, class Value, class Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::attemptUnlink(Link* parent, Link* node)
+{
+    Link* parentLeft = parent->left_.load();
+    Link* parentRight = parent->right_.load();
+    if (parentLeft != node && parentRight != node){
+        return false;
+    }
+    Link* left = node->left_.load();
+    Link* right = node->right_.load();
+    if (left != nullptr && right != nullptr){
+        return false;
+    }
+    Link* splice = left != nullptr ? left : right;
+    if (parentLeft == node){
+        parent->left_.store(splice);
+    }
+    else{
+        parent->right_.store(splice);
+    }
+    if (splice != nullptr){
+        splice->parent_.store(parent);
+    }
+    node->version_.store(node->version_.load() | UNLINKED);
+    node->value_.store(nullptr);
+    return true;
+}
+
+/**
+* Walks up from node fixing heights, rotating and unlinking routing nodes
+* until nothing on the way needs it. Each step locks only the node and,
+* to rotate or unlink, its parent and the children that move.
+*
+* A rotation may first hand back a node below it that now needs fixing,
+* and the walk up from there can stop short of the rotation's parent,
+* whose height may be stale; the parent is revisited at the end.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::fixHeightAndRebalance(Link* node, Handle& handle)
+{
+    while (true){
+        int condition = NOTHING_REQUIRED;
+        if (node != nullptr && node->parent_.load() != nullptr && !(node->version_.load() & UNLINKED)){
+            condition = nodeCondition(node);
+        }
+        if (condition == NOTHING_REQUIRED){
+            if (handle.revisits_.empty()){
+                return;
+            }
+            node = handle.revisits_.back();
+            handle.revisits_.pop_back();
+            continue;
+        }
+        if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED){
+            std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+            node = fixHeight(node);
+        }
+        else{
+            Link* parent = node->parent_.load();
+            std::lock_guard<OptimisticAVLLock> parentLock(parent->lock_);
+            if (!(parent->version_.load() & UNLINKED) && node->parent_.load() == parent){
+                std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+                node = rebalanceNode(parent, node, handle);
+            }
+        }
+    }
+}
+
+/**
+* Returns what node needs: UNLINK_REQUIRED for a routing node with a
+* missing child, REBALANCE_REQUIRED, NOTHING_REQUIRED, or else the new
+* height it should have.
+*/
+template<class Key, class Value, class Compare>
+int OptimisticAVLTree<Key, Value, Compare>::nodeCondition(Link* node)
+{
+    Link* left = node->left_.load();
+    Link* right = node->right_.load();
+    if ((left == nullptr || right == nullptr) && node->value_.load() == nullptr){
+        return UNLINK_REQUIRED;
+    }
+    int height = node->height_.load();
+    int leftHeight = heightOf(left);
+    int rightHeight = heightOf(right);
+    int replacement = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+    int balance = leftHeight - rightHeight;
+    if (balance < -1 || balance > 1){
+        return REBALANCE_REQUIRED;
+    }
+    return height != replacement ? replacement : NOTHING_REQUIRED;
+}
+
+/**
+* Fixes the height of node, which must be locked, and returns the next
+* node to look at: node itself if it needs more than a height, its
+* parent if its height changed, or NULL.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::fixHeight(Link* node)
+{
+    int condition = nodeCondition(node);
+    if (condition == REBALANCE_REQUIRED || condition == UNLINK_REQUIRED){
+        return node;
+    }
+    if (condition == NOTHING_REQUIRED){
+        return nullptr;
+    }
+    node->height_.store(condition);
+    return node->parent_.load();
+}
+
+/**
+* Unlinks, rotates or fixes the height of node, with it and its parent
+* locked, and returns the next node to look at, as fixHeight() does.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rebalanceNode(Link* parent, Link* node,
+                                                                                Handle& handle)
+{
+    Link* left = node->left_.load();
+    Link* right = node->right_.load();
+    if ((left == nullptr || right == nullptr) && node->value_.load() == nullptr){
+        if (attemptUnlink(parent, node)){
+            handle.retire(&reclaimNode, node);
+            return fixHeight(parent);
+        }
+        return node;
+    }
+    int height = node->height_.load();
+    int leftHeight = heightOf(left);
+    int rightHeight = heightOf(right);
+    int replacement = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+    int balance = leftHeight - rightHeight;
+    if (balance > 1){
+        handle.revisit(parent);
+        return rebalanceToRight(parent, node, left, rightHeight);
+    }
+    if (balance < -1){
+        handle.revisit(parent);
+        return rebalanceToLeft(parent, node, right, leftHeight);
+    }
+    if (replacement != height){
+        node->height_.store(replacement);
+        return fixHeight(parent);
+    }
+    return nullptr;
+}
+
+/**
+* Rotates node's too-tall left subtree up, once or twice as AVLTree
+* would, after locking the children that move. A double rotation that
+* would leave the left child out of balance is done as two single ones.
+*
+* Unlike the paper, a double rotation goes ahead even when it leaves the
+* left child a routing node with a missing child: rotating that child
+* alone would be refused, as it is not out of balance, and the walk up
+* would stop with node still unbalanced. The rotation returns the child
+* to be unlinked instead.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rebalanceToRight(Link* parent, Link* node,
+                                                                                   Link* left, int rightHeight)
+{
+    std::lock_guard<OptimisticAVLLock> leftLock(left->lock_);
+    int leftHeight = left->height_.load();
+    if (leftHeight - rightHeight <= 1){
+        return node;
+    }
+    Link* leftRight = left->right_.load();
+    int leftLeftHeight = heightOf(left->left_.load());
+    int leftRightHeight = heightOf(leftRight);
+    if (leftLeftHeight >= leftRightHeight){
+        return rotateRight(parent, node, left, rightHeight, leftLeftHeight, leftRight, leftRightHeight);
+    }
+    {
+        std::lock_guard<OptimisticAVLLock> leftRightLock(leftRight->lock_);
+        leftRightHeight = leftRight->height_.load();
+        if (leftLeftHeight >= leftRightHeight){
+            return rotateRight(parent, node, left, rightHeight, leftLeftHeight, leftRight, leftRightHeight);
+        }
+        int leftRightLeftHeight = heightOf(leftRight->left_.load());
+        int balance = leftLeftHeight - leftRightLeftHeight;
+        if (balance >= -1 && balance <= 1){
+            return rotateRightOverLeft(parent, node, left, rightHeight, leftLeftHeight, leftRight,
+                                       leftRightLeftHeight);
+        }
+    }
+    return rebalanceToLeft(node, left, leftRight, leftLeftHeight);
+}
+
+/**
+* Mirror image of rebalanceToRight().
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rebalanceToLeft(Link* parent, Link* node,
+                                                                                  Link* right, int leftHeight)
+{
+    std::lock_guard<OptimisticAVLLock> rightLock(right->lock_);
+    int rightHeight = right->height_.load();
+    if (leftHeight - rightHeight >= -1){
+        return node;
+    }
+    Link* rightLeft = right->left_.load();
+    int rightLeftHeight = heightOf(rightLeft);
+    int rightRightHeight = heightOf(right->right_.load());
+    if (rightRightHeight >= rightLeftHeight){
+        return rotateLeft(parent, node, leftHeight, right, rightLeft, rightLeftHeight, rightRightHeight);
+    }
+    {
+        std::lock_guard<OptimisticAVLLock> rightLeftLock(rightLeft->lock_);
+        rightLeftHeight = rightLeft->height_.load();
+        if (rightRightHeight >= rightLeftHeight){
+            return rotateLeft(parent, node, leftHeight, right, rightLeft, rightLeftHeight, rightRightHeight);
+        }
+        int rightLeftRightHeight = heightOf(rightLeft->right_.load());
+        int balance = rightRightHeight - rightLeftRightHeight;
+        if (balance >= -1 && balance <= 1){
+            return rotateLeftOverRight(parent, node, leftHeight, right, rightRightHeight, rightLeft,
+                                       rightLeftRightHeight);
+        }
+    }
+    return rebalanceToRight(node, right, rightLeft, rightRightHeight);
+}
+
+/**
+* Rotates left above node, with parent, node and left locked. node is
+* marked shrinking meanwhile, so searches passing through it wait, then
+* step back. Returns the next node to look at.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rotateRight(Link* parent, Link* node, Link* left,
+                                                                              int rightHeight, int leftLeftHeight,
+                                                                              Link* leftRight, int leftRightHeight)
+{
+    uint64_t nodeVersion = node->version_.load();
+    Link* parentLeft = parent->left_.load();
+    node->version_.store(nodeVersion | SHRINKING);
+
+    node->left_.store(leftRight);
+    if (leftRight != nullptr){
+        leftRight->parent_.store(node);
+    }
+    left->right_.store(node);
+    node->parent_.store(left);
+    if (parentLeft == node){
+        parent->left_.store(left);
+    }
+    else{
+        parent->right_.store(left);
+    }
+    left->parent_.store(parent);
+
+    int nodeHeight = 1 + (leftRightHeight > rightHeight ? leftRightHeight : rightHeight);
+    node->height_.store(nodeHeight);
+    left->height_.store(1 + (leftLeftHeight > nodeHeight ? leftLeftHeight : nodeHeight));
+    node->version_.store((nodeVersion | SHRINKING) + SHRINKING);
+
+    //whatever is still out of balance is fixed next, lowest first
+    int nodeBalance = leftRightHeight - rightHeight;
+    if (nodeBalance < -1 || nodeBalance > 1){
+        return node;
+    }
+    if ((leftRight == nullptr || rightHeight == 0) && node->value_.load() == nullptr){
+        return node;
+    }
+    int leftBalance = leftLeftHeight - nodeHeight;
+    if (leftBalance < -1 || leftBalance > 1){
+        return left;
+    }
+    if (leftLeftHeight == 0 && left->value_.load() == nullptr){
+        return left;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Mirror image of rotateRight().
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rotateLeft(Link* parent, Link* node,
+                                                                             int leftHeight, Link* right,
+                                                                             Link* rightLeft, int rightLeftHeight,
+                                                                             int rightRightHeight)
+{
+    uint64_t nodeVersion = node->version_.load();
+    Link* parentLeft = parent->left_.load();
+    node->version_.store(nodeVersion | SHRINKING);
+
+    node->right_.store(rightLeft);
+    if (rightLeft != nullptr){
+        rightLeft->parent_.store(node);
+    }
+    right->left_.store(node);
+    node->parent_.store(right);
+    if (parentLeft == node){
+        parent->left_.store(right);
+    }
+    else{
+        parent->right_.store(right);
+    }
+    right->parent_.store(parent);
+
+    int nodeHeight = 1 + (leftHeight > rightLeftHeight ? leftHeight : rightLeftHeight);
+    node->height_.store(nodeHeight);
+    right->height_.store(1 + (nodeHeight > rightRightHeight ? nodeHeight : rightRightHeight));
+    node->version_.store((nodeVersion | SHRINKING) + SHRINKING);
+
+    int nodeBalance = rightLeftHeight - leftHeight;
+    if (nodeBalance < -1 || nodeBalance > 1){
+        return node;
+    }
+    if ((rightLeft == nullptr || leftHeight == 0) && node->value_.load() == nullptr){
+        return node;
+    }
+    int rightBalance = rightRightHeight - nodeHeight;
+    if (rightBalance < -1 || rightBalance > 1){
+        return right;
+    }
+    if (rightRightHeight == 0 && right->value_.load() == nullptr){
+        return right;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Rotates left's right child up over left and then over node, with all
+* four locked; node and left shrink. Returns the next node to look at,
+* left included if it is now a routing node with a missing child.
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rotateRightOverLeft(Link* parent, Link* node,
+                                                                                      Link* left, int rightHeight,
+                                                                                      int leftLeftHeight,
+                                                                                      Link* leftRight,
+                                                                                      int leftRightLeftHeight)
+{
+    uint64_t nodeVersion = node->version_.load();
+    uint64_t leftVersion = left->version_.load();
+    Link* parentLeft = parent->left_.load();
+    Link* leftRightLeft = leftRight->left_.load();
+    Link* leftRightRight = leftRight->right_.load();
+    int leftRightRightHeight = heightOf(leftRightRight);
+    node->version_.store(nodeVersion | SHRINKING);
+    left->version_.store(leftVersion | SHRINKING);
+
+    node->left_.store(leftRightRight);
+    if (leftRightRight != nullptr){
+        leftRightRight->parent_.store(node);
+    }
+    left->right_.store(leftRightLeft);
+    if (leftRightLeft != nullptr){
+        leftRightLeft->parent_.store(left);
+    }
+    leftRight->left_.store(left);
+    left->parent_.store(leftRight);
+    leftRight->right_.store(node);
+    node->parent_.store(leftRight);
+    if (parentLeft == node){
+        parent->left_.store(leftRight);
+    }
+    else{
+        parent->right_.store(leftRight);
+    }
+    leftRight->parent_.store(parent);
+
+    int nodeHeight = 1 + (leftRightRightHeight > rightHeight ? leftRightRightHeight : rightHeight);
+    node->height_.store(nodeHeight);
+    int leftHeight = 1 + (leftLeftHeight > leftRightLeftHeight ? leftLeftHeight : leftRightLeftHeight);
+    left->height_.store(leftHeight);
+    leftRight->height_.store(1 + (leftHeight > nodeHeight ? leftHeight : nodeHeight));
+    node->version_.store((nodeVersion | SHRINKING) + SHRINKING);
+    left->version_.store((leftVersion | SHRINKING) + SHRINKING);
+
+    int nodeBalance = leftRightRightHeight - rightHeight;
+    if (nodeBalance < -1 || nodeBalance > 1){
+        return node;
+    }
+    if ((leftRightRight == nullptr || rightHeight == 0) && node->value_.load() == nullptr){
+        return node;
+    }
+    if ((leftRightLeft == nullptr || leftLeftHeight == 0) && left->value_.load() == nullptr){
+        return left;
+    }
+    int topBalance = leftHeight - nodeHeight;
+    if (topBalance < -1 || topBalance > 1){
+        return leftRight;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Mirror image of rotateRightOverLeft().
+*/
+template<class Key, class Value, class Compare>
+OptimisticAVLLink<Key, Value>* OptimisticAVLTree<Key, Value, Compare>::rotateLeftOverRight(Link* parent, Link* node,
+                                                                                      int leftHeight, Link* right,
+                                                                                      int rightRightHeight,
+                                                                                      Link* rightLeft,
+                                                                                      int rightLeftRightHeight)
+{
+    uint64_t nodeVersion = node->version_.load();
+    uint64_t rightVersion = right->version_.load();
+    Link* parentLeft = parent->left_.load();
+    Link* rightLeftLeft = rightLeft->left_.load();
+    Link* rightLeftRight = rightLeft->right_.load();
+    int rightLeftLeftHeight = heightOf(rightLeftLeft);
+    node->version_.store(nodeVersion | SHRINKING);
+    right->version_.store(rightVersion | SHRINKING);
+
+    node->right_.store(rightLeftLeft);
+    if (rightLeftLeft != nullptr){
+        rightLeftLeft->parent_.store(node);
+    }
+    right->left_.store(rightLeftRight);
+    if (rightLeftRight != nullptr){
+        rightLeftRight->parent_.store(right);
+    }
+    rightLeft->right_.store(right);
+    right->parent_.store(rightLeft);
+    rightLeft->left_.store(node);
+    node->parent_.store(rightLeft);
+    if (parentLeft == node){
+        parent->left_.store(rightLeft);
+    }
+    else{
+        parent->right_.store(rightLeft);
+    }
+    rightLeft->parent_.store(parent);
+
+    int nodeHeight = 1 + (leftHeight > rightLeftLeftHeight ? leftHeight : rightLeftLeftHeight);
+    node->height_.store(nodeHeight);
+    int rightHeight = 1 + (rightLeftRightHeight > rightRightHeight ? rightLeftRightHeight : rightRightHeight);
+    right->height_.store(rightHeight);
+    rightLeft->height_.store(1 + (nodeHeight > rightHeight ? nodeHeight : rightHeight));
+    node->version_.store((nodeVersion | SHRINKING) + SHRINKING);
+    right->version_.store((rightVersion | SHRINKING) + SHRINKING);
+
+    int nodeBalance = rightLeftLeftHeight - leftHeight;
+    if (nodeBalance < -1 || nodeBalance > 1){
+        return node;
+    }
+    if ((rightLeftLeft == nullptr || leftHeight == 0) && node->value_.load() == nullptr){
+        return node;
+    }
+    if ((rightLeftRight == nullptr || rightRightHeight == 0) && right->value_.load() == nullptr){
+        return right;
+    }
+    int topBalance = rightHeight - nodeHeight;
+    if (topBalance < -1 || topBalance > 1){
+        return rightLeft;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Waits out the rotation that is moving node down: briefly by spinning,
+* then by taking the lock the rotation holds.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::waitUntilNotChanging(Link* node)
+{
+    uint64_t version = node->version_.load();
+    if (!(version & SHRINKING)){
+        return;
+    }
+    for (int i = 0; i < OPTIMISTIC_SPIN_COUNT; ++i){
+        if (node->version_.load() != version){
+            return;
+        }
+    }
+    std::lock_guard<OptimisticAVLLock> lock(node->lock_);
+}
+
+template<class Key, class Value, class Compare>
+int OptimisticAVLTree<Key, Value, Compare>::heightOf(Link* node)
+{
+    return node != nullptr ? node->height_.load() : 0;
+}
+
+template<class Key, class Value, class Compare>
+bool OptimisticAVLTree<Key, Value, Compare>::canUnlink(Link* node)
+{
+    return node->left_.load() == nullptr || node->right_.load() == nullptr;
+}
+
+/**
+* Returns the key of a node below the holder, which is the only link
+* without one.
+*/
+template<class Key, class Value, class Compare>
+const Key& OptimisticAVLTree<Key, Value, Compare>::keyOf(Link* node)
+{
+    return *reinterpret_cast<const Key*>(&node->key_);
+}
+
+/**
+* Returns the height of the subtree at node, clearing balanced if any
+* node in it is out of balance.
+*/
+template<class Key, class Value, class Compare>
+int OptimisticAVLTree<Key, Value, Compare>::checkBalance(Link* node, bool& balanced) const
+{
+    if (node == nullptr){
+        return 0;
+    }
+    int left = checkBalance(node->left_.load(), balanced);
+    int right = checkBalance(node->right_.load(), balanced);
+    if (left - right > 1 || right - left > 1){
+        balanced = false;
+    }
+    return 1 + (left > right ? left : right);
+}
+
+/**
+* Calls f on the keys below node in order, skipping routing nodes.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+void OptimisticAVLTree<Key, Value, Compare>::visit(Link* node, F& f) const
+{
+    while (node != nullptr){
+        visit(node->left_.load(), f);
+        Value* value = node->value_.load();
+        if (value != nullptr){
+            f(keyOf(node), *value);
+        }
+        node = node->right_.load();
+    }
+}
+
+/**
+* Frees the nodes and values below node, none of which any thread can
+* reach any more.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::destroySubtree(Link* node)
+{
+    while (node != nullptr){
+        destroySubtree(node->left_.load());
+        Link* right = node->right_.load();
+        Value* value = node->value_.load();
+        if (value != &static_cast<Node*>(node)->initial_){
+            delete value;
+        }
+        destroyNode(node);
+        node = right;
+    }
+}
+
+/**
+* Retires a value taken out of node, unless it is the one stored in the
+* node itself, which goes when the node does.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::retireValue(Link* node, Value* value, Handle& handle)
+{
+    if (value != &static_cast<Node*>(node)->initial_){
+        handle.retire(&reclaimValue, value);
+    }
+}
+
+/**
+* Destroys node and gives its slot back to the pool. Except at teardown,
+* the reclaimer's lock must be held, as it is while the reclaimer frees.
+*/
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::destroyNode(Link* node)
+{
+    Node* doomed = static_cast<Node*>(node);
+    doomed->~Node();
+    pool_.deallocate(doomed);
+}
+
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::reclaimNode(void* tree, void* node)
+{
+    static_cast<OptimisticAVLTree<Key, Value, Compare>*>(tree)->destroyNode(static_cast<Link*>(node));
+}
+
+template<class Key, class Value, class Compare>
+void OptimisticAVLTree<Key, Value, Compare>::reclaimValue(void*, void* value)
+{
+    delete static_cast<Value*>(value);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the OptimisticAVLTree class.
+  -----------------------------------------
+*/
+
+#endif
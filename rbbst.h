@@ -0,0 +1,673 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds its color.
+*
+* Compiling with -DAVL_PACKED_BALANCE drops the red_ member and keeps the color in
+* the lowest bit of the parent pointer instead, just as AVLNode does with its balance.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    RBNode(typename Node<Key, Value>::ItemMaker make, void* context, RBNode<Key, Value>* parent);
+
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Redefined to return RBNodes, hiding the Node versions; see Node
+    RBNode<Key, Value>* getParent() const;
+    RBNode<Key, Value>* getLeft() const;
+    RBNode<Key, Value>* getRight() const;
+
+protected:
+#ifndef AVL_PACKED_BALANCE
+    bool red_;
+#endif
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------
+*/
+
+/**
+* Builds a red node, the color every node is inserted with.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent) :
+#ifdef AVL_PACKED_BALANCE
+    Node<Key, Value>(key, value, parent)
+{
+    static_assert(alignof(Node<Key, Value>) > Node<Key, Value>::PACKED_TAG_MASK,
+                  "AVL_PACKED_BALANCE needs 8-byte aligned nodes");
+    setRed(true);
+}
+#else
+    Node<Key, Value>(key, value, parent), red_(true)
+{
+
+}
+#endif
+
+/**
+* A constructor that builds the item in place; see Node.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(typename Node<Key, Value>::ItemMaker make, void* context, RBNode<Key, Value>* parent) :
+#ifdef AVL_PACKED_BALANCE
+    Node<Key, Value>(make, context, parent)
+{
+    setRed(true);
+}
+#else
+    Node<Key, Value>(make, context, parent), red_(true)
+{
+
+}
+#endif
+
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+#ifdef AVL_PACKED_BALANCE
+    return (this->parent_ & 1) != 0;
+#else
+    return red_;
+#endif
+}
+
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+#ifdef AVL_PACKED_BALANCE
+    this->parent_ = (this->parent_ & ~uintptr_t(1)) | uintptr_t(red);
+#else
+    red_ = red;
+#endif
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(Node<Key, Value>::getParent());
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------
+*/
+
+/**
+* A red-black tree: the same map as AVLTree, under a looser balance rule
+* (no path from a node down is more than twice as long as another) that
+* is cheaper to restore. An insert makes at most two rotations and a
+* remove at most three, where AVLTree::remove may rotate at every level
+* on its way back up, and the recoloring that fixes up the rest takes
+* O(1) amortized steps. The price is a tree up to about 2 log n tall
+* rather than 1.44 log n, so lookups can be a little longer.
+*
+* Nodes keep no heights, so height() and isBalanced() walk the tree, in
+* O(n). A red-black tree need not be height-balanced in the AVL sense, so
+* isBalanced() can be false.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class RedBlackTree : public BinarySearchTree<Key, Value, Compare>
+{
+public:
+    RedBlackTree();
+    explicit RedBlackTree(const Compare& comp);
+    template<typename Iterator>
+    RedBlackTree(Iterator first, Iterator last, const Compare& comp = Compare());
+    virtual void remove(const Key& key);
+    template<typename Iterator>
+    void buildFromSorted(Iterator first, Iterator last);
+
+protected:
+    virtual void nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2);
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key,
+                                         const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                         bool& inserted);
+    virtual Node<Key, Value>* newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make, void* context);
+    virtual int heightAt(Node<Key, Value>* top) const;
+    virtual bool balancedAt(Node<Key, Value>* top) const;
+
+    void rotateLeft(RBNode<Key, Value>* upperNode);
+    void rotateRight(RBNode<Key, Value>* upperNode);
+    void insertFix(RBNode<Key, Value>* node);
+    void removeFix(RBNode<Key, Value>* node, RBNode<Key, Value>* parent);
+    template<typename Iterator>
+    RBNode<Key, Value>* buildSubtree(Iterator& curr, Iterator last, size_t count,
+                                     RBNode<Key, Value>* parent, int depth, int redDepth);
+    static bool isRed(const RBNode<Key, Value>* node);
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the RedBlackTree class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor, which sets the node pool up for RBNodes.
+*/
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RBNode<Key, Value>), alignof(RBNode<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<RBNode<Key, Value> >)
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RBNode<Key, Value>), alignof(RBNode<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<RBNode<Key, Value> >, comp)
+{
+
+}
+
+/**
+* Constructs a tree from a range sorted by key under comp; see
+* buildFromSorted.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+RedBlackTree<Key, Value, Compare>::RedBlackTree(Iterator first, Iterator last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RBNode<Key, Value>), alignof(RBNode<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<RBNode<Key, Value> >, comp)
+{
+    buildFromSorted(first, last);
+}
+
+/**
+* Replaces the contents of the tree with the key/value pairs in
+* [first, last), which must be sorted by key, with the same rules and
+* guarantees as AVLTree::buildFromSorted. The tree is built perfectly
+* balanced, with the nodes on its deepest level red and all others black.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+void RedBlackTree<Key, Value, Compare>::buildFromSorted(Iterator first, Iterator last)
+{
+    //count the distinct keys, checking the order on the way
+    size_t count = 0;
+    for (Iterator curr = first; curr != last; ){
+        Iterator next = curr;
+        ++next;
+        if (next != last && this->comp_(next->first, curr->first)){
+            throw std::invalid_argument("buildFromSorted: range is not sorted");
+        }
+        if (next == last || this->comp_(curr->first, next->first)){
+            ++count;
+        }
+        curr = next;
+    }
+
+    //splitting in halves puts every empty child on the last two levels,
+    //so coloring just the last one red gives every path as many blacks;
+    //a lone root stays black
+    int height = 0;
+    for (size_t rest = count; rest != 0; rest /= 2){
+        ++height;
+    }
+    int redDepth = height > 1 ? height : 0;
+
+    this->clear();
+    this->adoptRoot(buildSubtree(first, last, count, static_cast<RBNode<Key, Value>*>(nullptr), 1, redDepth));
+    this->relinkThreads();
+}
+
+/**
+* Builds a perfectly balanced subtree from the next count distinct keys
+* starting at curr, whose root is at the given depth (1 for the root of
+* the tree), and advances curr past them. Nodes at redDepth are red.
+*/
+template<class Key, class Value, class Compare>
+template<typename Iterator>
+RBNode<Key, Value>* RedBlackTree<Key, Value, Compare>::buildSubtree(Iterator& curr, Iterator last, size_t count,
+                                                                    RBNode<Key, Value>* parent, int depth, int redDepth)
+{
+    if (count == 0){
+        return nullptr;
+    }
+
+    size_t leftCount = (count - 1) / 2;
+    RBNode<Key, Value>* leftChild = buildSubtree(curr, last, leftCount, static_cast<RBNode<Key, Value>*>(nullptr),
+                                                 depth + 1, redDepth);
+
+    //skip to the last of a run of equal keys
+    Iterator next = curr;
+    ++next;
+    while (next != last && !this->comp_(curr->first, next->first)){
+        curr = next;
+        ++next;
+    }
+
+    RBNode<Key, Value>* node;
+    try {
+        node = this->createNode(curr->first, curr->second, parent);
+    }
+    catch(...) {
+        this->destroySubtree(leftChild);
+        throw;
+    }
+    curr = next;
+    node->setRed(depth == redDepth);
+
+    node->setLeft(leftChild);
+    if (leftChild != nullptr){
+        leftChild->setParent(node);
+    }
+
+    try {
+        node->setRight(buildSubtree(curr, last, count - 1 - leftCount, node, depth + 1, redDepth));
+    }
+    catch(...) {
+        this->destroySubtree(node);
+        throw;
+    }
+    node->updateSize();
+    return node;
+}
+
+/**
+* Finds or inserts key as BinarySearchTree::insertFrom does, and
+* restores the red-black rules after an insert.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* RedBlackTree<Key, Value, Compare>::insertFrom(Node<Key, Value>* start, const Key& key,
+                                                                const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                                                bool& inserted)
+{
+    inserted = true;
+
+    //the root is always black
+    if (this->root_ == nullptr){
+        RBNode<Key, Value>* root = this->placeNode(source, static_cast<RBNode<Key, Value>*>(nullptr));
+        root->setRed(false);
+        this->root_ = root;
+        this->noteInserted(root);
+        return root;
+    }
+
+    RBNode<Key, Value>* curr = static_cast<RBNode<Key, Value>*>(start);
+    RBNode<Key, Value>* aboveNode = nullptr;
+    bool goLeft = false;
+    while (curr != nullptr){
+        aboveNode = curr;
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+
+        //the key exists; set it
+        if (order.equivalent){
+            inserted = false;
+            if (source.node != nullptr){
+                this->destroyNode(source.node);
+            }
+            if (source.assign != nullptr){
+                source.assign(source.context, curr->getValue());
+            }
+            return curr;
+        }
+        goLeft = order.less;
+        curr = goLeft ? curr->getLeft() : curr->getRight();
+    }
+
+    //a node moved in keeps the color it had, so paint it red
+    RBNode<Key, Value>* nodeToInsert = this->placeNode(source, aboveNode);
+    nodeToInsert->setRed(true);
+    if (goLeft){
+        aboveNode->setLeft(nodeToInsert);
+    }
+    else{
+        aboveNode->setRight(nodeToInsert);
+    }
+
+    this->noteInserted(nodeToInsert);
+    this->updateSizesUpward(aboveNode);
+    insertFix(nodeToInsert);
+    return nodeToInsert;
+}
+
+/**
+* Repairs a red node with a red parent, starting from a freshly inserted
+* red node. While the uncle is red too, the grandparent takes the red
+* from both and the problem moves two levels up; otherwise one or two
+* rotations settle it for good.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::insertFix(RBNode<Key, Value>* node)
+{
+    RBNode<Key, Value>* parent = node->getParent();
+    while (isRed(parent)){
+        //a red parent is never the root, so there is a grandparent
+        RBNode<Key, Value>* grandparent = parent->getParent();
+        if (parent == grandparent->getLeft()){
+            RBNode<Key, Value>* uncle = grandparent->getRight();
+            if (isRed(uncle)){
+                parent->setRed(false);
+                uncle->setRed(false);
+                grandparent->setRed(true);
+                node = grandparent;
+                parent = node->getParent();
+                continue;
+            }
+            //an inner grandchild first becomes an outer one
+            if (node == parent->getRight()){
+                rotateLeft(parent);
+                node = parent;
+                parent = node->getParent();
+            }
+            parent->setRed(false);
+            grandparent->setRed(true);
+            rotateRight(grandparent);
+            break;
+        }
+        else{
+            RBNode<Key, Value>* uncle = grandparent->getLeft();
+            if (isRed(uncle)){
+                parent->setRed(false);
+                uncle->setRed(false);
+                grandparent->setRed(true);
+                node = grandparent;
+                parent = node->getParent();
+                continue;
+            }
+            if (node == parent->getLeft()){
+                rotateRight(parent);
+                node = parent;
+                parent = node->getParent();
+            }
+            parent->setRed(false);
+            grandparent->setRed(true);
+            rotateLeft(grandparent);
+            break;
+        }
+    }
+    static_cast<RBNode<Key, Value>*>(this->root_)->setRed(false);
+}
+
+/*
+ * As in AVLTree, a node with 2 children is swapped with its
+ * predecessor and then removed.
+ */
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::remove(const Key& key)
+{
+    RBNode<Key, Value>* curr = static_cast<RBNode<Key, Value>*>(this->root_);
+    while (curr != nullptr){
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+        if (order.equivalent){
+            break;
+        }
+        curr = order.less ? curr->getLeft() : curr->getRight();
+    }
+
+    //exit if the item to remove is not found
+    if (curr == nullptr){
+        return;
+    }
+    this->noteRemoving(curr);
+
+    //with two children, swap with the predecessor, which has no right child
+    if (curr->getLeft() != nullptr && curr->getRight() != nullptr){
+        nodeSwap(curr, static_cast<RBNode<Key, Value>*>(BinarySearchTree<Key, Value, Compare>::predecessor(curr)));
+    }
+
+    //curr has at most one child now, which takes its place
+    RBNode<Key, Value>* child = curr->getLeft() != nullptr ? curr->getLeft() : curr->getRight();
+    RBNode<Key, Value>* parent = curr->getParent();
+    if (child != nullptr){
+        child->setParent(parent);
+    }
+    if (parent == nullptr){
+        this->root_ = child;
+    }
+    else if (parent->getLeft() == curr){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+    this->updateSizesUpward(parent);
+
+    //taking out a black node shortens the paths through it by one black
+    if (!curr->isRed()){
+        if (isRed(child)){
+            child->setRed(false);
+        }
+        else{
+            removeFix(child, parent);
+        }
+    }
+    this->destroyNode(curr);
+}
+
+/**
+* Repairs a subtree at node (possibly empty), under parent, whose paths
+* have one black too few. A red sibling is first rotated above parent so
+* that the sibling is black. If the sibling's children are both black,
+* the sibling turns red and the shortage moves up to parent; otherwise
+* one or two rotations lend a black from the sibling's side and finish.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::removeFix(RBNode<Key, Value>* node, RBNode<Key, Value>* parent)
+{
+    while (parent != nullptr && !isRed(node)){
+        //the short side has a black fewer, so the sibling is never empty
+        if (node == parent->getLeft()){
+            RBNode<Key, Value>* sibling = parent->getRight();
+            if (sibling->isRed()){
+                sibling->setRed(false);
+                parent->setRed(true);
+                rotateLeft(parent);
+                sibling = parent->getRight();
+            }
+            if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+                sibling->setRed(true);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+            if (!isRed(sibling->getRight())){
+                sibling->getLeft()->setRed(false);
+                sibling->setRed(true);
+                rotateRight(sibling);
+                sibling = parent->getRight();
+            }
+            sibling->setRed(parent->isRed());
+            parent->setRed(false);
+            sibling->getRight()->setRed(false);
+            rotateLeft(parent);
+            return;
+        }
+        else{
+            RBNode<Key, Value>* sibling = parent->getLeft();
+            if (sibling->isRed()){
+                sibling->setRed(false);
+                parent->setRed(true);
+                rotateRight(parent);
+                sibling = parent->getLeft();
+            }
+            if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+                sibling->setRed(true);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+            if (!isRed(sibling->getLeft())){
+                sibling->getRight()->setRed(false);
+                sibling->setRed(true);
+                rotateLeft(sibling);
+                sibling = parent->getLeft();
+            }
+            sibling->setRed(parent->isRed());
+            parent->setRed(false);
+            sibling->getLeft()->setRed(false);
+            rotateRight(parent);
+            return;
+        }
+    }
+    //a red node absorbs the missing black; the root can simply drop it
+    if (node != nullptr){
+        node->setRed(false);
+    }
+}
+
+/**
+* Creates a detached RBNode with its item built by make(context).
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* RedBlackTree<Key, Value, Compare>::newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make,
+                                                             void* context)
+{
+    return this->template createNode<RBNode<Key, Value> >(make, context, nullptr);
+}
+
+/**
+* Swaps two nodes' places as BinarySearchTree::nodeSwap does, and their
+* colors with them, since a color belongs to a position in the tree.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2)
+{
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
+    bool red = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(red);
+}
+
+/**
+* Returns the height of the subtree at top, in O(n).
+*/
+template<class Key, class Value, class Compare>
+int RedBlackTree<Key, Value, Compare>::heightAt(Node<Key, Value>* top) const
+{
+    bool balanced;
+    return this->measureSubtree(top, balanced);
+}
+
+/**
+* Returns whether the subtree at top is height-balanced in the AVL sense,
+* which the red-black rules alone do not promise, in O(n).
+*/
+template<class Key, class Value, class Compare>
+bool RedBlackTree<Key, Value, Compare>::balancedAt(Node<Key, Value>* top) const
+{
+    bool balanced;
+    this->measureSubtree(top, balanced);
+    return balanced;
+}
+
+/**
+* Rotates upperNode's right child above it.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::rotateLeft(RBNode<Key, Value>* upperNode)
+{
+    RBNode<Key, Value>* rightChild = upperNode->getRight();
+
+    //the right child's left subtree moves over to upperNode
+    RBNode<Key, Value>* inner = rightChild->getLeft();
+    upperNode->setRight(inner);
+    if (inner != nullptr){
+        inner->setParent(upperNode);
+    }
+
+    //the right child takes upperNode's place
+    RBNode<Key, Value>* above = upperNode->getParent();
+    rightChild->setParent(above);
+    if (above == nullptr){
+        this->root_ = rightChild;
+    }
+    else if (above->getLeft() == upperNode){
+        above->setLeft(rightChild);
+    }
+    else{
+        above->setRight(rightChild);
+    }
+
+    rightChild->setLeft(upperNode);
+    upperNode->setParent(rightChild);
+
+    upperNode->updateSize();
+    rightChild->updateSize();
+    this->rotations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* Rotates upperNode's left child above it.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::rotateRight(RBNode<Key, Value>* upperNode)
+{
+    RBNode<Key, Value>* leftChild = upperNode->getLeft();
+
+    //the left child's right subtree moves over to upperNode
+    RBNode<Key, Value>* inner = leftChild->getRight();
+    upperNode->setLeft(inner);
+    if (inner != nullptr){
+        inner->setParent(upperNode);
+    }
+
+    //the left child takes upperNode's place
+    RBNode<Key, Value>* above = upperNode->getParent();
+    leftChild->setParent(above);
+    if (above == nullptr){
+        this->root_ = leftChild;
+    }
+    else if (above->getLeft() == upperNode){
+        above->setLeft(leftChild);
+    }
+    else{
+        above->setRight(leftChild);
+    }
+
+    leftChild->setRight(upperNode);
+    upperNode->setParent(leftChild);
+
+    upperNode->updateSize();
+    leftChild->updateSize();
+    this->rotations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* Empty subtrees count as black.
+*/
+template<class Key, class Value, class Compare>
+bool RedBlackTree<Key, Value, Compare>::isRed(const RBNode<Key, Value>* node)
+{
+    return node != nullptr && node->isRed();
+}
+
+/*
+  -----------------------------------------
+  End implementations for the RedBlackTree class.
+  -----------------------------------------
+*/
+
+#endif
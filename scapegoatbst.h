@@ -0,0 +1,379 @@
+#ifndef SCAPEGOATBST_H
+#define SCAPEGOATBST_H
+
+#include <cmath>
+#include <functional>
+#include "bst.h"
+
+// How lopsided a scapegoat subtree may get: no child may hold more than
+// this share of its parent's nodes. Between 0.5 and 1; lower keeps the
+// tree shorter at the cost of rebuilding more often.
+#ifndef SCAPEGOAT_ALPHA
+#define SCAPEGOAT_ALPHA 0.6
+#endif
+
+/**
+* A scapegoat tree (Galperin and Rivest): a search tree that keeps no
+* balance information in its nodes at all. It stores plain Nodes, as
+* small as a node can be, and keeps just two counts for the whole tree.
+*
+* An insert that lands deeper than log base 1/alpha of the tree's size
+* walks back up to the first ancestor whose subtree is lopsided by more
+* than SCAPEGOAT_ALPHA allows, the scapegoat, and rebuilds that subtree
+* perfectly balanced. Once removes have shrunk the tree below alpha
+* times its largest size since the last full rebuild, the whole tree is
+* rebuilt. Either way the height stays O(log n) and inserts and removes
+* take O(log n) amortized time; lookups are plain descents that never
+* write to the tree.
+*
+* Nodes keep no heights, so height() and isBalanced() walk the tree, in
+* O(n).
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class ScapegoatTree : public BinarySearchTree<Key, Value, Compare>
+{
+public:
+    ScapegoatTree();
+    explicit ScapegoatTree(const Compare& comp);
+    virtual void remove(const Key& key);
+
+protected:
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key,
+                                         const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                         bool& inserted);
+    virtual Node<Key, Value>* newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make, void* context);
+    virtual int heightAt(Node<Key, Value>* top) const;
+    virtual bool balancedAt(Node<Key, Value>* top) const;
+
+    void rebuildAbove(Node<Key, Value>* node);
+    void rebuild(Node<Key, Value>* top, size_t count);
+    static Node<Key, Value>* linkBalanced(Node<Key, Value>*& list, size_t count, Node<Key, Value>* parent);
+    static size_t countSubtree(Node<Key, Value>* top);
+    static size_t depthLimit(size_t size);
+
+    // Nodes in the tree, and the most there have been since the whole
+    // tree was last rebuilt; both are reset when an insert finds it empty
+    size_t count_;
+    size_t maxCount_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the ScapegoatTree class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor, which sets the node pool up for plain Nodes.
+*/
+template<class Key, class Value, class Compare>
+ScapegoatTree<Key, Value, Compare>::ScapegoatTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(Node<Key, Value>), alignof(Node<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<Node<Key, Value> >),
+    count_(0),
+    maxCount_(0)
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+ScapegoatTree<Key, Value, Compare>::ScapegoatTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(Node<Key, Value>), alignof(Node<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<Node<Key, Value> >, comp),
+    count_(0),
+    maxCount_(0)
+{
+
+}
+
+/**
+* Finds or inserts key as BinarySearchTree::insertFrom does, and rebuilds
+* the subtree of a scapegoat if the new node is too deep.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* ScapegoatTree<Key, Value, Compare>::insertFrom(Node<Key, Value>* start, const Key& key,
+                                                                 const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                                                 bool& inserted)
+{
+    inserted = true;
+
+    //insert if tree is empty; clear() does not know about the counts
+    if (this->root_ == nullptr){
+        this->root_ = this->template placeNode<Node<Key, Value> >(source, nullptr);
+        this->noteInserted(this->root_);
+        count_ = 1;
+        maxCount_ = 1;
+        return this->root_;
+    }
+
+    //a hinted or appending search starts below the root
+    size_t depth = 0;
+    for (Node<Key, Value>* above = start->getParent(); above != nullptr; above = above->getParent()){
+        ++depth;
+    }
+
+    Node<Key, Value>* curr = start;
+    while (true){
+        ++depth;
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+        //the key exists
+        if (order.equivalent){
+            inserted = false;
+            if (source.node != nullptr){
+                this->destroyNode(source.node);
+            }
+            if (source.assign != nullptr){
+                source.assign(source.context, curr->getValue());
+            }
+            return curr;
+        }
+
+        bool goLeft = order.less;
+        Node<Key, Value>* next = goLeft ? curr->getLeft() : curr->getRight();
+
+        //if the child is empty, insert there
+        if (next == nullptr){
+            next = this->placeNode(source, curr);
+            if (goLeft){
+                curr->setLeft(next);
+            }
+            else{
+                curr->setRight(next);
+            }
+            this->noteInserted(next);
+            BinarySearchTree<Key, Value, Compare>::updateSizesUpward(curr);
+            ++count_;
+            if (count_ > maxCount_){
+                maxCount_ = count_;
+            }
+            if (depth > depthLimit(maxCount_)){
+                rebuildAbove(next);
+            }
+            return next;
+        }
+        curr = next;
+    }
+}
+
+/**
+* Removes key as the plain tree does, swapping a node with two children
+* with its predecessor first, and rebuilds the whole tree once it has
+* shrunk to less than alpha of its size at the last full rebuild.
+*/
+template<class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Node<Key, Value>* curr = this->findNode(key);
+    if (curr == nullptr){
+        return;
+    }
+    this->noteRemoving(curr);
+
+    //with two children, swap with the predecessor, which has no right child
+    if (curr->getLeft() != nullptr && curr->getRight() != nullptr){
+        this->nodeSwap(curr, BinarySearchTree<Key, Value, Compare>::predecessor(curr));
+    }
+
+    //curr has at most one child now, which takes its place
+    Node<Key, Value>* child = curr->getLeft() != nullptr ? curr->getLeft() : curr->getRight();
+    Node<Key, Value>* parent = curr->getParent();
+    if (child != nullptr){
+        child->setParent(parent);
+    }
+    if (parent == nullptr){
+        this->root_ = child;
+    }
+    else if (parent->getLeft() == curr){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+    BinarySearchTree<Key, Value, Compare>::updateSizesUpward(parent);
+    this->destroyNode(curr);
+
+    --count_;
+    if (double(count_) < SCAPEGOAT_ALPHA * double(maxCount_)){
+        if (this->root_ != nullptr){
+            rebuild(this->root_, count_);
+        }
+        maxCount_ = count_;
+    }
+}
+
+/**
+* Creates a detached plain Node with its item built by make(context).
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* ScapegoatTree<Key, Value, Compare>::newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make,
+                                                              void* context)
+{
+    return this->template createNode<Node<Key, Value> >(make, context, static_cast<Node<Key, Value>*>(nullptr));
+}
+
+/**
+* Returns the height of the subtree at top, in O(n).
+*/
+template<class Key, class Value, class Compare>
+int ScapegoatTree<Key, Value, Compare>::heightAt(Node<Key, Value>* top) const
+{
+    bool balanced;
+    return this->measureSubtree(top, balanced);
+}
+
+/**
+* Returns whether the subtree at top is height-balanced in the AVL sense,
+* which a scapegoat tree does not promise, in O(n).
+*/
+template<class Key, class Value, class Compare>
+bool ScapegoatTree<Key, Value, Compare>::balancedAt(Node<Key, Value>* top) const
+{
+    bool balanced;
+    this->measureSubtree(top, balanced);
+    return balanced;
+}
+
+/**
+* Called for a newly linked leaf that is deeper than the tree's size
+* allows. Climbs towards the root adding up subtree sizes until it
+* reaches the scapegoat, an ancestor with a child holding more than alpha
+* of its nodes, which a path that deep always has, and rebuilds it.
+* Finding and rebuilding the scapegoat take time in proportion to its
+* size, which the inserts that made it lopsided have paid for.
+*/
+template<class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::rebuildAbove(Node<Key, Value>* node)
+{
+    Node<Key, Value>* child = node;
+    size_t childCount = 1;
+    Node<Key, Value>* parent = node->getParent();
+    while (parent != nullptr){
+        Node<Key, Value>* sibling = parent->getLeft() == child ? parent->getRight() : parent->getLeft();
+        size_t parentCount = childCount + 1 + countSubtree(sibling);
+        if (double(childCount) > SCAPEGOAT_ALPHA * double(parentCount)){
+            rebuild(parent, parentCount);
+            return;
+        }
+        child = parent;
+        childCount = parentCount;
+        parent = parent->getParent();
+    }
+}
+
+/**
+* Relinks the count nodes of the subtree at top into a perfectly balanced
+* subtree in the same place, without allocating: the nodes are first
+* chained in key order through their right links. Key order is
+* unchanged, so the cached end nodes and the threads stay valid.
+*/
+template<class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::rebuild(Node<Key, Value>* top, size_t count)
+{
+    Node<Key, Value>* parent = top->getParent();
+    bool wasLeft = parent != nullptr && parent->getLeft() == top;
+
+    //walk down from the largest key; predecessor only follows the right
+    //links of smaller nodes, which are not relinked yet
+    Node<Key, Value>* curr = top;
+    while (curr->getRight() != nullptr){
+        curr = curr->getRight();
+    }
+    Node<Key, Value>* list = nullptr;
+    for (size_t i = 0; i < count; ++i){
+        Node<Key, Value>* prev = BinarySearchTree<Key, Value, Compare>::predecessor(curr);
+        curr->setRight(list);
+        list = curr;
+        curr = prev;
+    }
+
+    Node<Key, Value>* rebuilt = linkBalanced(list, count, parent);
+    if (parent == nullptr){
+        this->root_ = rebuilt;
+    }
+    else if (wasLeft){
+        parent->setLeft(rebuilt);
+    }
+    else{
+        parent->setRight(rebuilt);
+    }
+}
+
+/**
+* Takes the first count nodes off list, which is chained in key order
+* through the right links, links them into a perfectly balanced subtree
+* below parent and returns its root.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* ScapegoatTree<Key, Value, Compare>::linkBalanced(Node<Key, Value>*& list, size_t count,
+                                                                   Node<Key, Value>* parent)
+{
+    if (count == 0){
+        return nullptr;
+    }
+    size_t leftCount = count / 2;
+    Node<Key, Value>* leftChild = linkBalanced(list, leftCount, nullptr);
+    Node<Key, Value>* node = list;
+    list = node->getRight();
+
+    node->setParent(parent);
+    node->setLeft(leftChild);
+    if (leftChild != nullptr){
+        leftChild->setParent(node);
+    }
+    node->setRight(linkBalanced(list, count - leftCount - 1, node));
+    node->updateSize();
+    return node;
+}
+
+/**
+* Returns the number of nodes in the subtree at top: in O(1) from the
+* stored sizes when BST_ORDER_STATISTICS keeps them, and otherwise by
+* walking it in key order with successor until the walk leaves it.
+*/
+template<class Key, class Value, class Compare>
+size_t ScapegoatTree<Key, Value, Compare>::countSubtree(Node<Key, Value>* top)
+{
+#ifdef BST_ORDER_STATISTICS
+    return BinarySearchTree<Key, Value, Compare>::subtreeSize(top);
+#else
+    if (top == nullptr){
+        return 0;
+    }
+    Node<Key, Value>* last = top;
+    while (last->getRight() != nullptr){
+        last = last->getRight();
+    }
+    Node<Key, Value>* curr = top;
+    while (curr->getLeft() != nullptr){
+        curr = curr->getLeft();
+    }
+    size_t count = 1;
+    while (curr != last){
+        curr = BinarySearchTree<Key, Value, Compare>::successor(curr);
+        ++count;
+    }
+    return count;
+#endif
+}
+
+/**
+* The deepest a node may sit, counting the root as depth 0, in a tree
+* that has held size nodes since its last full rebuild: log base 1/alpha
+* of size.
+*/
+template<class Key, class Value, class Compare>
+size_t ScapegoatTree<Key, Value, Compare>::depthLimit(size_t size)
+{
+    return size_t(std::log(double(size)) / std::log(1.0 / SCAPEGOAT_ALPHA));
+}
+
+/*
+  -----------------------------------------
+  End implementations for the ScapegoatTree class.
+  -----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,170 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdexcept>
+// Fork at every level, so that even small trees are combined on several
+// threads at once
+#ifndef AVL_PARALLEL_GRAIN_HEIGHT
+#define AVL_PARALLEL_GRAIN_HEIGHT 1
+#endif
+#include "avlbst.h"
+#include "fork_join_pool.h"
+
+using namespace std;
+
+typedef AVLTree<int, int> Tree;
+typedef map<int, int> Model;
+
+/**
+ * Returns whether tree holds exactly model's items, in key order, and is
+ * balanced, printing what is wrong if not.
+ */
+bool matches(const Tree& tree, const Model& model, const string& what)
+{
+    Model::const_iterator expected = model.begin();
+    for(Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++expected) {
+        if(expected == model.end() || it->first != expected->first || it->second != expected->second) {
+            cout << what << ": wrong item at key " << it->first << endl;
+            return false;
+        }
+    }
+    if(expected != model.end()) {
+        cout << what << ": missing key " << expected->first << endl;
+        return false;
+    }
+    if(!tree.isBalanced()) {
+        cout << what << ": not balanced" << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Fills tree and model with up to count random keys below range, with
+ * values that tell which operand they came from.
+ */
+void fill(Tree& tree, Model& model, mt19937& rng, int count, int range, int tag)
+{
+    for(int i = 0; i < count; ++i) {
+        int key = (int)(rng() % range);
+        tree.insert(make_pair(key, key * 2 + tag));
+        model[key] = key * 2 + tag;
+    }
+}
+
+/**
+ * One round of the randomized check: two random trees of unrelated sizes,
+ * up to largest keys, over one key range, combined with each set
+ * operation through the pool and checked against std::map. The result is
+ * written into one of the operands on odd rounds, since either may be the
+ * result tree.
+ */
+bool checkRound(ForkJoinPool& pool, mt19937& rng, int index, int largest)
+{
+    const int sizes[] = { 0, 1, 7, 50, largest / 100, largest / 10, largest };
+    int leftCount = sizes[rng() % 7];
+    int rightCount = sizes[rng() % 7];
+    int range = 1 + (int)(rng() % (4 * largest));
+    // Two big operands of different heights give long stretches of
+    // parallel work with many rotations in the joins
+    if(index % 10 == 0) {
+        leftCount = largest / 5;
+        rightCount = largest;
+        range = 4 * largest;
+    }
+    string name = "round " + to_string(index);
+    bool passed = true;
+
+    for(int op = 0; op < 3; ++op) {
+        Tree left;
+        Tree right;
+        Model leftModel;
+        Model rightModel;
+        fill(left, leftModel, rng, leftCount, range, 0);
+        fill(right, rightModel, rng, rightCount, range, 1);
+
+        Model expected;
+        if(op == 0) {
+            expected = leftModel;
+            for(Model::iterator it = rightModel.begin(); it != rightModel.end(); ++it) expected[it->first] = it->second;
+        }
+        for(Model::iterator it = leftModel.begin(); it != leftModel.end(); ++it) {
+            bool inRight = rightModel.count(it->first) == 1;
+            if((op == 1 && inRight) || (op == 2 && !inRight)) expected.insert(*it);
+        }
+
+        Tree separate;
+        Tree& result = index % 2 == 1 ? left : separate;
+        const char* names[] = { " union", " intersection", " difference" };
+        if(op == 0) result.setUnion(left, right, pool);
+        else if(op == 1) result.setIntersection(left, right, pool);
+        else result.setDifference(left, right, pool);
+        passed = matches(result, expected, name + names[op]) && passed;
+        if(&result != &left && !left.empty()) {
+            cout << name << names[op] << ": left operand not emptied" << endl;
+            passed = false;
+        }
+        if(!right.empty()) {
+            cout << name << names[op] << ": right operand not emptied" << endl;
+            passed = false;
+        }
+    }
+
+    // split at a random key, present or not, then join the halves back
+    Tree tree;
+    Model model;
+    fill(tree, model, rng, leftCount, range, 0);
+    int key = (int)(rng() % (range + 1));
+    Tree less;
+    Tree greater;
+    tree.split(key, less, greater);
+    Model lessModel(model.begin(), model.lower_bound(key));
+    Model greaterModel(model.lower_bound(key), model.end());
+    passed = matches(less, lessModel, name + " split less") && passed;
+    passed = matches(greater, greaterModel, name + " split greater") && passed;
+    tree.join(less, greater);
+    passed = matches(tree, model, name + " join") && passed;
+
+    // join must refuse trees whose keys interleave and change nothing
+    if(model.size() >= 2) {
+        Tree low;
+        Tree high;
+        low.insert(make_pair(model.rbegin()->first, 0));
+        high.insert(make_pair(model.begin()->first, 0));
+        try {
+            tree.join(low, high);
+            cout << name << " join of interleaved trees did not throw" << endl;
+            passed = false;
+        }
+        catch(const invalid_argument&) {
+        }
+        passed = matches(tree, model, name + " failed join") && passed;
+    }
+    return passed;
+}
+
+int main(int argc, char *argv[])
+{
+    // usage: set-ops-test [threads] [rounds] [largest tree]
+    unsigned threads = 4;
+    int rounds = 300;
+    // Big trees keep tasks running long enough to overlap on other
+    // threads, which a race detector needs to see them collide
+    int largest = 2000;
+    if(argc > 1) threads = (unsigned)atoi(argv[1]);
+    if(argc > 2) rounds = atoi(argv[2]);
+    if(argc > 3) largest = atoi(argv[3]);
+
+    ForkJoinPool pool(threads);
+    mt19937 rng(104);
+    int failed = 0;
+    for(int i = 0; i < rounds; ++i) {
+        if(!checkRound(pool, rng, i, largest)) ++failed;
+    }
+    cout << rounds << " rounds on " << threads << " threads: " << failed << " failed" << endl;
+    cout << (failed == 0 ? "PASSED" : "FAILED") << endl;
+    return failed == 0 ? 0 : 1;
+}
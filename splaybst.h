@@ -0,0 +1,379 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <functional>
+#include "bst.h"
+
+/**
+* A self-adjusting search tree: every key inserted, found or removed is
+* rotated up towards the root. Keys that are hit often therefore stay
+* within a few links of the root, so a skewed workload pays for the depth
+* of its working set rather than log n on every lookup. The price is that
+* the tree has no fixed shape; any one operation may take O(n), though m
+* operations take O(m log n) altogether.
+*
+* The restructuring is Sleator and Tarjan's semi-splaying, which moves an
+* accessed node up the path by about half its depth at a time, with the
+* same amortized bounds as splaying it all the way to the root but about
+* half as many rotations. Every rotation rewrites parent links, so fewer
+* of them is what matters once the tree no longer fits in cache.
+*
+* Nodes are plain Nodes. Keeping subtree heights up to date would mean
+* reading both children of every node a rotation moves, so height() and
+* isBalanced() walk the subtree instead, in O(n).
+*
+* Only the non-const find and tryGet restructure the tree. A lookup on a
+* const tree or through a BinarySearchTree reference leaves the shape as
+* it is, as do the bound and range searches.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class SplayTree : public BinarySearchTree<Key, Value, Compare>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Compare>::iterator iterator;
+
+    SplayTree();
+    explicit SplayTree(const Compare& comp);
+    virtual void remove(const Key& key);
+
+    using BinarySearchTree<Key, Value, Compare>::find;
+    using BinarySearchTree<Key, Value, Compare>::tryGet;
+    iterator find(const Key& key);
+    Value* tryGet(const Key& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value* tryGet(const K& key);
+
+protected:
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key,
+                                         const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                         bool& inserted);
+    virtual Node<Key, Value>* newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make, void* context);
+    virtual int heightAt(Node<Key, Value>* top) const;
+    virtual bool balancedAt(Node<Key, Value>* top) const;
+
+    template<typename K>
+    Node<Key, Value>* access(const K& key);
+    void splay(Node<Key, Value>* node);
+    void rotateUp(Node<Key, Value>* node);
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the SplayTree class.
+  -------------------------------------------
+*/
+
+/**
+* Default constructor, which sets the node pool up for plain Nodes.
+*/
+template<class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(Node<Key, Value>), alignof(Node<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<Node<Key, Value> >)
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(Node<Key, Value>), alignof(Node<Key, Value>),
+        &BinarySearchTree<Key, Value, Compare>::template destroyAs<Node<Key, Value> >, comp)
+{
+
+}
+
+/**
+* Looks key up and splays the node it is in. On a miss the last node on
+* the search path is splayed instead, which is what keeps a run of misses
+* from walking the same long path over and over.
+*/
+template<class Key, class Value, class Compare>
+typename SplayTree<Key, Value, Compare>::iterator SplayTree<Key, Value, Compare>::find(const Key& key)
+{
+    return this->iteratorAt(access(key));
+}
+
+/**
+* Like find, but returns a pointer to the value, or NULL on a miss.
+*/
+template<class Key, class Value, class Compare>
+Value* SplayTree<Key, Value, Compare>::tryGet(const Key& key)
+{
+    Node<Key, Value>* found = access(key);
+    return found != nullptr ? &found->getValue() : nullptr;
+}
+
+/**
+* find by any key type a transparent Compare accepts.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename SplayTree<Key, Value, Compare>::iterator SplayTree<Key, Value, Compare>::find(const K& key)
+{
+    return this->iteratorAt(access(key));
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+Value* SplayTree<Key, Value, Compare>::tryGet(const K& key)
+{
+    Node<Key, Value>* found = access(key);
+    return found != nullptr ? &found->getValue() : nullptr;
+}
+
+/**
+* Unlinks key's node the way the plain tree does, trading places with
+* its predecessor first if it has two children, and then splays the
+* parent of the position it was unlinked from.
+*/
+template<class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* last = nullptr;
+    while (curr != nullptr){
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+        if (order.equivalent){
+            break;
+        }
+        last = curr;
+        curr = order.less ? curr->getLeft() : curr->getRight();
+    }
+
+    //key is not found; the path still gets splayed
+    if (curr == nullptr){
+        if (last != nullptr){
+            splay(last);
+        }
+        return;
+    }
+    this->noteRemoving(curr);
+
+    //with two children, swap with the predecessor, which has no right child
+    if (curr->getLeft() != nullptr && curr->getRight() != nullptr){
+        this->nodeSwap(curr, BinarySearchTree<Key, Value, Compare>::predecessor(curr));
+    }
+
+    //curr has at most one child now, which takes its place
+    Node<Key, Value>* child = curr->getLeft() != nullptr ? curr->getLeft() : curr->getRight();
+    Node<Key, Value>* parent = curr->getParent();
+    if (child != nullptr){
+        child->setParent(parent);
+    }
+    if (parent == nullptr){
+        this->root_ = child;
+    }
+    else if (parent->getLeft() == curr){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    BinarySearchTree<Key, Value, Compare>::updateSizesUpward(parent);
+    this->destroyNode(curr);
+    if (parent != nullptr){
+        splay(parent);
+    }
+}
+
+/**
+* Inserts as the plain tree does, less the height bookkeeping, then
+* splays the new or existing node. Every other way in (insert with a
+* hint, emplace, try_emplace, findOrInsert, operator[] on a missing key)
+* comes through here.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::insertFrom(Node<Key, Value>* start, const Key& key,
+                                                             const typename BinarySearchTree<Key, Value, Compare>::ItemSource& source,
+                                                             bool& inserted)
+{
+    inserted = true;
+
+    //insert if tree is empty
+    if (this->root_ == nullptr){
+        this->root_ = this->template placeNode<Node<Key, Value> >(source, nullptr);
+        this->noteInserted(this->root_);
+        return this->root_;
+    }
+
+    Node<Key, Value>* curr = start;
+    while (true){
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+        //the key exists
+        if (order.equivalent){
+            inserted = false;
+            if (source.node != nullptr){
+                this->destroyNode(source.node);
+            }
+            if (source.assign != nullptr){
+                source.assign(source.context, curr->getValue());
+            }
+            splay(curr);
+            return curr;
+        }
+
+        bool goLeft = order.less;
+        Node<Key, Value>* next = goLeft ? curr->getLeft() : curr->getRight();
+
+        //if the child is empty, insert there
+        if (next == nullptr){
+            next = this->placeNode(source, curr);
+            if (goLeft){
+                curr->setLeft(next);
+            }
+            else{
+                curr->setRight(next);
+            }
+            this->noteInserted(next);
+            BinarySearchTree<Key, Value, Compare>::updateSizesUpward(curr);
+            splay(next);
+            return next;
+        }
+        curr = next;
+    }
+}
+
+/**
+* Creates a detached plain Node with its item built by make(context).
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::newNode(typename BinarySearchTree<Key, Value, Compare>::ItemMaker make,
+                                                          void* context)
+{
+    return this->template createNode<Node<Key, Value> >(make, context, static_cast<Node<Key, Value>*>(nullptr));
+}
+
+/**
+* Returns the height of the subtree at top, in O(n).
+*/
+template<class Key, class Value, class Compare>
+int SplayTree<Key, Value, Compare>::heightAt(Node<Key, Value>* top) const
+{
+    bool balanced;
+    return this->measureSubtree(top, balanced);
+}
+
+/**
+* Returns whether every node of the subtree at top is balanced, in O(n).
+*/
+template<class Key, class Value, class Compare>
+bool SplayTree<Key, Value, Compare>::balancedAt(Node<Key, Value>* top) const
+{
+    bool balanced;
+    this->measureSubtree(top, balanced);
+    return balanced;
+}
+
+/**
+* Searches for key and splays the node it is in, or the last node on the
+* search path if it is missing. Returns the node with key, or NULL.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::access(const K& key)
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* last = nullptr;
+    while (curr != nullptr){
+        KeyOrder order = this->orderKeys(key, curr->getKey());
+        if (order.equivalent){
+            splay(curr);
+            return curr;
+        }
+        last = curr;
+        curr = order.less ? curr->getLeft() : curr->getRight();
+    }
+    if (last != nullptr){
+        splay(last);
+    }
+    return nullptr;
+}
+
+/**
+* Semi-splays node: moves it up the path two levels at a time until it
+* is a child of the root or the root itself. When node and its parent
+* are children on the same side (zig-zig), the parent is rotated above
+* the grandparent and the climb carries on from the parent, leaving node
+* where it is; otherwise (zig-zag) node is rotated up twice and the climb
+* carries on from node. Either way the nodes on the path end up about
+* half as deep as before.
+*/
+template<class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::splay(Node<Key, Value>* node)
+{
+    while (node->getParent() != nullptr && node->getParent()->getParent() != nullptr){
+        Node<Key, Value>* parent = node->getParent();
+        Node<Key, Value>* grandparent = parent->getParent();
+        if ((grandparent->getLeft() == parent) == (parent->getLeft() == node)){
+            rotateUp(parent);
+            node = parent;
+        }
+        else{
+            rotateUp(node);
+            rotateUp(node);
+        }
+    }
+}
+
+/**
+* Rotates node above its parent, keeping key order. Only the two of them
+* end up with different subtrees, so only their sizes are recomputed;
+* key order, and with it the threads and the cached first and last
+* nodes, does not change.
+*/
+template<class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::rotateUp(Node<Key, Value>* node)
+{
+    Node<Key, Value>* parent = node->getParent();
+    Node<Key, Value>* grandparent = parent->getParent();
+
+    //the child of node between it and parent changes sides
+    if (parent->getLeft() == node){
+        Node<Key, Value>* inner = node->getRight();
+        parent->setLeft(inner);
+        if (inner != nullptr){
+            inner->setParent(parent);
+        }
+        node->setRight(parent);
+    }
+    else{
+        Node<Key, Value>* inner = node->getLeft();
+        parent->setRight(inner);
+        if (inner != nullptr){
+            inner->setParent(parent);
+        }
+        node->setLeft(parent);
+    }
+    parent->setParent(node);
+
+    //node takes parent's place under grandparent
+    node->setParent(grandparent);
+    if (grandparent == nullptr){
+        this->root_ = node;
+    }
+    else if (grandparent->getLeft() == parent){
+        grandparent->setLeft(node);
+    }
+    else{
+        grandparent->setRight(node);
+    }
+
+    //parent is below node now, so it goes first
+    parent->updateSize();
+    node->updateSize();
+    this->rotations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the SplayTree class.
+  -----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef TREE_RECLAIMER_H
+#define TREE_RECLAIMER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/**
+* A background thread that frees the nodes of cleared trees.
+*
+* Tearing down a tree of tens of millions of nodes takes hundreds of
+* milliseconds, mostly running destructors and returning slabs to the
+* system. A tree given a reclaimer with setReclaimer() instead detaches
+* its nodes and their pool in O(1) when it is cleared or destroyed and
+* hands them over with retire(); the reclaimer's thread does the rest.
+*
+* backlog() tells how many nodes are still waiting to be freed, and
+* drain() waits until there are none, e.g. at shutdown or before taking
+* a memory measurement. The destructor drains too, so a reclaimer must
+* outlive every tree that uses it.
+*/
+class TreeReclaimer
+{
+public:
+    TreeReclaimer();
+    ~TreeReclaimer();
+
+    void retire(void (*reclaim)(void* garbage), void* garbage, size_t nodes);
+    void drain();
+    size_t backlog() const;
+
+private:
+    // Not copyable: the worker holds a pointer to the reclaimer
+    TreeReclaimer(const TreeReclaimer&);
+    TreeReclaimer& operator=(const TreeReclaimer&);
+
+    struct Job
+    {
+        void (*reclaim)(void* garbage);
+        void* garbage;
+        size_t nodes;
+    };
+
+    void workerLoop();
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable drained_;
+    // Handed over but not yet started, oldest first
+    std::deque<Job> pending_;
+    // Nodes in pending_ plus those of the job being run
+    size_t backlog_;
+    bool running_;
+    bool stopping_;
+    std::thread worker_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the TreeReclaimer class.
+  -------------------------------------------
+*/
+
+/**
+* Starts the reclaimer's thread, which sleeps until work arrives.
+*/
+inline TreeReclaimer::TreeReclaimer() :
+    backlog_(0),
+    running_(false),
+    stopping_(false)
+{
+    worker_ = std::thread(&TreeReclaimer::workerLoop, this);
+}
+
+/**
+* Finishes every job handed over so far, then stops the thread.
+*/
+inline TreeReclaimer::~TreeReclaimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+}
+
+/**
+* Queues reclaim(garbage) to run on the reclaimer's thread. nodes is
+* what the job counts for in backlog(). reclaim must not throw. If
+* queueing throws, nothing was queued and the caller still owns garbage.
+*/
+inline void TreeReclaimer::retire(void (*reclaim)(void* garbage), void* garbage, size_t nodes)
+{
+    Job job;
+    job.reclaim = reclaim;
+    job.garbage = garbage;
+    job.nodes = nodes;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(job);
+        backlog_ += nodes;
+    }
+    wake_.notify_one();
+}
+
+/**
+* Blocks until every job handed over so far has finished.
+*/
+inline void TreeReclaimer::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(!pending_.empty() || running_){
+        drained_.wait(lock);
+    }
+}
+
+/**
+* Returns the number of retired nodes not yet freed.
+*/
+inline size_t TreeReclaimer::backlog() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return backlog_;
+}
+
+/**
+* Runs jobs in the order they were retired until stopped with none left.
+*/
+inline void TreeReclaimer::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true){
+        if(pending_.empty()){
+            if(stopping_) return;
+            wake_.wait(lock);
+            continue;
+        }
+        Job job = pending_.front();
+        pending_.pop_front();
+        running_ = true;
+        lock.unlock();
+
+        job.reclaim(job.garbage);
+
+        lock.lock();
+        running_ = false;
+        backlog_ -= job.nodes;
+        if(pending_.empty()){
+            drained_.notify_all();
+        }
+    }
+}
+
+/*
+  -----------------------------------------
+  End implementations for the TreeReclaimer class.
+  -----------------------------------------
+*/
+
+#endif